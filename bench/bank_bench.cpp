@@ -0,0 +1,213 @@
+#include <benchmark/benchmark.h>
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <vector>
+
+#include "engine.h"
+#include "shard.h"
+#include "workload.h"
+
+// Throughput and p50/p99 latency of InitBank on a generated ledger and of
+// each Bank method on its own, across thread counts. Accounts are picked
+// from a Zipf(0.99) distribution over NUM_ACCOUNTS accounts, so a few hot
+// accounts see most of the traffic, as in the skewed ledgers of ledger_gen.
+
+#define NUM_ACCOUNTS 1000
+#define LEDGER_ENTRIES 200000
+
+typedef std::chrono::steady_clock Clock;
+
+// Adds p50/p99 counters for the latency samples of one thread, named after
+// their unit; with several threads the reported value is the average over threads.
+static void report_latency(benchmark::State& state, std::vector<uint32_t>& samples, const std::string& unit) {
+  if (samples.empty()) return;
+  std::sort(samples.begin(), samples.end());
+  state.counters["p50_" + unit] = benchmark::Counter(samples[samples.size() / 2], benchmark::Counter::kAvgThreads);
+  state.counters["p99_" + unit] = benchmark::Counter(samples[samples.size() * 99 / 100], benchmark::Counter::kAvgThreads);
+}
+
+static const std::string& ledger_path() {
+  static std::string path = [] {
+    WorkloadConfig config;
+    config.entries = LEDGER_ENTRIES;
+    config.accounts = NUM_ACCOUNTS;
+    config.zipf = 0.99;
+    std::string p = "/tmp/bank_bench.ledger";
+    write_ledger(p, generate_ledger(config), true);
+    return p;
+  }();
+  return path;
+}
+
+// `steal`, `partition` and `pin` select the per-worker queue modes and CPU pinning of InitBank, `fuse` its op fusion.
+static void BM_InitBank(benchmark::State& state, bool steal, bool partition, bool pin, bool fuse) {
+  const std::string& path = ledger_path();
+  BankConfig config;
+  config.verbosity = QUIET;
+  config.steal = steal;
+  config.partition = partition;
+  config.pin = pin;
+  config.fuse = fuse;
+  std::vector<uint32_t> us;
+
+  // InitBank prints the accounts; keep that out of the benchmark output.
+  std::stringstream sink;
+  std::streambuf* old = std::cout.rdbuf(sink.rdbuf());
+  for (auto _ : state) {
+    auto start = Clock::now();
+    InitBank(state.range(0), path, config);
+    us.push_back(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+    sink.str("");
+  }
+  std::cout.rdbuf(old);
+
+  state.SetItemsProcessed(state.iterations() * LEDGER_ENTRIES);
+  report_latency(state, us, "us");
+}
+
+BENCHMARK_CAPTURE(BM_InitBank, shared, false, false, false, false)->ArgName("workers")->RangeMultiplier(2)->Range(1, 8)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK_CAPTURE(BM_InitBank, steal, true, false, false, false)->ArgName("workers")->RangeMultiplier(2)->Range(1, 8)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK_CAPTURE(BM_InitBank, steal_pinned, true, false, true, false)->ArgName("workers")->RangeMultiplier(2)->Range(1, 8)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK_CAPTURE(BM_InitBank, partitioned, false, true, false, false)->ArgName("workers")->RangeMultiplier(2)->Range(1, 8)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK_CAPTURE(BM_InitBank, fused, false, false, false, true)->ArgName("workers")->RangeMultiplier(2)->Range(1, 8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// The same ledger on forked shard processes, routed by two threads.
+static void BM_ShardBank(benchmark::State& state) {
+  const std::string& path = ledger_path();
+  BankConfig config;
+  config.verbosity = QUIET;
+  config.shards = state.range(0);
+  std::vector<uint32_t> us;
+
+  std::stringstream sink;
+  std::streambuf* old = std::cout.rdbuf(sink.rdbuf());
+  for (auto _ : state) {
+    auto start = Clock::now();
+    ShardBank(2, path, config);
+    us.push_back(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+    sink.str("");
+  }
+  std::cout.rdbuf(old);
+
+  state.SetItemsProcessed(state.iterations() * LEDGER_ENTRIES);
+  report_latency(state, us, "us");
+}
+
+BENCHMARK(BM_ShardBank)->ArgName("shards")->RangeMultiplier(2)->Range(1, 8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Many small batches through one long-lived BankEngine, the embedding
+// alternative to starting InitBank (and its threads) per batch.
+static void BM_EngineSubmit(benchmark::State& state) {
+  WorkloadConfig config;
+  config.entries = state.range(1);
+  config.accounts = NUM_ACCOUNTS;
+  config.zipf = 0.99;
+  config.open_accounts = false;
+  std::vector<Ledger> batch = generate_ledger(config);
+
+  Bank bank {NUM_ACCOUNTS};
+  bank.logger.set_verbosity(QUIET);
+  BankEngine engine {bank, (int)state.range(0)};
+  std::vector<uint32_t> us;
+  for (auto _ : state) {
+    auto start = Clock::now();
+    engine.submit(batch).get();
+    us.push_back(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+  }
+  state.SetItemsProcessed(state.iterations() * batch.size());
+  report_latency(state, us, "us");
+}
+
+BENCHMARK(BM_EngineSubmit)->ArgNames({"workers", "batch"})->ArgsProduct({{1, 4, 8}, {64, 4096}})->UseRealTime();
+
+static Bank* bank = nullptr;
+
+// One Bank call on account `id` (and `to` for transfers) by worker `t`.
+typedef void (*BankOp)(Bank& bank, int t, int i, int id, int to);
+
+static void BM_BankOp(benchmark::State& state, BankOp op) {
+  if (state.thread_index() == 0) {
+    bank = new Bank(NUM_ACCOUNTS);
+    bank->logger.set_verbosity(QUIET);
+    for (int id = 0; id < NUM_ACCOUNTS; ++id) bank->deposit(0, 0, id, 1 << 30);
+  }
+
+  std::mt19937 rng(377 + state.thread_index());
+  ZipfSampler pick {NUM_ACCOUNTS, 0.99};
+  std::vector<int> ids(1 << 16);
+  for (int& id : ids) id = pick(rng);
+  std::vector<uint32_t> ns;
+  ns.reserve(1 << 20);
+
+  int t = state.thread_index();
+  size_t i = 0;
+  for (auto _ : state) {
+    int id = ids[i & (ids.size() - 1)];
+    int to = ids[(i + 1) & (ids.size() - 1)];
+    auto start = Clock::now();
+    op(*bank, t, i, id, to);
+    ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+    i++;
+  }
+  state.SetItemsProcessed(state.iterations());
+  report_latency(state, ns, "ns");
+
+  if (state.thread_index() == 0) {
+    delete bank;
+    bank = nullptr;
+  }
+}
+
+BENCHMARK_CAPTURE(BM_BankOp, deposit,
+                  [](Bank& b, int t, int i, int id, int) { b.deposit(t, i, id, 1); })->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_CAPTURE(BM_BankOp, withdraw,
+                  [](Bank& b, int t, int i, int id, int) { b.withdraw(t, i, id, 1); })->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_CAPTURE(BM_BankOp, transfer,
+                  [](Bank& b, int t, int i, int id, int to) { b.transfer(t, i, id, to, 1); })->ThreadRange(1, 8)->UseRealTime();
+// Every other transfer asks for more than any account holds and is rejected.
+BENCHMARK_CAPTURE(BM_BankOp, transfer_half_rejected,
+                  [](Bank& b, int t, int i, int id, int to) { b.transfer(t, i, id, to, i % 2 ? 1u << 31 : 1); })->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_CAPTURE(BM_BankOp, check_balance,
+                  [](Bank& b, int t, int i, int id, int) { b.check_balance(t, i, id); })->ThreadRange(1, 8)->UseRealTime();
+// Fresh ids per thread, so every open inserts a new account.
+BENCHMARK_CAPTURE(BM_BankOp, open_account,
+                  [](Bank& b, int t, int i, int, int) { b.open_account(t, i, NUM_ACCOUNTS + t * (1 << 24) + i); })->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_CAPTURE(BM_BankOp, close_account,
+                  [](Bank& b, int t, int i, int id, int) { b.close_account(t, i, id); })->ThreadRange(1, 8)->UseRealTime();
+
+// 90% of the ops hit one settlement account: deposits into it, transfers into
+// it from random accounts, and a few withdrawals from it. The account turns
+// hot once the threads start contending for it (see Account).
+static void BM_HotAccount(benchmark::State& state) {
+  if (state.thread_index() == 0) {
+    bank = new Bank(NUM_ACCOUNTS);
+    bank->logger.set_verbosity(QUIET);
+    for (int id = 0; id < NUM_ACCOUNTS; ++id) bank->deposit(0, 0, id, 1 << 30);
+  }
+
+  std::mt19937 rng(377 + state.thread_index());
+  std::uniform_int_distribution<int> percent {0, 99}, other {1, NUM_ACCOUNTS - 1};
+  int t = state.thread_index();
+  int i = 0;
+  for (auto _ : state) {
+    int p = percent(rng);
+    if      (p < 50) bank->deposit(t, i, 0, 1);
+    else if (p < 85) bank->transfer(t, i, other(rng), 0, 1);
+    else if (p < 90) bank->withdraw(t, i, 0, 1);
+    else             bank->deposit(t, i, other(rng), 1);
+    i++;
+  }
+  state.SetItemsProcessed(state.iterations());
+
+  if (state.thread_index() == 0) {
+    delete bank;
+    bank = nullptr;
+  }
+}
+
+BENCHMARK(BM_HotAccount)->ThreadRange(1, 8)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,155 @@
+#include <benchmark/benchmark.h>
+
+#include <unistd.h>
+
+#include <fstream>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "account_index.h"
+#include "compact_store.h"
+
+// Lookup throughput of the old std::map<int, Account> layout against
+// AccountIndex as the number of accounts grows, and memory and op throughput
+// of AccountIndex against CompactStore. Every benchmark uses uniformly random
+// existing ids, the access pattern of deposit/withdraw.
+
+static std::vector<int> random_ids(int num_accounts) {
+  std::mt19937 rng(377);
+  std::uniform_int_distribution<int> dist(0, num_accounts - 1);
+  std::vector<int> ids(1 << 16);
+  for (int& id : ids) id = dist(rng);
+  return ids;
+}
+
+static void BM_MapLookup(benchmark::State& state) {
+  static std::map<int, Account> accounts;
+  int num_accounts = state.range(0);
+  if (state.thread_index() == 0) {
+    accounts.clear();
+    for (int i = 0; i < num_accounts; ++i) accounts[i].open();
+  }
+  std::vector<int> ids = random_ids(num_accounts);
+
+  size_t i = 0;
+  for (auto _ : state) {
+    // find() followed by operator[], as Bank did before the index
+    int id = ids[i++ & (ids.size() - 1)];
+    if (accounts.find(id) != accounts.end()) benchmark::DoNotOptimize(accounts[id].balance());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_IndexLookup(benchmark::State& state) {
+  static AccountIndex* accounts = nullptr;
+  int num_accounts = state.range(0);
+  if (state.thread_index() == 0) {
+    delete accounts;
+    accounts = new AccountIndex();
+    accounts->reserve(num_accounts);
+    for (int i = 0; i < num_accounts; ++i) accounts->insert(i).first->open();
+  }
+  std::vector<int> ids = random_ids(num_accounts);
+
+  size_t i = 0;
+  for (auto _ : state) {
+    Account* acc = accounts->find(ids[i++ & (ids.size() - 1)]);
+    if (acc != nullptr) benchmark::DoNotOptimize(acc->balance());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_IndexInsert(benchmark::State& state) {
+  int num_accounts = state.range(0);
+  for (auto _ : state) {
+    AccountIndex accounts;
+    for (int i = 0; i < num_accounts; ++i) accounts.insert(i);
+  }
+  state.SetItemsProcessed(state.iterations() * num_accounts);
+}
+
+// Resident memory of the process, in bytes.
+static size_t resident_bytes() {
+  std::ifstream statm {"/proc/self/statm"};
+  size_t total = 0, resident = 0;
+  statm >> total >> resident;
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+// Mixed deposits, withdrawals and transfers on random accounts, through
+// AccountIndex + Account (as Bank stores them) and through CompactStore.
+// bytes_per_account is the resident memory the accounts added when built
+// (small sizes may fit in memory freed by the previous run and show 0).
+static void BM_IndexOps(benchmark::State& state) {
+  static AccountIndex* accounts = nullptr;
+  static double bytes = 0;
+  int num_accounts = state.range(0);
+  if (state.thread_index() == 0) {
+    delete accounts;
+    size_t before = resident_bytes();
+    accounts = new AccountIndex();
+    accounts->reserve(num_accounts);
+    for (int i = 0; i < num_accounts; ++i) accounts->insert(i, 1000 * Account::UNIT | Account::OPEN);
+    bytes = double(resident_bytes() - before) / num_accounts;
+  }
+  std::vector<int> ids = random_ids(num_accounts);
+
+  size_t i = 0;
+  for (auto _ : state) {
+    Account& acc = *accounts->find(ids[i & (ids.size() - 1)]);
+    Account& other = *accounts->find(ids[(i + 1) & (ids.size() - 1)]);
+    switch (i++ % 3) {
+      case 0: if (acc.deposit(1) == ACC_FROZEN) { std::scoped_lock lock {acc}; acc.deposit(1); } break;
+      case 1: if (acc.withdraw(1) == ACC_FROZEN) { std::scoped_lock lock {acc}; acc.withdraw(1); } break;
+      case 2: {
+        if (&acc == &other) break;
+        std::scoped_lock lock {&acc < &other ? acc : other, &acc < &other ? other : acc};
+        long src = acc.freeze(), dest = other.freeze();
+        if (Account::balance_of(src) >= 1) { src -= Account::UNIT; dest += Account::UNIT; }
+        acc.thaw(src);
+        other.thaw(dest);
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["bytes_per_account"] = benchmark::Counter(bytes, benchmark::Counter::kAvgThreads);
+}
+
+static void BM_CompactOps(benchmark::State& state) {
+  static CompactStore* accounts = nullptr;
+  static double bytes = 0;
+  int num_accounts = state.range(0);
+  if (state.thread_index() == 0) {
+    delete accounts;
+    size_t before = resident_bytes();
+    accounts = new CompactStore(num_accounts);
+    for (int i = 0; i < num_accounts; ++i) {
+      accounts->open(i);
+      accounts->deposit(i, 1000);
+    }
+    bytes = double(resident_bytes() - before) / num_accounts;
+  }
+  std::vector<int> ids = random_ids(num_accounts);
+
+  size_t i = 0;
+  for (auto _ : state) {
+    int id = ids[i & (ids.size() - 1)];
+    int other = ids[(i + 1) & (ids.size() - 1)];
+    switch (i++ % 3) {
+      case 0: accounts->deposit(id, 1); break;
+      case 1: accounts->withdraw(id, 1); break;
+      case 2: accounts->transfer(id, other, 1); break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["bytes_per_account"] = benchmark::Counter(bytes, benchmark::Counter::kAvgThreads);
+}
+
+BENCHMARK(BM_MapLookup)->RangeMultiplier(10)->Range(1000, 1000000)->ThreadRange(1, 4)->UseRealTime();
+BENCHMARK(BM_IndexLookup)->RangeMultiplier(10)->Range(1000, 1000000)->ThreadRange(1, 4)->UseRealTime();
+BENCHMARK(BM_IndexInsert)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_IndexOps)->RangeMultiplier(10)->Range(1000, 10000000)->ThreadRange(1, 4)->UseRealTime();
+BENCHMARK(BM_CompactOps)->RangeMultiplier(10)->Range(1000, 10000000)->ThreadRange(1, 4)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,93 @@
+#include <benchmark/benchmark.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bank.h"
+
+// Deposit throughput of the bank in memory against the bank with a
+// write-ahead log. Every iteration is a batch of BATCH deposits to random
+// accounts, made durable in one of these ways:
+//   0  in memory, no log
+//   1  group commit in the background, as bank_app runs (sync() only at the end)
+//   2  group commit, one sync() per batch
+//   3  group commit, sync() after every deposit (concurrent syncs share a commit)
+//   4  naive log, write() + fdatasync() of every record under one lock
+
+#define BATCH 256
+#define NUM_ACCOUNTS 64
+
+enum Durability {IN_MEMORY, GROUP_ASYNC, GROUP_BATCH, GROUP_EACH, FSYNC_EACH};
+
+static const std::string wal_path = "/tmp/wal_bench.wal";
+
+// One write() and one fdatasync() per record: what group commit avoids.
+struct NaiveLog {
+  int fd {open(wal_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644)};
+  std::mutex lock;
+
+  ~NaiveLog() { close(fd); }
+
+  void append(const WalRecord& rec) {
+    // Automatically unlocks when destroyed.
+    std::scoped_lock guard {lock};
+    if (write(fd, &rec, sizeof(rec)) != sizeof(rec) || fdatasync(fd) < 0) perror("wal_bench");
+  }
+};
+
+static Bank* bank = nullptr;
+static WriteAheadLog* wal = nullptr;
+static NaiveLog* naive = nullptr;
+
+static void setup(Durability mode) {
+  remove(wal_path.c_str());
+  bank = new Bank(NUM_ACCOUNTS);
+  bank->logger.set_verbosity(QUIET);
+  if (mode != IN_MEMORY && mode != FSYNC_EACH) {
+    wal = new WriteAheadLog(wal_path);
+    bank->wal = wal;
+  }
+  if (mode == FSYNC_EACH) naive = new NaiveLog();
+}
+
+static void teardown() {
+  if (wal != nullptr) wal->sync();
+  delete wal;
+  delete naive;
+  delete bank;
+  wal = nullptr;
+  naive = nullptr;
+  bank = nullptr;
+  remove(wal_path.c_str());
+}
+
+static void BM_Deposits(benchmark::State& state) {
+  Durability mode = (Durability)state.range(0);
+  if (state.thread_index() == 0) setup(mode);
+
+  std::mt19937 rng(377 + state.thread_index());
+  std::vector<int> ids(BATCH);
+  for (int& id : ids) id = rng() % NUM_ACCOUNTS;
+
+  int ledger_id = 0;
+  for (auto _ : state) {
+    for (int id : ids) {
+      bank->deposit(state.thread_index(), ledger_id++, id, 1);
+      if (mode == GROUP_EACH) wal->sync();
+      if (mode == FSYNC_EACH) naive->append({ledger_id, id, 0, OP_DEPOSIT, 1, 0});
+    }
+    if (mode == GROUP_BATCH) wal->sync();
+  }
+  state.SetItemsProcessed(state.iterations() * BATCH);
+
+  if (state.thread_index() == 0) teardown();
+}
+
+BENCHMARK(BM_Deposits)->ArgName("durability")->DenseRange(IN_MEMORY, FSYNC_EACH)->Threads(1)->Threads(4)->UseRealTime();
+
+BENCHMARK_MAIN();
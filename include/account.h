@@ -0,0 +1,292 @@
+#ifndef _ACCOUNT_H
+#define _ACCOUNT_H
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+
+#include <spin.h>
+
+// Outcome of a lock-free attempt on an account.
+enum AccountResult {
+  ACC_OK,
+  ACC_CLOSED,
+  ACC_FUNDS,
+  ACC_FROZEN,  // a write_lock holder has the account frozen; take write_lock and retry
+  ACC_SHORT,   // the word alone is short, but unfolded deltas may cover it; fold() under write_lock and retry
+};
+
+#define HOT_THRESHOLD 64  // contended updates before an account gets delta stripes
+#define HOT_STRIPES 16
+
+// One stripe of a hot account's pending deposits, in units of money.
+struct alignas(64) DeltaStripe {
+  std::atomic<long> delta {0};
+};
+
+/**
+ * @brief Deposits into a hot account that have not been folded into its
+ *        state word yet, spread over stripes so depositors on different
+ *        threads write different cache lines. `folds` is odd while fold() is
+ *        moving the stripes into the word, which tells readers to retry.
+ */
+struct HotDeltas {
+  std::atomic<uint64_t> folds {0};
+  DeltaStripe stripes[HOT_STRIPES];
+
+  /**
+   * @brief The calling thread's stripe. Threads are dealt stripes round robin.
+   */
+  DeltaStripe& local() {
+    static std::atomic<unsigned> next {0};
+    thread_local unsigned index = next++ % HOT_STRIPES;
+    return stripes[index];
+  }
+
+  long sum() const {
+    long total = 0;
+    for (const DeltaStripe& stripe : stripes) total += stripe.delta.load(std::memory_order_acquire);
+    return total;
+  }
+};
+
+/**
+ * @brief A bank account.
+ *
+ * The balance and the open flag share one atomic word, `state`:
+ *
+ *     state = balance * 4 | FROZEN | OPEN
+ *
+ * Deposits and withdrawals update it with a single CAS and no lock.
+ * Operations that must change more than the word in one step (transfers)
+ * take `write_lock` and then freeze the word, which makes lock-free updaters
+ * fall back to waiting on `write_lock`. Whoever holds `write_lock` can
+ * therefore read frozen words and write them back without any update slipping
+ * in between, which keeps transfers atomic with respect to the fast path.
+ *
+ * Readers work like seqlock readers: the word is its own version stamp, and
+ * FROZEN plays the part of an odd sequence number. `read()` loads the word
+ * and only retries while a transfer has it frozen, so a balance check never
+ * writes shared memory, never takes a lock, and never delays a writer.
+ *
+ * Under skewed traffic a few accounts take most of the deposits, and every
+ * depositor then fights over the one word. Failed CASes and waits for
+ * `write_lock` are counted, and after HOT_THRESHOLD of them the account turns
+ * hot: it gets a `HotDeltas`, and from then on deposits only check the OPEN
+ * bit and add to the caller's stripe, ignoring FROZEN. Deposits commute, so
+ * they never need to see each other. The balance is the word plus the
+ * stripes, which makes the word a lower bound: withdrawals and debits that
+ * it covers still run on the word alone, and only one that finds it short
+ * folds the stripes in, under `write_lock`. A hot account stays hot.
+ */
+struct Account {
+  static constexpr long OPEN   = 1;
+  static constexpr long FROZEN = 2;
+  static constexpr long UNIT   = 4;
+
+  std::atomic<long> state {0};
+
+  // Copy-on-write pre-image for Bank::snapshot(): the state as of the start
+  // of snapshot epoch `snap_epoch`, saved by the first writer in that epoch.
+  std::atomic<uint64_t> snap_epoch {0};
+  std::atomic<long> snap_state {0};
+
+  std::mutex write_lock;
+
+  // Set once the account turns hot; see above.
+  std::atomic<HotDeltas*> hot {nullptr};
+  std::atomic<unsigned> contention {0};
+
+  Account() {}
+  ~Account() { delete hot.load(); }
+
+  static long balance_of(long s) { return s >> 2; }
+  static bool open_of(long s) { return s & OPEN; }
+
+  /**
+   * @brief Reads a state that is not in the middle of a transfer.
+   *
+   * @return long the account's state word (never FROZEN)
+   */
+  long read() const {
+    int spins = 0;
+    long s = state.load(std::memory_order_acquire);
+    while (s & FROZEN) {
+      spin_wait(spins);
+      s = state.load(std::memory_order_acquire);
+    }
+    return s;
+  }
+
+  /**
+   * @brief Reads the state with a hot account's unfolded deposits added in.
+   *        It includes every deposit that finished before the call.
+   *
+   * @return long the account's full state word (never FROZEN)
+   */
+  long read_settled() const {
+    HotDeltas* h = hot.load(std::memory_order_acquire);
+    if (h == nullptr) return read();
+    int spins = 0;
+    for (;;) {
+      uint64_t folds = h->folds.load(std::memory_order_acquire);
+      if (!(folds & 1)) {
+        long s = read() + h->sum() * UNIT;
+        if (h->folds.load(std::memory_order_acquire) == folds) return s;
+      }
+      spin_wait(spins);
+    }
+  }
+
+  long balance() const { return balance_of(read_settled()); }
+  bool is_open() const { return open_of(read()); }
+  bool is_hot() const { return hot.load(std::memory_order_relaxed) != nullptr; }
+
+  /**
+   * @brief Counts one contended update; the HOT_THRESHOLD-th makes the
+   *        account hot.
+   */
+  void contended() {
+    if (contention.load(std::memory_order_relaxed) >= HOT_THRESHOLD) return;
+    if (contention.fetch_add(1, std::memory_order_relaxed) + 1 == HOT_THRESHOLD) promote();
+  }
+
+  void promote() {
+    HotDeltas* expected = nullptr;
+    HotDeltas* h = new HotDeltas;
+    if (!hot.compare_exchange_strong(expected, h, std::memory_order_acq_rel)) delete h;
+  }
+
+  /**
+   * @brief Takes write_lock, counting it as contention if someone else has it.
+   *        Lets `std::scoped_lock` lock an Account directly.
+   */
+  void lock() {
+    if (write_lock.try_lock()) return;
+    contended();
+    write_lock.lock();
+  }
+  bool try_lock() { return write_lock.try_lock(); }
+  void unlock() { write_lock.unlock(); }
+
+  /**
+   * @brief Adds `amount` to an open account with one CAS.
+   *
+   * A hot account takes the deposit on the caller's stripe instead, even
+   * while the word is frozen.
+   *
+   * @param amount amount to add
+   * @return AccountResult ACC_OK, ACC_CLOSED, or ACC_FROZEN
+   */
+  AccountResult deposit(long amount) {
+    if (HotDeltas* h = hot.load(std::memory_order_acquire)) {
+      if (!open_of(state.load(std::memory_order_acquire))) return ACC_CLOSED;
+      h->local().delta.fetch_add(amount, std::memory_order_acq_rel);
+      return ACC_OK;
+    }
+
+    long s = state.load(std::memory_order_relaxed);
+    for (;;) {
+      if (s & FROZEN) return ACC_FROZEN;
+      if (!open_of(s)) return ACC_CLOSED;
+      if (state.compare_exchange_weak(s, s + amount * UNIT, std::memory_order_acq_rel,
+                                      std::memory_order_relaxed)) return ACC_OK;
+      contended();
+    }
+  }
+
+  /**
+   * @brief Removes `amount` from an open account holding at least `amount`,
+   *        with one CAS.
+   *
+   * @param amount amount to remove
+   * @return AccountResult ACC_OK, ACC_CLOSED, ACC_FUNDS, ACC_FROZEN, or
+   *         ACC_SHORT (hot accounts only)
+   */
+  AccountResult withdraw(long amount) {
+    long s = state.load(std::memory_order_relaxed);
+    for (;;) {
+      if (s & FROZEN) return ACC_FROZEN;
+      if (!open_of(s)) return ACC_CLOSED;
+      if (amount > balance_of(s)) return is_hot() ? ACC_SHORT : ACC_FUNDS;
+      if (state.compare_exchange_weak(s, s - amount * UNIT, std::memory_order_acq_rel,
+                                      std::memory_order_relaxed)) return ACC_OK;
+      contended();
+    }
+  }
+
+  /**
+   * @brief Replaces the balance of an open account with `next(balance)` in
+   *        one CAS. `next` runs once per attempt, so it must not have side
+   *        effects. Hot accounts must be fold()ed under write_lock first, or
+   *        `next` only sees the word's lower bound.
+   *
+   * @param next computes the new balance from the current one
+   * @param before set to the balance of the attempt that went in
+   * @return AccountResult ACC_OK, ACC_CLOSED, or ACC_FROZEN
+   */
+  template <typename F>
+  AccountResult update(F next, long& before) {
+    long s = state.load(std::memory_order_relaxed);
+    for (;;) {
+      if (s & FROZEN) return ACC_FROZEN;
+      if (!open_of(s)) return ACC_CLOSED;
+      before = balance_of(s);
+      if (state.compare_exchange_weak(s, s + (next(before) - before) * UNIT, std::memory_order_acq_rel,
+                                      std::memory_order_relaxed)) return ACC_OK;
+      contended();
+    }
+  }
+
+  // The remaining operations must be called with write_lock held, or by the
+  // account's only writer (Bank::single_writer).
+
+  /**
+   * @brief Saves the current state as the pre-image for snapshot epoch `e`,
+   *        unless an earlier writer in that epoch already did. The pre-image
+   *        is published before the caller changes `state`.
+   *
+   * @param e snapshot epoch being written in
+   */
+  void preserve(uint64_t e) {
+    if (snap_epoch.load(std::memory_order_relaxed) >= e) return;
+    snap_state.store(read_settled(), std::memory_order_relaxed);
+    snap_epoch.store(e, std::memory_order_release);
+  }
+
+  /**
+   * @brief Moves a hot account's unfolded deposits into the state word.
+   *        Depositors keep adding to their stripes meanwhile; whatever lands
+   *        after a stripe is emptied simply waits for the next fold.
+   */
+  void fold() {
+    HotDeltas* h = hot.load(std::memory_order_acquire);
+    if (h == nullptr) return;
+    h->folds.fetch_add(1, std::memory_order_acq_rel);
+    long total = 0;
+    for (DeltaStripe& stripe : h->stripes) total += stripe.delta.exchange(0, std::memory_order_acq_rel);
+    state.fetch_add(total * UNIT, std::memory_order_acq_rel);
+    h->folds.fetch_add(1, std::memory_order_release);
+  }
+
+  /**
+   * @brief Freezes the word. If the word alone is short of `need`, folds a
+   *        hot account's deltas in first.
+   *
+   * @param need amount the caller wants to take out
+   * @return long the state word before freezing
+   */
+  long freeze(long need = 0) {
+    long s = state.fetch_or(FROZEN, std::memory_order_acq_rel);
+    if (balance_of(s) >= need || !is_hot()) return s;
+    thaw(s);
+    fold();
+    return state.fetch_or(FROZEN, std::memory_order_acq_rel);
+  }
+  void thaw(long s) { state.store(s & ~FROZEN, std::memory_order_release); }
+  void open() { state.fetch_or(OPEN, std::memory_order_acq_rel); }
+  void close() { state.fetch_and(~OPEN, std::memory_order_acq_rel); }
+  void adjust(long amount) { state.fetch_add(amount * UNIT, std::memory_order_acq_rel); }  // no funds check
+};
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef _ACCOUNT_INDEX_H
+#define _ACCOUNT_INDEX_H
+
+#include <account.h>
+
+#include <stdint.h>
+#include <atomic>
+#include <array>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#define INDEX_SHARD_BITS 6
+#define INDEX_SHARD_SLOTS 16
+
+/**
+ * @brief Concurrent hash index from account id to Account.
+ *
+ * The index is split into 2^INDEX_SHARD_BITS shards, each an open-addressing
+ * (linear probing) table of 16-byte slots holding the id next to the account
+ * pointer. Lookups never lock: they load the shard's current table and probe
+ * it, so a hit costs one hash and (almost always) one cache line. Inserts take
+ * the shard's `insert_lock`, so concurrent `open_account` calls are safe and
+ * only contend when they land on the same shard.
+ *
+ * Accounts are never removed (closing only clears `open`), which keeps the
+ * lock-free readers simple. Accounts live in a per-shard arena so references
+ * stay valid for the lifetime of the index. When a shard grows, the old table
+ * is retired rather than freed, since a reader may still be probing it; the
+ * retired tables together are never larger than the live one.
+ */
+class AccountIndex {
+  public:
+    AccountIndex() {};
+    ~AccountIndex() {};
+
+    AccountIndex(const AccountIndex&) = delete;
+    AccountIndex& operator=(const AccountIndex&) = delete;
+
+    Account* find(int acc_id) const;
+    std::pair<Account*, bool> insert(int acc_id, long state = 0);
+    void reserve(size_t n);
+    size_t size() const;
+
+    // std::map compatible find-or-insert
+    Account& operator[](int acc_id) { return *insert(acc_id).first; }
+
+    std::vector<std::pair<int, Account*>> sorted() const;
+
+    // Shard an account id lives in, 0 ... 2^INDEX_SHARD_BITS - 1
+    static size_t shard(int acc_id) { return shard_of(hash(acc_id)); }
+    // Which of `parts` even splits of the ids an account falls in; the same
+    // split as shard() when `parts` divides the shard count
+    static int partition(int acc_id, int parts) { return ((hash(acc_id) >> 32) * parts) >> 32; }
+
+    /**
+     * @brief Calls f(id, account) for every account, in no particular order.
+     *        Safe to run concurrently with inserts; accounts inserted during
+     *        the walk may or may not be visited.
+     */
+    template <typename F>
+    void for_each(F f) const {
+      for (const Shard& shard : shards) {
+        const Table* table = shard.table.load(std::memory_order_acquire);
+        if (table == nullptr) continue;
+        for (size_t i = 0; i <= table->mask; ++i) {
+          Account* acc = table->slots[i].acc.load(std::memory_order_acquire);
+          if (acc != nullptr) f(table->slots[i].key.load(std::memory_order_relaxed), *acc);
+        }
+      }
+    }
+
+  private:
+    struct Slot {
+      std::atomic<int> key {0};
+      std::atomic<Account*> acc {nullptr};
+    };
+
+    struct Table {
+      size_t mask;
+      std::unique_ptr<Slot[]> slots;
+
+      Table(size_t capacity) : mask(capacity - 1), slots(new Slot[capacity]) {};
+    };
+
+    struct alignas(64) Shard {
+      std::atomic<Table*> table {nullptr};
+      std::mutex insert_lock;
+      size_t count {0};
+      std::deque<Account> arena;
+      std::vector<std::unique_ptr<Table>> tables;
+    };
+
+    static uint64_t hash(int acc_id);
+    static size_t shard_of(uint64_t h) { return h >> (64 - INDEX_SHARD_BITS); }
+    static void place(Table& table, uint64_t h, int acc_id, Account* acc);
+    static void grow(Shard& shard, size_t capacity);
+
+    std::array<Shard, 1 << INDEX_SHARD_BITS> shards;
+};
+
+#endif
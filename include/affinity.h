@@ -0,0 +1,23 @@
+#ifndef _AFFINITY_H
+#define _AFFINITY_H
+
+#include <string>
+#include <vector>
+
+/**
+ * @brief The CPUs this process may run on, grouped by NUMA node. Read from
+ *        /sys/devices/system/node; machines (or containers) without it show
+ *        up as a single node holding every allowed CPU.
+ */
+struct CpuTopology {
+  std::vector<std::vector<int>> nodes;  // allowed CPUs of each node that has any
+
+  static CpuTopology detect();
+  int cpus() const;
+};
+
+std::vector<int> parse_cpu_list(const std::string& list);
+std::vector<int> place_threads(const CpuTopology& topology, int count);
+bool pin_thread(int cpu);
+
+#endif
@@ -19,20 +19,90 @@
 #include <condition_variable>
 #include <queue>
 
-struct Account {
-  bool open {false};
-  long balance {0};
-  int  readers {0};
+#include <account.h>
+#include <account_index.h>
+#include <checkpoint.h>
+#include <logger.h>
+#include <stats.h>
+#include <thread_slots.h>
+#include <trace.h>
+#include <wal.h>
+#include <vector>
 
-  std::mutex read_lock;
-  std::mutex write_lock;
+#define OCC_RETRIES 8  // optimistic rounds before a transfer waits on account locks
+
+// Epoch the owning thread's current operation runs in (0 when idle).
+struct alignas(64) EpochSlot {
+  std::atomic<uint64_t> active {0};
+
+  // Money this thread took out of accounts with Bank::debit(), minus what it
+  // put back with credit() or refund(). Summed over all threads, it is the
+  // money in the mail between partitions. Only the owning thread writes it,
+  // and it keeps a pre-image for snapshots like Account does.
+  std::atomic<long> transit {0};
+  std::atomic<uint64_t> snap_epoch {0};
+  std::atomic<long> snap_transit {0};
 };
 
+// Globally consistent copy of every open account's balance.
+struct BankSnapshot {
+  uint64_t epoch;
+  std::vector<std::pair<int, long>> balances;  // sorted by id
+  long in_transit {0};  // debited from one partition but not credited to another yet
+
+  long total() const;
+};
+
+// One deposit, withdrawal or balance check of a run passed to Bank::apply_run().
+struct RunOp {
+  int ledger_id;
+  int amount;  // unused by balance checks
+  Op op;
+};
 
 class Bank {
   private:
-    int num_succ {0};
-    int num_fail {0};
+    // per-thread success/failure counts, aggregated by stats()
+    PerThread<OpCounters> counters;
+
+    // Snapshot state; see Bank::snapshot().
+    PerThread<EpochSlot> epochs;
+    std::atomic<uint64_t> epoch {1};
+    std::atomic<uint64_t> grace_epoch {1};
+    std::atomic<bool> snapshotting {false};
+    std::mutex snapshot_lock;
+
+    std::vector<std::pair<int, long>> capture(uint64_t& e, long& transit);
+    Account* find(int acc_id);
+    std::unique_lock<Account> lock_account(Account& acc);
+    void replay_change(const WalRecord& rec);
+
+    // Checkpoint the bank was restored from. Accounts that are not in
+    // `accounts` yet are read from its mapping on first use.
+    std::unique_ptr<MappedFile> base_file;
+    CheckpointView base {0, nullptr, nullptr, nullptr};
+
+    // ledger ids restored by replay(), indexed by id
+    std::vector<bool> recovered;
+
+    /**
+     * @brief Marks one operation as running in the current epoch for as long
+     *        as it lives. While a snapshot is being taken, `cow` is set and the
+     *        operation must take `write_lock` and `preserve()` every account
+     *        before changing it.
+     */
+    class EpochGuard {
+      public:
+        EpochGuard(Bank& bank);
+        ~EpochGuard() { slot.active.store(0, std::memory_order_release); }
+
+        void preserve(Account& acc) const { if (cow) acc.preserve(epoch); }
+        void move_transit(long amount);
+
+        EpochSlot& slot;
+        uint64_t epoch;
+        bool cow;
+    };
     
   public:
     // empty constructor/destructor due to RAII (initialization and destruction is handled for us)
@@ -48,13 +118,35 @@ class Bank {
     int check_balance(int worker_id, int ledger_id, int acc_id);
     int open_account (int worker_id, int ledger_id, int acc_id);
     int close_account(int worker_id, int ledger_id, int acc_id);
-    
+
+    // Cross-partition transfers of a single_writer bank
+    int debit (int worker_id, int ledger_id, int src_id, int dest_id, unsigned int amount);
+    int credit(int worker_id, int ledger_id, int src_id, int dest_id, unsigned int amount);
+    void refund(int src_id, unsigned int amount);
+
+    // Deposits, withdrawals and balance checks on one account, applied at once
+    int apply_run(int worker_id, int acc_id, const std::vector<RunOp>& run);
+
     void print_accounts();
-    void recordSucc(std::string message);
-    void recordFail(std::string message);
+    BankSnapshot snapshot();
+    bool checkpoint(const std::string& path);
+    bool restore(const std::string& path);
+    BankStats stats();
+    void recordSucc(const LogRecord& result);
+    void recordFail(const LogRecord& result, FailReason reason);
+    void replay(const WalRecord& rec, bool apply = true);
+    // Records of the log with this id that the restored checkpoint includes
+    uint64_t checkpointed_records(uint64_t wal_id) const { return base.wal_id == wal_id ? base.wal_records : 0; }
+    bool replayed(int ledger_id) const { return ledger_id >= 0 && (size_t)ledger_id < recovered.size() && recovered[ledger_id]; }
+    int next_ledger_id() const { return recovered.size(); }  // first id past every id replay() restored
 
+    Logger logger;
     std::mutex bank_lock;
-    std::map<int, Account> accounts;
+    AccountIndex accounts;
+    WriteAheadLog* wal {nullptr};  // successful changes are appended here when set
+    // Set when every account is only ever changed by one worker (InitBank's
+    // --partition mode); operations then skip account locks.
+    bool single_writer {false};
 };
 
 #endif
\ No newline at end of file
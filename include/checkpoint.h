@@ -0,0 +1,49 @@
+#ifndef _CHECKPOINT_H
+#define _CHECKPOINT_H
+
+#include <ledger_file.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define CHECKPOINT_MAGIC   0x4B504342u  // "BCPK" on disk
+#define CHECKPOINT_VERSION 3
+
+/**
+ * @brief Header of a bank checkpoint. It is followed by three arrays that can
+ *        be used straight from a read-only mapping:
+ *  - `int32_t ids[count]`, ascending, then zero padding to 8 bytes
+ *  - `int64_t balances[count]`
+ *  - `uint64_t open[(count + 63) / 64]`, bit i set if account ids[i] is open
+ */
+struct CheckpointHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t count;
+  uint64_t checksum;     // checkpoint_checksum() of the arrays
+  uint64_t wal_records;  // write-ahead log records the balances already include
+  uint64_t wal_id;       // WriteAheadLog::id() of that log (0 = none)
+};
+
+// The arrays of a checkpoint, pointing into a mapped file.
+struct CheckpointView {
+  uint64_t count;
+  const int32_t* ids;
+  const int64_t* balances;
+  const uint64_t* open;
+  uint64_t wal_records {0};
+  uint64_t wal_id {0};
+
+  bool is_open(uint64_t i) const { return open[i / 64] >> (i % 64) & 1; }
+};
+
+size_t checkpoint_size(uint64_t count);
+uint64_t checkpoint_checksum(const CheckpointView& view);
+bool checkpoint_view(const MappedFile& file, CheckpointView& view);
+bool write_checkpoint(const std::string& path, const std::vector<std::pair<int, long>>& states,
+                      uint64_t wal_records = 0, uint64_t wal_id = 0);
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef _COMPACT_STORE_H
+#define _COMPACT_STORE_H
+
+#include <account.h>
+
+#include <stdint.h>
+#include <atomic>
+
+/**
+ * @brief Compact struct-of-arrays storage for dense account ids.
+ *
+ * Where AccountIndex gives every account an `Account` object (state word,
+ * snapshot pre-image, mutex, hot-account stripes) plus a hash slot, this store
+ * keeps ids 0 ... capacity-1 in two flat arrays: the state word of each
+ * account (balance * 4 | FROZEN | OPEN, exactly as in Account) and a
+ * one-byte spinlock per account. That is 9 bytes per account and no lookup at
+ * all, so 100M accounts take 900 MB.
+ *
+ * Both arrays are one anonymous mapping reserved up front, so the memory of
+ * accounts that are never touched is never committed; pages are zero, i.e.
+ * closed accounts with no money, until first written.
+ *
+ * The per-account protocol is Account's: deposits and withdrawals are one
+ * CAS, transfers take both spinlocks in id order and freeze both words, and
+ * reads only retry while a transfer has the word frozen. Operations on a
+ * frozen word wait on its spinlock instead of returning ACC_FROZEN.
+ *
+ * This is a standalone store, not a storage option of Bank. Bank's snapshots
+ * keep a pre-image in every Account, hot accounts hang delta stripes off it
+ * and checkpoints restore sparse ids into the hash index, and none of that
+ * fits in 9 bytes, so Bank and bank_app always run on AccountIndex. The store
+ * has no logging, counters, snapshots or write-ahead log. It suits code that
+ * only needs the account operations on dense ids; index_bench measures both.
+ */
+class CompactStore {
+  public:
+    CompactStore(size_t capacity);
+    ~CompactStore();
+
+    CompactStore(const CompactStore&) = delete;
+    CompactStore& operator=(const CompactStore&) = delete;
+
+    bool valid() const { return states != nullptr; }
+    size_t capacity() const { return count; }
+    static constexpr size_t bytes_per_account() { return sizeof(std::atomic<long>) + sizeof(std::atomic<uint8_t>); }
+
+    AccountResult deposit(int id, long amount);
+    AccountResult withdraw(int id, long amount);
+    AccountResult transfer(int src_id, int dest_id, long amount);
+    bool open(int id);
+    bool close(int id);
+
+    long read(int id) const;
+    long balance(int id) const { return Account::balance_of(read(id)); }
+    bool is_open(int id) const { return Account::open_of(read(id)); }
+
+  private:
+    bool contains(int id) const { return id >= 0 && (size_t)id < count; }
+    void lock(int id);
+    void unlock(int id) { locks[id].store(0, std::memory_order_release); }
+
+    size_t count;
+    size_t mapped {0};
+    std::atomic<long>* states {nullptr};
+    std::atomic<uint8_t>* locks {nullptr};
+};
+
+#endif
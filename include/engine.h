@@ -0,0 +1,98 @@
+#ifndef _ENGINE_H
+#define _ENGINE_H
+
+#include <ledger.h>
+
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#define ENGINE_CHUNK 64  // most entries a worker takes from a batch at once
+
+/**
+ * @brief Long-lived execution engine for embedding the bank in a service.
+ *
+ * The engine owns a persistent pool of workers that run submitted batches of
+ * ledger entries on a bank, so no threads are created per batch. Each batch
+ * is split into chunks of up to ENGINE_CHUNK entries that go through one
+ * shared RingBuffer; entries of a batch run concurrently, exactly as the
+ * workers of InitBank would run them. When the last chunk of a batch is done,
+ * its per-entry results (0 on success, -1 on failure) are handed to the
+ * batch's future or callback. The buffer a batch's entries are copied into
+ * is recycled across batches. So is its results buffer when the batch has a
+ * callback that only reads the results; a future's results are moved out to
+ * the caller, and so are a callback's if it moves from them.
+ *
+ * Callbacks run on a worker. One may submit() another batch, which then runs
+ * right there on that worker rather than going through the queue, so a full
+ * queue cannot block the worker that would drain it. Neither waits for the
+ * lock that outside submitters hold while they queue chunks. One may also
+ * call shutdown(), which then only stops taking batches; the destructor
+ * closes the queue and joins the workers. The engine must not be destroyed
+ * from a callback.
+ *
+ * Destroying the engine (or calling shutdown()) finishes every batch already
+ * submitted and joins the workers.
+ */
+class BankEngine {
+  public:
+    typedef std::function<void(std::vector<int>&& results)> Callback;
+
+    BankEngine(Bank& bank, int num_workers, size_t queue_size = DEFAULT_QUEUE_SIZE);
+    ~BankEngine();
+
+    BankEngine(const BankEngine&) = delete;
+    BankEngine& operator=(const BankEngine&) = delete;
+
+    std::future<std::vector<int>> submit(std::span<const Ledger> entries);
+    void submit(std::span<const Ledger> entries, Callback done);
+    void shutdown();
+
+  private:
+    // One submitted batch: a copy of its entries and its results so far.
+    struct Batch {
+      std::vector<Ledger> entries;
+      std::vector<int> results;
+      std::atomic<size_t> remaining {0};
+      std::promise<std::vector<int>> promise;
+      Callback done;
+    };
+
+    // A range of one batch's entries, the unit of work in the queue.
+    struct Chunk {
+      Batch* batch;
+      size_t begin;
+      size_t end;
+    };
+
+    Batch* acquire(std::span<const Ledger> entries);
+    void start(Batch* batch);
+    void run(Batch* batch, size_t begin, size_t end, int worker_id);
+    void finish(Batch* batch);
+    void work(int worker_id);
+
+    Bank& bank;
+    int num_workers;
+    RingBuffer<Chunk> chunks;
+    std::vector<std::thread> threads;
+
+    // Every batch ever allocated, and the finished ones kept for reuse.
+    std::mutex batch_lock;
+    std::deque<Batch> batches;
+    std::vector<Batch*> free_batches;
+
+    // Held while a batch is queued, so shutdown() never closes the queue
+    // under a submitter.
+    std::mutex submit_lock;
+    std::atomic<bool> stopped {false};
+
+    // Held while joining, so two threads calling shutdown() never join the same worker.
+    std::mutex join_lock;
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef _FILE_READER_H
+#define _FILE_READER_H
+
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+#define READ_DEPTH 16              // files read ahead of the first one that is not read yet
+#define URING_MAX_READ (1u << 30)  // bytes asked for by one io_uring read; bigger files take several
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/**
+ * @brief Reads whole files into memory, many at a time.
+ *
+ * On kernels that allow it, one io_uring (set up with raw syscalls, no
+ * liburing) keeps a read in flight for up to `depth` files, and the calling
+ * thread only submits and reaps them. Where io_uring is missing or disabled,
+ * `depth` threads read the files with blocking read() calls instead.
+ *
+ * Either way files are started in list order, and a file is only started
+ * while fewer than `depth` files separate it from the first one that is not
+ * read yet. A slow file therefore holds at most `depth` finished files in
+ * memory behind it, plus whatever `done` keeps: read_files() queues up to
+ * READ_DEPTH more for its parsers, so a list read there can have about
+ * twice `depth` files in memory. `done` gets every file once, in the order
+ * reads finish, and never runs on two threads at once.
+ */
+class FileReader {
+  public:
+    // Index of the file in the list, its contents (which may be moved from),
+    // and false if the file could not be read (an error is printed).
+    typedef std::function<void(size_t index, std::vector<char>& data, bool ok)> Done;
+
+    FileReader(int depth = READ_DEPTH, bool use_uring = true);
+    ~FileReader();
+
+    FileReader(const FileReader&) = delete;
+    FileReader& operator=(const FileReader&) = delete;
+
+    bool uring() const { return ring_fd >= 0; }
+    void read_all(const std::vector<std::string>& files, const Done& done);
+
+  private:
+    // A file being read through the ring.
+    struct Slot {
+      size_t index;
+      int fd {-1};
+      std::vector<char> data;
+      size_t filled {0};
+    };
+
+    bool setup_uring();
+    void submit_read(int slot, Slot& s);
+    void read_uring(const std::vector<std::string>& files, const Done& done);
+    void read_threads(const std::vector<std::string>& files, const Done& done);
+
+    int depth;
+    int ring_fd {-1};
+    void* sq_map {nullptr};
+    void* cq_map {nullptr};
+    size_t sq_size {0}, cq_size {0};
+    io_uring_sqe* sqes {nullptr};
+    size_t sqes_size {0};
+
+    // Fields of the mapped rings
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    io_uring_cqe* cqes;
+    unsigned to_submit {0};
+};
+
+#endif
@@ -2,8 +2,20 @@
 #define _LEDGER_H
 
 #include <bank.h>
+#include <ring_buffer.h>
+#include <ledger_file.h>
 
-#define MAX_SIZE 5
+#include <atomic>
+#include <barrier>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#define DEFAULT_QUEUE_SIZE 1024
+#define DEFAULT_BATCH_SIZE 4096
+#define READ_BATCH 64  // entries a reader parses before pushing them, and the window op fusion looks at
+#define MAX_RUN_SLOTS 65536  // most fused runs queued or running at once, whatever the queue size
+#define FOLLOW_READ_SIZE 65536  // bytes --follow reads from the ledger per read()
 
 struct Ledger {
 	int from;
@@ -13,10 +25,169 @@ struct Ledger {
 	int ledgerID;
 };
 
-void InitBank(int num_workers, std::string filename);
-void load_ledger(bool& done, int& ledger_id, std::ifstream& file, std::mutex& stream_lock, 
-				 std::queue<Ledger>& ledger, std::mutex& ledger_lock, std::condition_variable& empty, std::condition_variable& fill);
-void worker(Bank& bank, bool& done, int worker_id, 
-			std::queue<Ledger>& ledger, std::mutex& ledger_lock, std::condition_variable& empty, std::condition_variable& fill);
+// Binary ledgers store this struct verbatim.
+static_assert(sizeof(Ledger) == 5 * sizeof(int), "binary ledger records must not contain padding");
+
+// Ledger modes 0 ... 5 are the ops OP_DEPOSIT ... OP_CLOSE. Readers skip
+// entries with any other mode, so workers only ever see these.
+static inline bool valid_mode(int mode) { return mode >= 0 && mode < NUM_OPS; }
+
+// What a LedgerQueue item holds. The kind travels next to the entry, never in
+// its mode, so no ledger line can pass itself off as an internal item.
+enum ItemKind {
+	ITEM_ENTRY,  // a ledger entry
+	ITEM_RUN,    // fused ops on account `from`: `to` is their run slot, `amount` their count
+	// Messages workers mail each other in partitioned mode
+	ITEM_CREDIT, // second half of a cross-partition transfer
+	ITEM_REFUND, // a credit that failed, going back to the source
+};
+
+struct LedgerItem {
+	Ledger l;
+	ItemKind kind;
+};
+
+/**
+ * @brief Buffer between the readers and the workers.
+ *
+ * With one queue (the default) this is a single RingBuffer that every reader
+ * pushes to and every worker pops from. With `num_queues` > 1 each worker
+ * gets a ring of its own: readers push every entry to the ring of its home
+ * worker, picked by AccountIndex::partition() of the entry's `from` account,
+ * and a worker pops its own ring first and steals from the others once it
+ * runs dry. Entries for an account then mostly run on one worker, so its
+ * cache lines stay local, while
+ * stealing keeps skewed ledgers from idling the other workers.
+ *
+ * Without `steal` the split is strict: a worker only ever pops its own ring,
+ * so it is the only worker that runs entries from its accounts. Workers can
+ * then post() messages to each other's mailboxes, which are unbounded so
+ * posting never blocks, and every worker parks on its own futex word. A
+ * transfer between partitions counts as in flight from begin_transfer() to
+ * end_transfer(), and pop() only returns false once every worker has
+ * drained its ring and nothing is in flight, since until then a message
+ * may still arrive.
+ *
+ * With `fuse` set, readers coalesce the deposits, withdrawals and balance
+ * checks each batch has on one account into a run (see push_batch()). A run
+ * travels as one ITEM_RUN item whose ops sit in a run slot. Slots come
+ * from a fixed pool with a free list, so readers reuse their vectors and
+ * wait for a free slot when every run is still queued or running.
+ */
+class LedgerQueue {
+	public:
+		explicit LedgerQueue(size_t capacity, int num_queues = 1, bool steal = true, bool fuse = false);
+
+		LedgerQueue(const LedgerQueue&) = delete;
+		LedgerQueue& operator=(const LedgerQueue&) = delete;
+
+		size_t capacity() const;
+		int queues() const { return rings.size(); }
+		bool is_closed() const { return closed.load(std::memory_order_acquire); }
+		bool partitioned() const { return !boxes.empty(); }
+		int owner(int acc_id) const { return AccountIndex::partition(acc_id, rings.size()); }
+
+		bool try_push(const Ledger& l, ItemKind kind = ITEM_ENTRY);
+		bool try_pop(Ledger& l);
+		bool push(const Ledger& l, ItemKind kind = ITEM_ENTRY);
+		bool pop(Ledger& l) { return pop(0, l); }
+		bool pop(int worker_id, Ledger& l);
+		bool pop(int worker_id, LedgerItem& item);
+		void close();
+
+		// Partitioned mode only
+		void post(int worker_id, const Ledger& l, ItemKind kind);
+		void begin_transfer() { in_flight.fetch_add(1); }
+		void end_transfer();
+
+		// Fusing mode only
+		bool fuses() const { return free_runs != nullptr; }
+		int acquire_run();
+		std::vector<RunOp>& run(int slot) { return runs[slot]; }
+		void release_run(int slot) { free_runs->push(slot); }
+
+	private:
+		// A worker's mail and parking spot (partitioned mode only).
+		struct alignas(64) Mailbox {
+			std::mutex lock;
+			std::vector<LedgerItem> items;      // posted, guarded by `lock`
+			std::atomic<bool> has_mail {false};
+			std::vector<LedgerItem> local;      // taken from `items`; owner only
+			size_t next {0};
+			bool input_done {false};            // owner only
+			std::atomic<uint32_t> waiting {0};
+			std::atomic<uint32_t> signal {0};
+		};
+
+		bool take(int worker_id, LedgerItem& item);
+		bool take_owned(int worker_id, LedgerItem& item);
+		bool pop_owned(int worker_id, LedgerItem& item);
+		bool finished(const Mailbox& box) const;
+		void wake(int worker_id);
+		void wake_all();
+
+		std::vector<std::unique_ptr<RingBuffer<LedgerItem>>> rings;
+		std::atomic<bool> closed {false};
+
+		// Workers parked until any ring gets an entry (stealing mode only)
+		alignas(64) std::atomic<uint32_t> waiters {0};
+		std::atomic<uint32_t> signal {0};
+
+		std::vector<std::unique_ptr<Mailbox>> boxes;
+		alignas(64) std::atomic<int> draining {0};  // workers that have not drained their ring
+		std::atomic<long> in_flight {0};            // cross-partition transfers not finished yet
+
+		std::vector<std::vector<RunOp>> runs;
+		std::unique_ptr<RingBuffer<int>> free_runs;  // slots of `runs` not in use
+};
+
+// Runtime options for InitBank beyond the worker count and ledger file.
+struct BankConfig {
+	size_t queue_size {DEFAULT_QUEUE_SIZE};
+	Verbosity verbosity {ALL};
+	int report_ms {0};          // print a live snapshot report this often (0 = never)
+	bool print_stats {false};   // print the per-op/per-reason breakdown at the end
+	bool deterministic {false}; // conflict-aware scheduling that matches a sequential replay
+	size_t batch_size {DEFAULT_BATCH_SIZE}; // entries per deterministic batch
+	std::string checkpoint_path; // checkpoint to start from instead of 10 empty accounts (empty = none)
+	std::string save_checkpoint; // checkpoint to write once the ledger is done (empty = none)
+	std::string wal_path;       // write-ahead log to recover from and append to (empty = none)
+	std::string trace_path {DEFAULT_TRACE_FILE}; // latency histogram dump (only in BANK_TRACE builds)
+	bool mmap {false};   // map text ledgers and parse newline-aligned chunks in parallel (binary ledgers are always mapped)
+	int readers {0};     // reader threads (0 = one per worker)
+	bool steal {false};  // per-worker queues with work stealing instead of one shared queue
+	bool pin {false};    // pin workers to CPUs, grouped by NUMA node
+	bool partition {false}; // every account is only changed by the worker that owns its partition
+	int shards {0};      // shard processes to fork (0 = run in this process)
+	bool fuse {false};   // coalesce each read batch's deposits, withdrawals and checks per account
+	bool follow {false}; // keep executing lines appended to the ledger until SIGINT/SIGTERM
+};
+
+// Lets InitBank stop the periodic reporter promptly.
+struct ReportTimer {
+	std::mutex lock;
+	std::condition_variable stop_cv;
+	bool stop {false};
+};
+
+void InitBank(int num_workers, std::string filename, const BankConfig& config = BankConfig());
+void InitBank(int num_workers, const std::vector<std::string>& paths, const BankConfig& config = BankConfig());
+bool prepare_bank(Bank& bank, const BankConfig& config, std::unique_ptr<WriteAheadLog>& wal, uint64_t ledger = 0);
+void report(Bank& bank, int interval_ms, ReportTimer& timer);
+bool is_binary_ledger(std::string filename);
+void read_ledgers(int num_readers, const std::vector<std::string>& files, bool mmap, LedgerQueue& ledger);
+void read_files(int num_readers, const std::vector<std::string>& files, LedgerQueue& ledger);
+void read_stream(int num_readers, std::string filename, LedgerQueue& ledger);
+void read_mapped(int num_readers, std::string filename, LedgerQueue& ledger);
+void read_follow(std::string filename, LedgerQueue& ledger);
+void load_ledger(std::atomic<int>& readers, int& ledger_id, std::ifstream& file, std::mutex& stream_lock, LedgerQueue& ledger);
+void load_chunk(std::atomic<int>& readers, const LedgerChunk& chunk, int first_id, LedgerQueue& ledger);
+void push_chunk(const LedgerChunk& chunk, int first_id, LedgerQueue& ledger);
+void load_records(std::atomic<int>& readers, const Ledger* begin, const Ledger* end, int first_id, LedgerQueue& ledger);
+void push_records(const Ledger* begin, const Ledger* end, int first_id, LedgerQueue& ledger);
+void push_batch(const Ledger* begin, const Ledger* end, LedgerQueue& ledger);
+void worker(Bank& bank, int worker_id, LedgerQueue& ledger);
+int execute_entry(Bank& bank, int worker_id, const Ledger& l);
+void execute_owned(Bank& bank, int worker_id, const LedgerItem& item, LedgerQueue& ledger);
 
-#endif
\ No newline at end of file
+#endif
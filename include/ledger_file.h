@@ -0,0 +1,64 @@
+#ifndef _LEDGER_FILE_H
+#define _LEDGER_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct Ledger;
+
+#define LEDGER_MAGIC   0x474C4442u  // "BDLG" on disk
+#define LEDGER_VERSION 1
+
+/**
+ * @brief Header of a binary ledger. It is followed by `count` records that
+ *        are laid out exactly like `struct Ledger`, ledger id included. Readers
+ *        number records by position and ignore the stored id.
+ */
+struct LedgerHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t count;
+  uint64_t checksum;  // sum of record_checksum() over all records
+};
+
+/**
+ * @brief Read-only memory mapping of a whole file. Unmapped when destroyed.
+ */
+class MappedFile {
+  public:
+    MappedFile(const std::string& filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool valid() const { return ok; }
+    const char* data() const { return base; }
+    size_t size() const { return length; }
+
+  private:
+    const char* base {nullptr};
+    size_t length {0};
+    bool ok {false};
+};
+
+// A byte range of a text ledger that starts and ends on a line boundary.
+struct LedgerChunk {
+  const char* begin;
+  const char* end;
+};
+
+std::vector<LedgerChunk> split_chunks(const char* data, size_t size, int num_chunks);
+int count_records(const LedgerChunk& chunk);
+const char* parse_record(const char* p, const char* end, Ledger& l, bool& ok);
+
+bool ledger_magic(const char* data, size_t size);
+const LedgerHeader* binary_header(const MappedFile& file);
+const LedgerHeader* binary_header(const char* data, size_t size);
+uint64_t record_checksum(const Ledger& l);
+bool convert_ledger(const std::string& in, const std::string& out);
+std::vector<std::string> ledger_files(const std::vector<std::string>& paths);
+
+#endif
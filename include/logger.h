@@ -0,0 +1,99 @@
+#ifndef _LOGGER_H
+#define _LOGGER_H
+
+#include <thread_slots.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#define LOG_BUFFER_SIZE 1024       // records per thread buffer (power of two)
+#define LOG_WRITE_SIZE  (64 << 10) // bytes formatted before each write
+
+enum Verbosity {
+  QUIET    = 0,  // nothing per operation; only print_accounts output
+  FAILURES = 1,  // failed operations only
+  ALL      = 2,  // every operation
+};
+
+enum Op : uint8_t {
+  OP_DEPOSIT,
+  OP_WITHDRAW,
+  OP_TRANSFER,
+  OP_BALANCE,
+  OP_OPEN,
+  OP_CLOSE,
+};
+
+// Result of one bank operation, formatted into a log line by the sink thread.
+struct LogRecord {
+  int  worker_id;
+  int  ledger_id;
+  int  acc_id;
+  int  dest_id;   // transfers only
+  long amount;    // balance for successful balance checks
+  Op   op;
+  bool success;
+};
+
+/**
+ * @brief Asynchronous operation log.
+ *
+ * Workers append fixed-size LogRecords to their own single-producer ring
+ * buffer, which costs no lock, no allocation, and no formatting. One sink
+ * thread, started on the first record, drains every buffer, formats the
+ * records into one large buffer, and hands it to the output stream in big
+ * writes. If a worker's buffer fills up, the worker waits for the sink
+ * rather than dropping lines.
+ *
+ * Lines from different workers interleave in whatever order the sink drains
+ * them, just as they did under the old global lock. `flush()` waits until
+ * everything recorded so far has been written.
+ */
+class Logger {
+  public:
+    Logger(std::ostream& out = std::cout) : out(out) {};
+    ~Logger();
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    void record(const LogRecord& r);
+    void flush();
+
+    void set_verbosity(Verbosity v) { level.store(v, std::memory_order_relaxed); }
+    Verbosity verbosity() const { return level.load(std::memory_order_relaxed); }
+
+  private:
+    struct alignas(64) Buffer {
+      std::atomic<size_t> head {0};              // written by the owning thread
+      alignas(64) std::atomic<size_t> tail {0};  // written by the sink
+      alignas(64) std::array<LogRecord, LOG_BUFFER_SIZE> records;
+    };
+
+    void start();
+    void sink();
+    bool drain(std::string& text);
+    static void format(const LogRecord& r, std::string& text);
+
+    std::ostream& out;
+    std::atomic<Verbosity> level {ALL};
+    PerThread<Buffer> buffers;
+
+    std::once_flag started;
+    std::atomic<bool> running {false};
+    std::thread sink_thread;
+    std::mutex sink_lock;
+    std::condition_variable wake_sink, flushed;
+    bool stopping {false};
+    uint64_t flush_requested {0};
+    uint64_t flush_done {0};
+};
+
+#endif
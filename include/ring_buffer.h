@@ -0,0 +1,202 @@
+#ifndef _RING_BUFFER_H
+#define _RING_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+
+#include <spin.h>
+#include <trace.h>
+
+#define RING_SPIN 256
+
+/**
+ * @brief Bounded lock-free multi-producer/multi-consumer queue.
+ *
+ * Each cell carries a sequence number telling producers and consumers whose
+ * turn it is (Vyukov's bounded MPMC queue), so the fast path is one CAS on
+ * `head` or `tail` and no lock. `head` and `tail` live on separate cache
+ * lines so producers and consumers do not false-share.
+ *
+ * `push` and `pop` spin for RING_SPIN attempts and then park on a futex
+ * (std::atomic::wait) until the other side signals. Signals are only sent
+ * when someone is actually parked, so an uncontended handoff never enters
+ * the kernel. Once `close` is called, `pop` drains what is left and then
+ * returns false instead of blocking, which is how workers learn the input
+ * is finished.
+ */
+template <typename T>
+class RingBuffer {
+  public:
+    /**
+     * @brief Construct a new ring buffer.
+     *
+     * @param capacity minimum number of slots (rounded up to a power of two)
+     */
+    explicit RingBuffer(size_t capacity) {
+      size_t size = 2;
+      while (size < capacity) size *= 2;
+      mask = size - 1;
+      cells.reset(new Cell[size]);
+      for (size_t i = 0; i < size; ++i) cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    size_t capacity() const { return mask + 1; }
+    bool is_closed() const { return closed.load(std::memory_order_acquire); }
+
+    /**
+     * @brief Enqueues an item if there is room.
+     *
+     * @param item item to enqueue
+     * @return true if the item was enqueued, false if the buffer is full
+     */
+    bool try_push(const T& item) {
+      size_t pos = head.load(std::memory_order_relaxed);
+      for (;;) {
+        Cell& cell = cells[pos & mask];
+        size_t seq = cell.seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+          if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            cell.item = item;
+            TRACE_STAMP(cell.pushed);
+            cell.seq.store(pos + 1, std::memory_order_release);
+            wake(pop_waiters, pop_signal);
+            return true;
+          }
+        } else if (diff < 0) {
+          return false;
+        } else {
+          pos = head.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    /**
+     * @brief Dequeues an item if one is available.
+     *
+     * @param item receives the dequeued item
+     * @return true if an item was dequeued, false if the buffer is empty
+     */
+    bool try_pop(T& item) {
+      size_t pos = tail.load(std::memory_order_relaxed);
+      for (;;) {
+        Cell& cell = cells[pos & mask];
+        size_t seq = cell.seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+          if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            item = cell.item;
+            TRACE_DEQUEUED(cell.pushed);
+            cell.seq.store(pos + mask + 1, std::memory_order_release);
+            wake(push_waiters, push_signal);
+            return true;
+          }
+        } else if (diff < 0) {
+          return false;
+        } else {
+          pos = tail.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    /**
+     * @brief Enqueues an item, waiting for room if the buffer is full.
+     *
+     * @param item item to enqueue
+     * @return true once enqueued, false if the buffer was closed first
+     */
+    bool push(const T& item) {
+      for (int i = 0; i < RING_SPIN; ++i) {
+        if (try_push(item)) return true;
+        cpu_relax();
+      }
+      for (;;) {
+        if (is_closed()) return false;
+        push_waiters.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint32_t signal = push_signal.load(std::memory_order_acquire);
+        bool pushed = try_push(item);
+        if (!pushed && !is_closed()) push_signal.wait(signal);
+        push_waiters.fetch_sub(1);
+        if (pushed) return true;
+      }
+    }
+
+    /**
+     * @brief Dequeues an item, waiting for one if the buffer is empty.
+     *
+     * @param item receives the dequeued item
+     * @return true if an item was dequeued, false if the buffer is closed and empty
+     */
+    bool pop(T& item) {
+      for (int i = 0; i < RING_SPIN; ++i) {
+        if (try_pop(item)) return true;
+        cpu_relax();
+      }
+      for (;;) {
+        pop_waiters.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint32_t signal = pop_signal.load(std::memory_order_acquire);
+        bool popped = try_pop(item);
+        bool finished = !popped && is_closed();
+        // Items pushed before close() must still be drained.
+        if (finished) popped = try_pop(item);
+        else if (!popped) pop_signal.wait(signal);
+        pop_waiters.fetch_sub(1);
+        if (popped) return true;
+        if (finished) return false;
+      }
+    }
+
+    /**
+     * @brief Marks the end of input and wakes every parked thread. Must only
+     *        be called once all producers are done pushing.
+     */
+    void close() {
+      closed.store(true, std::memory_order_seq_cst);
+      pop_signal.fetch_add(1);
+      pop_signal.notify_all();
+      push_signal.fetch_add(1);
+      push_signal.notify_all();
+    }
+
+  private:
+    struct Cell {
+      std::atomic<size_t> seq;
+      T item;
+#ifdef BANK_TRACE
+      uint64_t pushed;  // when the item was pushed, for queue-wait histograms
+#endif
+    };
+
+    /**
+     * @brief Wakes one parked thread on the other side, if any. The fence pairs
+     *        with the one a waiter issues after registering, so either the
+     *        waiter sees our update or we see the waiter.
+     */
+    static void wake(std::atomic<uint32_t>& waiters, std::atomic<uint32_t>& signal) {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (waiters.load(std::memory_order_relaxed) != 0) {
+        signal.fetch_add(1, std::memory_order_release);
+        signal.notify_one();
+      }
+    }
+
+    size_t mask;
+    std::unique_ptr<Cell[]> cells;
+
+    alignas(64) std::atomic<size_t> head {0};
+    alignas(64) std::atomic<size_t> tail {0};
+    alignas(64) std::atomic<uint32_t> pop_waiters {0};
+    std::atomic<uint32_t> pop_signal {0};
+    alignas(64) std::atomic<uint32_t> push_waiters {0};
+    std::atomic<uint32_t> push_signal {0};
+    alignas(64) std::atomic<bool> closed {false};
+};
+
+#endif
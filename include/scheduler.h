@@ -0,0 +1,75 @@
+#ifndef _SCHEDULER_H
+#define _SCHEDULER_H
+
+#include <ledger.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Deterministic, conflict-aware executor for batches of ledger entries.
+ *
+ * For every batch the scheduler works out which accounts each entry reads
+ * and writes. Balance checks read their account. Every other op writes its
+ * account, and transfers write both accounts. From that it builds a
+ * dependency graph in ledger order:
+ * - An entry waits for the last earlier entry that wrote any of its accounts.
+ * - A write also waits for the reads of its accounts since that write.
+ *
+ * A persistent pool of workers then runs entries as their dependencies
+ * complete. Non-conflicting entries run in parallel, and entries that share
+ * an account run in ledger order.
+ *
+ * Every account therefore sees exactly the sequence of operations a
+ * single-threaded replay would apply. Entries that touch different accounts
+ * commute, so the final balances and every success/failure outcome are the
+ * same as a sequential replay at any number of workers.
+ */
+class Scheduler {
+  public:
+    Scheduler(Bank& bank, int num_workers);
+    ~Scheduler();
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    void execute(const std::vector<Ledger>& batch);
+
+  private:
+    // Accesses to one account within the current batch.
+    struct AccountUse {
+      int last_write {-1};
+      std::vector<int> reads;  // reads since last_write
+    };
+
+    void build(const std::vector<Ledger>& batch);
+    void depend(int before, int after);
+    void use(int entry, int acc_id, bool write);
+    void work(int worker_id);
+
+    Bank& bank;
+    std::vector<std::thread> threads;
+
+    // Dependency graph of the current batch.
+    const std::vector<Ledger>* entries {nullptr};
+    std::unique_ptr<std::atomic<int>[]> deps;
+    std::vector<std::vector<int>> successors;
+    std::unordered_map<int, AccountUse> uses;
+    std::unique_ptr<RingBuffer<int>> ready;
+    std::atomic<int> remaining {0};
+
+    // Batch handoff between execute() and the pool.
+    std::mutex batch_lock;
+    std::condition_variable batch_start, batch_done;
+    uint64_t generation {0};
+    int idle {0};
+    bool stopping {false};
+};
+
+void sequence(Bank& bank, int num_workers, size_t batch_size, LedgerQueue& ledger, bool eager = false);
+
+#endif
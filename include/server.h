@@ -0,0 +1,129 @@
+#ifndef _SERVER_H
+#define _SERVER_H
+
+#include <engine.h>
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define SERVER_READ_SIZE 65536  // bytes read from a socket per read()
+#define SERVER_MAX_EVENTS 64
+#define SERVER_DRAIN_MS 1000    // longest drain() waits for a client to take its replies
+#define SERVER_MAX_PENDING 64   // batches in flight per connection before it is no longer read
+
+// Reply to one binary record: the record's ledger id and its result.
+struct LedgerReply {
+  int32_t ledgerID;
+  int32_t result;  // 0 on success, -1 on failure
+};
+
+int listen_on(const std::string& address);
+int connect_to(const std::string& address);
+
+/**
+ * @brief epoll server that feeds ledger entries from sockets to a BankEngine.
+ *
+ * One event-loop thread accepts connections, reads and parses requests and
+ * writes replies; the engine's workers execute them, so I/O and execution
+ * never share threads. A connection is binary if it starts with the 4-byte
+ * LEDGER_MAGIC, followed by `struct Ledger` records whose ledger ids are
+ * chosen by the client; replies are `LedgerReply` records. Otherwise it is
+ * text: one "FROM TO AMOUNT MODE" line per entry, numbered from 0 per
+ * connection, answered by "LEDGER_ID RESULT" lines.
+ *
+ * Those ids only match replies to requests. The bank sees ledger ids the
+ * server deals out itself, one sequence across all connections that starts
+ * at `first_id`, so ids never repeat within a run or, given the bank's
+ * next_ledger_id(), across runs that share a write-ahead log.
+ *
+ * Clients may pipeline any number of requests. Every complete record in one
+ * read becomes one engine batch, and the replies of a batch are queued and
+ * written together. Batches run concurrently, so replies may come back out
+ * of request order; they carry the ledger id to match them up.
+ *
+ * The loop never waits for the engine: a submitter thread hands batches to
+ * it, so a full engine queue only holds up that thread. A connection with
+ * SERVER_MAX_PENDING batches in flight is not read again until some of its
+ * replies are back. With a write-ahead log, a batch is only answered once
+ * WriteAheadLog::sync() has made its records durable, so a reply is never
+ * lost in a crash.
+ */
+class LedgerServer {
+  public:
+    LedgerServer(BankEngine& engine, const std::string& address, int first_id = 0, WriteAheadLog* wal = nullptr);
+    ~LedgerServer();
+
+    LedgerServer(const LedgerServer&) = delete;
+    LedgerServer& operator=(const LedgerServer&) = delete;
+
+    bool valid() const { return listen_fd >= 0 && epoll_fd >= 0 && wake_fd >= 0; }
+    void run();
+    void stop();
+    void drain();
+
+  private:
+    struct Connection {
+      int fd;
+      bool detected {false};  // whether the format is known yet
+      bool binary {false};
+      bool eof {false};       // the client shut down its side
+      bool throttled {false}; // not read while SERVER_MAX_PENDING batches are in flight
+      int next_id {0};        // next reply id of a text connection
+      std::vector<char> in;
+      std::atomic<int> pending {0};  // batches still running
+
+      std::mutex out_lock;
+      std::string out;
+      bool queued {false};    // in the server's flush list
+      bool want_write {false};  // output is waiting for EPOLLOUT
+      bool watched {false};     // in the epoll set
+    };
+
+    // A parsed batch on its way to the engine.
+    struct Submission {
+      std::shared_ptr<Connection> conn;
+      std::vector<Ledger> entries;
+      std::vector<int> ids;  // what the client knows each entry by
+    };
+
+    void submit_all();
+    void stop_submitter();
+    void accept_all();
+    void read_from(const std::shared_ptr<Connection>& conn);
+    void parse(const std::shared_ptr<Connection>& conn);
+    void reply(const std::shared_ptr<Connection>& conn, const std::vector<int>& ids, const std::vector<int>& results);
+    void flush(const std::shared_ptr<Connection>& conn);
+    void watch(const std::shared_ptr<Connection>& conn);
+    void close_connection(const std::shared_ptr<Connection>& conn);
+
+    BankEngine& engine;
+    WriteAheadLog* wal;  // synced before replies are sent, if set
+    int listen_fd {-1};
+    int epoll_fd {-1};
+    int wake_fd {-1};  // eventfd: replies ready or stop requested
+    std::atomic<bool> stopping {false};
+    int next_id;  // next ledger id the bank sees; event loop only
+    std::unordered_map<int, std::shared_ptr<Connection>> connections;
+
+    // Connections with replies the loop has not written yet.
+    std::mutex flush_lock;
+    std::vector<std::shared_ptr<Connection>> to_flush;
+
+    // Batches the loop has parsed and the submitter has not handed over yet.
+    std::thread submitter;
+    std::mutex submit_lock;
+    std::condition_variable has_submission;
+    std::deque<Submission> submissions;
+    bool submitting {true};
+};
+
+void ServeBank(int num_workers, std::string address, const BankConfig& config = BankConfig());
+
+#endif
@@ -0,0 +1,235 @@
+#ifndef _SHARD_H
+#define _SHARD_H
+
+#include <ledger.h>
+
+#include <semaphore.h>  /* for sem */
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#define SHARD_RING_SIZE 4096  // slots of each shared-memory ring (power of two)
+#define SHARD_TABLE_BITS 20   // account slots per shard process: 2^SHARD_TABLE_BITS
+#define SHARD_BATCH 64        // ledger entries a shard runs between checks of its peer ring
+#define MAX_SHARDS (1 << INDEX_SHARD_BITS)
+
+/**
+ * @brief Bounded lock-free multi-producer/multi-consumer queue that keeps its
+ *        cells inline, so it can be placed in a shared mapping and used by
+ *        several processes at once.
+ *
+ * This is RingBuffer's algorithm (one CAS on `head` or `tail` per operation)
+ * with a fixed capacity and no blocking: futex waits in std::atomic are
+ * process-private, so callers park on a process-shared semaphore instead.
+ */
+template <typename T, size_t N>
+class ShmRing {
+  static_assert((N & (N - 1)) == 0, "ring size must be a power of two");
+
+  public:
+    ShmRing() {
+      for (size_t i = 0; i < N; ++i) cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    ShmRing(const ShmRing&) = delete;
+    ShmRing& operator=(const ShmRing&) = delete;
+
+    bool empty() const { return tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire); }
+
+    /**
+     * @brief Enqueues an item if there is room.
+     *
+     * @return true if the item was enqueued, false if the ring is full
+     */
+    bool try_push(const T& item) {
+      size_t pos = head.load(std::memory_order_relaxed);
+      for (;;) {
+        Cell& cell = cells[pos & (N - 1)];
+        intptr_t diff = (intptr_t)cell.seq.load(std::memory_order_acquire) - (intptr_t)pos;
+        if (diff == 0) {
+          if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            cell.item = item;
+            cell.seq.store(pos + 1, std::memory_order_release);
+            return true;
+          }
+        } else if (diff < 0) {
+          return false;
+        } else {
+          pos = head.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    /**
+     * @brief Dequeues an item if one is available.
+     *
+     * @return true if an item was dequeued, false if the ring is empty
+     */
+    bool try_pop(T& item) {
+      size_t pos = tail.load(std::memory_order_relaxed);
+      for (;;) {
+        Cell& cell = cells[pos & (N - 1)];
+        intptr_t diff = (intptr_t)cell.seq.load(std::memory_order_acquire) - (intptr_t)(pos + 1);
+        if (diff == 0) {
+          if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            item = cell.item;
+            cell.seq.store(pos + N, std::memory_order_release);
+            return true;
+          }
+        } else if (diff < 0) {
+          return false;
+        } else {
+          pos = tail.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+  private:
+    struct Cell {
+      std::atomic<size_t> seq;
+      T item;
+    };
+
+    alignas(64) std::atomic<size_t> head {0};
+    alignas(64) std::atomic<size_t> tail {0};
+    alignas(64) Cell cells[N];
+};
+
+// What a ShardMsg asks of its receiver.
+enum ShardMsgKind : int32_t {
+  MSG_PREPARE,  // source to destination: the source's vote, with the amount held if it is VOTE_YES
+  MSG_COMMIT,   // destination to source: the destination was credited
+  MSG_ABORT,    // destination to source: the transfer failed for `reason`; release the held amount
+};
+
+#define VOTE_YES NUM_FAIL_REASONS  // a source vote that is not a failure reason
+
+// One step of a cross-shard transfer.
+struct ShardMsg {
+  Ledger entry;
+  int32_t kind;
+  int32_t vote;    // the source's vote, echoed back by the destination
+  int32_t reason;  // why an aborted transfer failed
+};
+
+// An account slot. Only the owning shard process writes it.
+struct ShardAccount {
+  int32_t id;
+  bool used;
+  bool open;
+  long balance;
+};
+
+/**
+ * @brief Everything one shard process shares with the others: its two input
+ *        rings, the semaphore it parks on, and its operation counters.
+ */
+struct alignas(64) ShardState {
+  ShmRing<Ledger, SHARD_RING_SIZE> input;    // entries from the router
+  ShmRing<ShardMsg, SHARD_RING_SIZE> peers;  // transfer messages from other shards
+  sem_t wakeup;
+  alignas(64) std::atomic<bool> sleeping {false};
+  std::atomic<bool> input_done {false};  // the router's entries are all executed
+  std::atomic<bool> failed {false};      // the process died
+  size_t accounts {0};
+  pid_t pid {-1};
+  OpCounters counters;
+};
+
+// State of the whole sharded run, at the start of the shared mapping.
+struct ShardRegion {
+  std::atomic<bool> input_closed {false};  // the router has submitted every entry
+  std::atomic<int> draining {0};           // shards whose input_done is not set yet
+  std::atomic<long> in_flight {0};         // prepared transfers not committed or aborted yet
+  std::atomic<bool> failed {false};        // some shard died
+};
+
+/**
+ * @brief A bank split over `num_shards` forked processes.
+ *
+ * Every shard process owns a contiguous range of AccountIndex shards (the
+ * same split LedgerQueue::owner() makes for up to MAX_SHARDS workers) and keeps those accounts
+ * in its own open-addressing table inside one shared anonymous mapping. Only
+ * the owner writes its table, so accounts need no locks, a crash of one
+ * shard cannot corrupt another's accounts, and the parent can read every
+ * table once the shards are done. Each table also lists its used slots, so
+ * listing the accounts never touches (and commits) the empty parts.
+ *
+ * The parent routes each entry to the owner of its `from` account through
+ * that shard's input ring. A shard runs its entries in ring order, one at a
+ * time. A transfer whose destination lives on another shard runs in two
+ * phases:
+ *
+ *   1. The source shard votes: it checks the source account and, if the
+ *      transfer can go ahead, holds the amount by debiting it. The vote goes
+ *      to the destination shard as MSG_PREPARE.
+ *   2. The destination shard decides: it combines the vote with the
+ *      destination account, in the order Bank::transfer checks (missing, then
+ *      closed, then funds), credits the account if both sides agree and
+ *      replies MSG_COMMIT, or replies MSG_ABORT with the failure reason.
+ *
+ * The source logs the outcome once the reply arrives and, on an abort, gives
+ * the held amount back. Held money is missing from the source while the
+ * transfer is in flight, as if the transfer had already happened. Shards
+ * never wait for a reply: messages that do not fit into a full peer ring are
+ * kept locally and retried, so two shards sending to each other cannot
+ * deadlock.
+ *
+ * Shards park on a process-shared semaphore when both rings are empty. They
+ * exit once every shard has finished its input and no transfer is in
+ * flight. If a shard dies, the parent marks it failed: entries for it are
+ * dropped, the other shards stop waiting for its replies, and its accounts
+ * are still listed as they were when it died.
+ */
+class ShardedBank {
+  public:
+    ShardedBank(int num_shards, Verbosity verbosity = ALL);
+    ~ShardedBank();
+
+    ShardedBank(const ShardedBank&) = delete;
+    ShardedBank& operator=(const ShardedBank&) = delete;
+
+    bool valid() const { return region != nullptr; }
+    int shards() const { return num_shards; }
+    int owner(int acc_id) const { return (AccountIndex::shard(acc_id) * num_shards) >> INDEX_SHARD_BITS; }
+
+    bool seed(int acc_id, long balance);
+    bool start();
+    bool submit(const Ledger& l);
+    void close();
+    bool wait();
+
+    std::vector<std::pair<int, long>> balances() const;
+    BankStats stats() const;
+    void print_accounts() const;
+
+  private:
+    friend class ShardProcess;
+
+    ShardState& state(int shard) const { return states[shard]; }
+    ShardAccount* table(int shard) const { return tables + ((size_t)shard << SHARD_TABLE_BITS); }
+    ShardAccount* find(int shard, int acc_id) const;
+    ShardAccount* insert(int shard, int acc_id);
+    void notify(int shard) const;
+    void wake_all() const;
+    void monitor();
+
+    int num_shards;
+    Verbosity verbosity;
+    size_t mapped {0};
+    ShardRegion* region {nullptr};
+    ShardState* states {nullptr};
+    ShardAccount* tables {nullptr};
+    uint32_t* used_slots {nullptr};  // per shard, the slots in use in insertion order
+    std::thread monitor_thread;
+};
+
+void ShardBank(int num_workers, std::string filename, const BankConfig& config = BankConfig());
+void ShardBank(int num_workers, const std::vector<std::string>& paths, const BankConfig& config = BankConfig());
+
+#endif
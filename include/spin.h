@@ -0,0 +1,30 @@
+#ifndef _SPIN_H
+#define _SPIN_H
+
+#include <thread>
+
+#define SPIN_BEFORE_YIELD 64
+
+/**
+ * @brief Spin-wait hint to the CPU.
+ */
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+/**
+ * @brief One step of a spin-wait loop: pause for the first few iterations,
+ *        then give the CPU away in case the thread we wait on is preempted.
+ *
+ * @param spins iteration counter owned by the caller
+ */
+inline void spin_wait(int& spins) {
+  if (++spins < SPIN_BEFORE_YIELD) cpu_relax();
+  else std::this_thread::yield();
+}
+
+#endif
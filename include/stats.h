@@ -0,0 +1,54 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <logger.h>
+
+#include <stdint.h>
+#include <atomic>
+#include <iostream>
+
+#define NUM_OPS 6
+
+enum FailReason : uint8_t {
+  FAIL_MISSING,       // account does not exist
+  FAIL_CLOSED,        // account exists but is closed
+  FAIL_FUNDS,         // insufficient funds
+  FAIL_SAME_ACCOUNT,  // transfer from an account to itself
+  FAIL_EXISTS,        // open of an account that already exists
+  NUM_FAIL_REASONS,
+};
+
+// Aggregated operation counts, broken down by op type and failure reason.
+struct BankStats {
+  uint64_t succ[NUM_OPS] {};
+  uint64_t fail[NUM_OPS] {};
+  uint64_t reasons[NUM_FAIL_REASONS] {};
+
+  uint64_t successes() const;
+  uint64_t failures() const;
+  void print(std::ostream& out) const;
+};
+
+/**
+ * @brief One thread's operation counters, alone on its cache line(s).
+ *
+ * Only the owning thread writes, so a bump is a relaxed load and store rather
+ * than a locked read-modify-write; readers aggregating the counters see each
+ * value whole.
+ */
+struct alignas(64) OpCounters {
+  std::atomic<uint64_t> succ[NUM_OPS] {};
+  std::atomic<uint64_t> fail[NUM_OPS] {};
+  std::atomic<uint64_t> reasons[NUM_FAIL_REASONS] {};
+
+  static void bump(std::atomic<uint64_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  void add_to(BankStats& stats) const;
+};
+
+const char* op_name(Op op);
+const char* reason_name(FailReason reason);
+
+#endif
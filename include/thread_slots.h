@@ -0,0 +1,85 @@
+#ifndef _THREAD_SLOTS_H
+#define _THREAD_SLOTS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * @brief One T per thread that touches this object.
+ *
+ * `local()` hands each thread its own slot, created on first use, so hot-path
+ * writes never share a cache line with another thread (T should be
+ * cache-line aligned). Readers that need every thread's data call `for_each`.
+ * Slots outlive the threads that made them and are destroyed with the
+ * PerThread object.
+ *
+ * Each thread caches slot pointers keyed by a process-wide owner id rather
+ * than by `this`, so a new object at a recycled address never sees a stale
+ * slot.
+ */
+template <typename T>
+class PerThread {
+  public:
+    PerThread() : owner(next_owner()) {};
+    ~PerThread() {};
+
+    PerThread(const PerThread&) = delete;
+    PerThread& operator=(const PerThread&) = delete;
+
+    /**
+     * @brief The calling thread's slot.
+     *
+     * @return T& the slot, default constructed on the thread's first call
+     */
+    T& local() {
+      Cache& cache = thread_cache();
+      if (cache.last_owner == owner) return *cache.last;
+
+      T*& slot = cache.slots[owner];
+      if (slot == nullptr) {
+        // Automatically unlocks when destroyed.
+        std::scoped_lock lock {slots_lock};
+        slot = &slots.emplace_back();
+      }
+      cache.last_owner = owner;
+      cache.last = slot;
+      return *slot;
+    }
+
+    /**
+     * @brief Calls f(slot) on every thread's slot. Threads keep writing to
+     *        their slots while this runs.
+     */
+    template <typename F>
+    void for_each(F f) {
+      // Automatically unlocks when destroyed.
+      std::scoped_lock lock {slots_lock};
+      for (T& slot : slots) f(slot);
+    }
+
+  private:
+    struct Cache {
+      uint64_t last_owner {0};
+      T* last {nullptr};
+      std::unordered_map<uint64_t, T*> slots;
+    };
+
+    static Cache& thread_cache() {
+      thread_local Cache cache;
+      return cache;
+    }
+
+    static uint64_t next_owner() {
+      static std::atomic<uint64_t> next {1};
+      return next++;
+    }
+
+    uint64_t owner;
+    std::mutex slots_lock;
+    std::deque<T> slots;
+};
+
+#endif
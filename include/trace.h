@@ -0,0 +1,108 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stats.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <signal.h>
+
+#define TRACE_SUB_BITS 4   // 16 linear sub-buckets per power of two: at most 6.25% error
+#define TRACE_MAX_EXP  36  // values of 2^37 ns (about two minutes) and up share the last bucket
+#define TRACE_BUCKETS  ((TRACE_MAX_EXP - TRACE_SUB_BITS + 2) << TRACE_SUB_BITS)
+#define DEFAULT_TRACE_FILE "bank_trace.json"
+
+// What a latency sample measures.
+enum TraceKind : uint8_t {
+  TRACE_QUEUE,  // pushed by a reader until popped by a worker
+  TRACE_LOCK,   // waiting for an account's write_lock
+  TRACE_EXEC,   // running the bank operation
+  NUM_TRACE_KINDS,
+};
+
+/**
+ * @brief HDR-style log-linear histogram of nanosecond latencies. Values
+ *        below 2^TRACE_SUB_BITS get a bucket each; above that every power of
+ *        two is split into 2^TRACE_SUB_BITS equal buckets.
+ *
+ * Only the owning thread records, so a bump is a relaxed load and store like
+ * OpCounters::bump, and a dump running at the same time reads whole counts.
+ */
+struct LatencyHistogram {
+  std::atomic<uint64_t> buckets[TRACE_BUCKETS] {};
+
+  static size_t bucket_of(uint64_t ns) {
+    if (ns < (1u << TRACE_SUB_BITS)) return ns;
+    int e = 63 - __builtin_clzll(ns);
+    if (e > TRACE_MAX_EXP) return TRACE_BUCKETS - 1;
+    return ((e - TRACE_SUB_BITS + 1) << TRACE_SUB_BITS) + ((ns >> (e - TRACE_SUB_BITS)) & ((1u << TRACE_SUB_BITS) - 1));
+  }
+
+  static uint64_t lowest(size_t bucket);
+
+  void record(uint64_t ns) {
+    std::atomic<uint64_t>& b = buckets[bucket_of(ns)];
+    b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+};
+
+// One thread's histograms, for every op and kind of sample.
+struct alignas(64) OpTrace {
+  LatencyHistogram hist[NUM_OPS][NUM_TRACE_KINDS];
+};
+
+inline uint64_t trace_clock() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Queue wait of the last item this thread popped from a RingBuffer.
+inline thread_local uint64_t trace_queue_wait = 0;
+
+void trace_record(TraceKind kind, int op, uint64_t ns);
+bool trace_dump(const std::string& path);
+
+/**
+ * @brief Writes the histograms to a stats file on every SIGUSR1 and once more
+ *        when destroyed. SIGUSR1 is blocked in the creating thread for the
+ *        object's lifetime, so create it before any other thread that should
+ *        inherit the blocked mask; a dedicated thread takes the signal with
+ *        sigwait().
+ */
+class TraceDumper {
+  public:
+    TraceDumper(const std::string& path);
+    ~TraceDumper();
+
+    TraceDumper(const TraceDumper&) = delete;
+    TraceDumper& operator=(const TraceDumper&) = delete;
+
+  private:
+    void wait_signals();
+
+    std::string path;
+    sigset_t old_mask;
+    std::atomic<bool> stop {false};
+    std::thread dumper;
+};
+
+// The instrumentation is compiled in only with -DBANK_TRACE (make TRACE=1);
+// otherwise these expand to nothing and the hot paths are unchanged.
+#ifdef BANK_TRACE
+#define TRACE_START(var)              uint64_t var = trace_clock()
+#define TRACE_RECORD(kind, op, start) trace_record(kind, op, trace_clock() - (start))
+#define TRACE_STAMP(var)              (var) = trace_clock()
+#define TRACE_DEQUEUED(stamp)         trace_queue_wait = trace_clock() - (stamp)
+#define TRACE_QUEUED(op)              trace_record(TRACE_QUEUE, op, trace_queue_wait)
+#else
+#define TRACE_START(var)
+#define TRACE_RECORD(kind, op, start)
+#define TRACE_STAMP(var)
+#define TRACE_DEQUEUED(stamp)
+#define TRACE_QUEUED(op)
+#endif
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef _WAL_H
+#define _WAL_H
+
+#include <logger.h>
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define WAL_MAGIC   0x4C415747u  // "GWAL" on disk
+#define WAL_VERSION 4
+#define WAL_GROUP_RECORDS 4096                        // commit early once this many records are pending
+#define WAL_COMMIT_INTERVAL std::chrono::milliseconds(2) // longest a record waits for its group
+#define WAL_FAILED 0x100  // set in WalRecord::op for an operation that failed
+
+struct WalHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t ledger;  // ledger_fingerprint() of the ledger the log was written for
+  uint64_t log_id;  // random, never 0; tells this log from any other
+};
+
+/**
+ * @brief One executed operation. Failures are logged too, with WAL_FAILED
+ *        set in `op`, so that recovery knows their ledger ids ran; they
+ *        change nothing on replay. Records carry their own checksum so a
+ *        torn write at the end of the log is detected and dropped on recovery.
+ */
+struct WalRecord {
+  int32_t ledger_id;
+  int32_t acc_id;
+  int32_t dest_id;  // transfers only
+  int32_t op;       // Op, plus WAL_FAILED if it failed
+  int64_t amount;
+  uint64_t checksum;
+};
+
+static_assert(sizeof(WalRecord) == 32, "WAL records must not contain padding");
+
+uint64_t wal_checksum(const WalRecord& rec);
+uint64_t ledger_fingerprint(const std::vector<std::string>& files);
+bool read_wal(const std::string& path, std::vector<WalRecord>& records, uint64_t ledger = 0);
+
+/**
+ * @brief Append-only write-ahead log of applied operations with group commit.
+ *
+ * `append()` only copies a record into the pending group under a short lock.
+ * A background committer thread writes the whole group with one `write()` and
+ * makes it durable with one `fdatasync()`, so every worker whose record landed
+ * in the group shares the cost of a single sync. A group is committed when it
+ * reaches WAL_GROUP_RECORDS, when WAL_COMMIT_INTERVAL has passed, or when
+ * someone is waiting in `sync()`.
+ */
+class WriteAheadLog {
+  public:
+    WriteAheadLog(const std::string& path, uint64_t ledger = 0);
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    bool valid() const { return fd >= 0; }
+    uint64_t id() const { return log_id; }
+    void append(const LogRecord& result);
+    void sync();
+    uint64_t records();
+
+  private:
+    void commit();
+
+    int fd {-1};
+    uint64_t log_id {0};
+    std::thread committer;
+
+    std::mutex wal_lock;
+    std::condition_variable commit_cv, durable_cv;
+    std::vector<WalRecord> pending;
+    uint64_t existing {0};  // records already in the file when it was opened
+    uint64_t appended {0};  // records appended so far
+    uint64_t durable {0};   // records known to be on disk
+    int waiters {0};
+    bool stopping {false};
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef _WORKLOAD_H
+#define _WORKLOAD_H
+
+#include <ledger.h>
+
+#include <stdint.h>
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Shape of a synthetic ledger.
+ *
+ * Account ids are drawn from a Zipf distribution over 0 ... accounts-1 in
+ * which id k has weight 1/(k+1)^zipf, so low ids are the hot accounts and
+ * zipf = 0 is uniform. With probability `locality` a transfer's destination
+ * is drawn from the LOCALITY_WINDOW accounts around its source instead of
+ * from the whole distribution.
+ */
+struct WorkloadConfig {
+  int entries {100000};
+  int accounts {1000};
+  double zipf {0.0};
+  double mix[6] {30, 25, 30, 15, 0, 0};  // relative weight of each mode 0 ... 5; no opens or closes,
+                                         // since a closed hot account fails everything after it
+  double locality {0.0};
+  uint32_t seed {377};
+  bool open_accounts {true};  // start with an open for every account past the bank's initial 10
+};
+
+#define LOCALITY_WINDOW 16
+
+/**
+ * @brief Samples account ids from a Zipf distribution by binary search over
+ *        its cumulative weights.
+ */
+class ZipfSampler {
+  public:
+    ZipfSampler(int n, double s);
+    int operator()(std::mt19937& rng) const;
+
+  private:
+    std::vector<double> cdf;
+};
+
+std::vector<Ledger> generate_ledger(const WorkloadConfig& config);
+bool write_ledger(const std::string& path, const std::vector<Ledger>& entries, bool binary);
+
+#endif
@@ -0,0 +1,159 @@
+#include <account_index.h>
+
+#include <algorithm>
+
+/**
+ * @brief Fibonacci hash of an account id. The top INDEX_SHARD_BITS pick the
+ *        shard and the mixed low bits pick the starting slot.
+ *
+ * @param acc_id the account ID to hash
+ * @return uint64_t the hash
+ */
+uint64_t AccountIndex::hash(int acc_id) {
+  uint64_t h = (uint64_t)(uint32_t)acc_id * 0x9E3779B97F4A7C15ull;
+  return h ^ (h >> 29);
+}
+
+/**
+ * @brief Places an account in the first empty slot of its probe sequence. The
+ *        key is written before the account pointer is published, so a reader
+ *        that sees the pointer also sees the key.
+ *
+ * @param table table to insert into (must have a free slot)
+ * @param h hash of the account id
+ * @param acc_id the account ID
+ * @param acc the account
+ */
+void AccountIndex::place(Table& table, uint64_t h, int acc_id, Account* acc) {
+  for (size_t i = h & table.mask; ; i = (i + 1) & table.mask) {
+    Slot& slot = table.slots[i];
+    if (slot.acc.load(std::memory_order_relaxed) == nullptr) {
+      slot.key.store(acc_id, std::memory_order_relaxed);
+      slot.acc.store(acc, std::memory_order_release);
+      return;
+    }
+  }
+}
+
+/**
+ * @brief Replaces a shard's table with one of the given capacity. Must be
+ *        called with the shard's `insert_lock` held. The old table is kept
+ *        alive since lock-free readers may still be probing it.
+ *
+ * @param shard shard to grow
+ * @param capacity new capacity (a power of two)
+ */
+void AccountIndex::grow(Shard& shard, size_t capacity) {
+  Table* old_table = shard.table.load(std::memory_order_relaxed);
+  auto table = std::make_unique<Table>(capacity);
+  if (old_table != nullptr) {
+    for (size_t i = 0; i <= old_table->mask; ++i) {
+      Account* acc = old_table->slots[i].acc.load(std::memory_order_relaxed);
+      if (acc == nullptr) continue;
+      int acc_id = old_table->slots[i].key.load(std::memory_order_relaxed);
+      place(*table, hash(acc_id), acc_id, acc);
+    }
+  }
+
+  shard.table.store(table.get(), std::memory_order_release);
+  shard.tables.push_back(std::move(table));
+}
+
+/**
+ * @brief Looks up an account without taking any lock.
+ *
+ * @param acc_id the account ID to look up
+ * @return Account* the account, or nullptr if it does not exist
+ */
+Account* AccountIndex::find(int acc_id) const {
+  uint64_t h = hash(acc_id);
+  const Table* table = shards[shard_of(h)].table.load(std::memory_order_acquire);
+  if (table == nullptr) return nullptr;
+
+  for (size_t i = h & table->mask; ; i = (i + 1) & table->mask) {
+    const Slot& slot = table->slots[i];
+    Account* acc = slot.acc.load(std::memory_order_acquire);
+    if (acc == nullptr) return nullptr;
+    if (slot.key.load(std::memory_order_relaxed) == acc_id) return acc;
+  }
+}
+
+/**
+ * @brief Finds an account, creating it with the given state word (by default
+ *        closed with a zero balance) if it does not exist yet. The state is
+ *        set before the account is published. Exactly one concurrent caller
+ *        for a given id observes `inserted == true`.
+ *
+ * @param acc_id the account ID to insert
+ * @param state initial Account state word of a new account
+ * @return std::pair<Account*, bool> the account and whether it was created
+ */
+std::pair<Account*, bool> AccountIndex::insert(int acc_id, long state) {
+  if (Account* acc = find(acc_id)) return {acc, false};
+
+  uint64_t h = hash(acc_id);
+  Shard& shard = shards[shard_of(h)];
+
+  // Automatically unlocks when destroyed.
+  std::scoped_lock lock {shard.insert_lock};
+  // Someone may have inserted the id while we waited for the lock.
+  if (Account* acc = find(acc_id)) return {acc, false};
+
+  Table* table = shard.table.load(std::memory_order_relaxed);
+  size_t capacity = table == nullptr ? 0 : table->mask + 1;
+  // Keep the load factor at or below 1/2 so probe sequences stay short.
+  if (2 * (shard.count + 1) > capacity) {
+    grow(shard, std::max<size_t>(INDEX_SHARD_SLOTS, 2 * capacity));
+    table = shard.table.load(std::memory_order_relaxed);
+  }
+
+  Account* acc = &shard.arena.emplace_back();
+  acc->state.store(state, std::memory_order_relaxed);
+  place(*table, h, acc_id, acc);
+  shard.count++;
+
+  return {acc, true};
+}
+
+/**
+ * @brief Sizes every shard up front for roughly n accounts, avoiding repeated
+ *        growth when a bank is created with many accounts.
+ *
+ * @param n expected number of accounts
+ */
+void AccountIndex::reserve(size_t n) {
+  size_t per_shard = n / shards.size() + 1;
+  size_t capacity = INDEX_SHARD_SLOTS;
+  while (capacity < 2 * per_shard) capacity *= 2;
+
+  for (Shard& shard : shards) {
+    // Automatically unlocks when destroyed.
+    std::scoped_lock lock {shard.insert_lock};
+    Table* table = shard.table.load(std::memory_order_relaxed);
+    if (table == nullptr || table->mask + 1 < capacity) grow(shard, capacity);
+  }
+}
+
+/**
+ * @brief Number of accounts in the index.
+ *
+ * @return size_t account count
+ */
+size_t AccountIndex::size() const {
+  size_t n = 0;
+  for_each([&n](int, Account&) { n++; });
+  return n;
+}
+
+/**
+ * @brief Every account ordered by id, for printing.
+ *
+ * @return std::vector<std::pair<int, Account*>> (id, account) pairs
+ */
+std::vector<std::pair<int, Account*>> AccountIndex::sorted() const {
+  std::vector<std::pair<int, Account*>> result;
+  for_each([&result](int acc_id, Account& acc) { result.emplace_back(acc_id, &acc); });
+  std::sort(result.begin(), result.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+  return result;
+}
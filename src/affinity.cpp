@@ -0,0 +1,132 @@
+#include <affinity.h>
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+
+/**
+ * @brief Parses a Linux CPU list such as "0-3,8,10-11".
+ *
+ * @param list CPU list
+ * @return std::vector<int> the CPUs, in list order
+ */
+std::vector<int> parse_cpu_list(const std::string& list) {
+  std::vector<int> cpus;
+  const char* p = list.c_str();
+  while (*p != '\0') {
+    char* end;
+    long first = strtol(p, &end, 10);
+    if (end == p) break;
+    long last = first;
+    p = end;
+    if (*p == '-') {
+      last = strtol(p + 1, &end, 10);
+      p = end;
+    }
+    for (long cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+    if (*p == ',') p++;
+  }
+  return cpus;
+}
+
+/**
+ * @brief Finds the CPUs the process may run on and the NUMA node of each.
+ *
+ * @return CpuTopology allowed CPUs by node
+ */
+CpuTopology CpuTopology::detect() {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) CPU_SET(cpu, &allowed);
+  }
+
+  CpuTopology topology;
+  std::vector<int> seen;
+  if (DIR* dir = opendir("/sys/devices/system/node")) {
+    std::vector<int> node_ids;
+    while (dirent* entry = readdir(dir)) {
+      int id;
+      if (sscanf(entry->d_name, "node%d", &id) == 1) node_ids.push_back(id);
+    }
+    closedir(dir);
+    std::sort(node_ids.begin(), node_ids.end());
+
+    for (int id : node_ids) {
+      std::ifstream file {"/sys/devices/system/node/node" + std::to_string(id) + "/cpulist"};
+      std::string list;
+      std::getline(file, list);
+      std::vector<int> cpus;
+      for (int cpu : parse_cpu_list(list)) {
+        if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+      }
+      seen.insert(seen.end(), cpus.begin(), cpus.end());
+      if (!cpus.empty()) topology.nodes.push_back(cpus);
+    }
+  }
+
+  // Allowed CPUs sysfs did not list (or no sysfs at all) form one more node
+  std::vector<int> rest;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &allowed) && std::find(seen.begin(), seen.end(), cpu) == seen.end()) rest.push_back(cpu);
+  }
+  if (!rest.empty()) topology.nodes.push_back(rest);
+  return topology;
+}
+
+/**
+ * @brief Number of allowed CPUs.
+ */
+int CpuTopology::cpus() const {
+  int count = 0;
+  for (const auto& node : nodes) count += node.size();
+  return count;
+}
+
+/**
+ * @brief Picks a CPU for each of `count` threads. Threads are split into
+ *        contiguous groups, one per node and sized by the node's CPU count,
+ *        so neighbouring thread indices share a node; within a node they
+ *        take its CPUs in turn.
+ *
+ * @param topology allowed CPUs by node
+ * @param count number of threads
+ * @return std::vector<int> CPU of thread i (empty if no CPU is known)
+ */
+std::vector<int> place_threads(const CpuTopology& topology, int count) {
+  std::vector<int> placement;
+  int total = topology.cpus();
+  if (total == 0) return placement;
+
+  int before = 0;  // CPUs on the nodes already filled
+  for (const auto& node : topology.nodes) {
+    int first = (long)count * before / total;
+    before += node.size();
+    int last = (long)count * before / total;
+    for (int i = first; i < last; ++i) placement.push_back(node[(i - first) % node.size()]);
+  }
+  return placement;
+}
+
+/**
+ * @brief Pins the calling thread to one CPU.
+ *
+ * @param cpu CPU to run on
+ * @return true on success (a failure is printed)
+ */
+bool pin_thread(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (err != 0) {
+    fprintf(stderr, "pin to CPU %d: %s\n", cpu, strerror(err));
+    return false;
+  }
+  return true;
+}
@@ -1,54 +1,317 @@
 #include <bank.h>
 
+#include <algorithm>
+
 /**
- * @brief prints account information
+ * @brief prints account information after flushing the operation log. The
+ *        balances come from one consistent snapshot, so they add up even
+ *        while workers are running.
  */
 void Bank::print_accounts() {
-  for (auto& [id, acc] : accounts) {
-    {
-      // Automatically unlocks when destroyed.
-      std::scoped_lock lock {acc.read_lock};
-      if (++acc.readers == 1) acc.write_lock.lock();
-    }
-    
-    if (acc.open) std::cout << "ID# " << id << " | " << acc.balance << "\n";
+  // Operations logged so far come before the account listing.
+  logger.flush();
 
-    {
-      // Automatically unlocks when destroyed.
-      std::scoped_lock lock {acc.read_lock};
-      if (--acc.readers == 0) acc.write_lock.unlock();
-    }
+  for (auto& [id, balance] : snapshot().balances) {
+    std::cout << "ID# " << id << " | " << balance << "\n";
+  }
+
+  BankStats totals = stats();
+  std::cout << "Success: " << totals.successes() << " Fails: " << totals.failures() << "\n";
+}
+
+/**
+ * @brief Enters the bank's current epoch. If a snapshot is collecting its
+ *        grace period, waits until every operation from older epochs has
+ *        finished, so no older operation can change an account after this one
+ *        has saved its pre-image.
+ *
+ * @param bank bank the operation runs on
+ */
+Bank::EpochGuard::EpochGuard(Bank& bank) : slot(bank.epochs.local()) {
+  epoch = bank.epoch.load();
+  for (;;) {
+    slot.active.store(epoch);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t now = bank.epoch.load();
+    if (now == epoch) break;
+    epoch = now;
+  }
+
+  cow = bank.snapshotting.load();
+  if (cow) {
+    int spins = 0;
+    while (bank.grace_epoch.load(std::memory_order_acquire) < epoch) spin_wait(spins);
+  }
+}
+
+/**
+ * @brief Adds `amount` to the calling thread's money in transit (see
+ *        EpochSlot), saving the pre-image first while a snapshot needs it.
+ *
+ * @param amount amount debited (positive) or credited back (negative)
+ */
+void Bank::EpochGuard::move_transit(long amount) {
+  if (cow && slot.snap_epoch.load(std::memory_order_relaxed) < epoch) {
+    slot.snap_transit.store(slot.transit.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    slot.snap_epoch.store(epoch, std::memory_order_release);
   }
+  slot.transit.fetch_add(amount, std::memory_order_acq_rel);
+}
 
+/**
+ * @brief Captures the state word of every account, open or closed, as of one
+ *        consistent point, without stopping the workers.
+ *
+ * The snapshot bumps the epoch, then waits out a grace period in which every
+ * operation that started in an older epoch finishes. Operations in the new
+ * epoch copy an account's state into its pre-image (`Account::preserve`)
+ * under `write_lock` before their first change to it, so the snapshot reads
+ * the pre-image where one exists and the live state everywhere else. The
+ * result is the bank exactly as it stood between the two epochs, with every
+ * transfer either fully in or fully out. Workers only ever wait for the
+ * grace period, which lasts as long as the operations already in flight.
+ *
+ * A partitioned bank's transfers between partitions are two operations, so
+ * their money can be in neither account at the cut. Each half moves it in
+ * or out of its thread's EpochSlot::transit within the same epoch, and the
+ * slots are read the same way as the accounts, so the money in transit as
+ * of the cut makes the capture add up.
+ *
+ * @param e set to the epoch the capture was taken at
+ * @param transit set to the money in transit between partitions at the cut
+ * @return std::vector<std::pair<int, long>> account ids and state words, sorted by id
+ */
+std::vector<std::pair<int, long>> Bank::capture(uint64_t& e, long& transit) {
   // Automatically unlocks when destroyed.
-  std::scoped_lock lock {bank_lock};
-  std::cout << "Success: " << num_succ << " Fails: " << num_fail << "\n";
+  std::scoped_lock lock {snapshot_lock};
+  snapshotting.store(true);
+  e = epoch.fetch_add(1) + 1;
+
+  epochs.for_each([e](EpochSlot& slot) {
+    int spins = 0;
+    for (uint64_t active = slot.active.load(); active != 0 && active < e; active = slot.active.load()) {
+      spin_wait(spins);
+    }
+  });
+  grace_epoch.store(e, std::memory_order_release);
+
+  std::vector<std::pair<int, long>> states;
+  accounts.for_each([&](int id, Account& acc) {
+    // A writer publishes its pre-image before changing `state`, so if the
+    // state we read already has new-epoch changes, the pre-image is visible.
+    long state = acc.read_settled();
+    if (acc.snap_epoch.load(std::memory_order_acquire) == e) state = acc.snap_state.load(std::memory_order_relaxed);
+    states.emplace_back(id, state);
+  });
+  transit = 0;
+  epochs.for_each([&](EpochSlot& slot) {
+    long amount = slot.transit.load(std::memory_order_acquire);
+    if (slot.snap_epoch.load(std::memory_order_acquire) == e) amount = slot.snap_transit.load(std::memory_order_relaxed);
+    transit += amount;
+  });
+  snapshotting.store(false);
+
+  std::sort(states.begin(), states.end());
+  if (base.count == 0) return states;
+
+  // Checkpoint accounts that were never used are still in their base state;
+  // merge them with the accounts seen above, both sorted by id.
+  std::vector<std::pair<int, long>> merged;
+  merged.reserve(states.size() + base.count);
+  size_t j = 0;
+  for (uint64_t i = 0; i < base.count; ++i) {
+    int id = base.ids[i];
+    while (j < states.size() && states[j].first < id) merged.push_back(states[j++]);
+    if (j < states.size() && states[j].first == id) merged.push_back(states[j++]);
+    else merged.emplace_back(id, base.balances[i] * Account::UNIT | (base.is_open(i) ? Account::OPEN : 0));
+  }
+  merged.insert(merged.end(), states.begin() + j, states.end());
+  return merged;
+}
+
+/**
+ * @brief Looks up an account. An account that so far only exists in the
+ *        checkpoint the bank was restored from is added to `accounts` with
+ *        its checkpointed balance and open flag first.
+ *
+ * @param acc_id the account ID to look up
+ * @return Account* the account, or nullptr if it does not exist
+ */
+Account* Bank::find(int acc_id) {
+  if (Account* acc = accounts.find(acc_id)) return acc;
+  if (base.count == 0) return nullptr;
+
+  const int32_t* it = std::lower_bound(base.ids, base.ids + base.count, acc_id);
+  if (it == base.ids + base.count || *it != acc_id) return nullptr;
+  uint64_t i = it - base.ids;
+  return accounts.insert(acc_id, base.balances[i] * Account::UNIT | (base.is_open(i) ? Account::OPEN : 0)).first;
+}
+
+/**
+ * @brief Takes an account's write_lock, unless every account has a single
+ *        writer (see `single_writer`), in which case nobody else can change it.
+ *
+ * @param acc account to lock
+ * @return std::unique_lock<Account> owning the lock, or empty
+ */
+std::unique_lock<Account> Bank::lock_account(Account& acc) {
+  if (single_writer) return std::unique_lock<Account> {};
+  return std::unique_lock<Account> {acc};
+}
+
+/**
+ * @brief Takes a globally consistent snapshot of every open account's balance
+ *        without stopping the workers; see capture().
+ *
+ * @return BankSnapshot balances of all open accounts, sorted by id
+ */
+BankSnapshot Bank::snapshot() {
+  BankSnapshot snap {0, {}};
+  for (auto& [id, state] : capture(snap.epoch, snap.in_transit)) {
+    if (Account::open_of(state)) snap.balances.emplace_back(id, Account::balance_of(state));
+  }
+  return snap;
 }
 
 /**
- * @brief helper function to increment the bank variable `num_fail` and log 
- *        message.
+ * @brief Writes every account (closed ones included) to a checkpoint file as
+ *        of one consistent point. Workers may keep running meanwhile. The
+ *        checkpoint also records which write-ahead log it was saved with and
+ *        how many of its records it already includes, so a restore with
+ *        that log does not replay them again; that count is
+ *        only exact when no operation is running, which is how InitBank and
+ *        ServeBank save. Without a log, the count of the checkpoint the bank
+ *        was restored from carries over.
+ *
+ * @param path checkpoint file
+ * @return true on success, false on error (an error is printed)
+ */
+bool Bank::checkpoint(const std::string& path) {
+  uint64_t e;
+  long transit;
+  std::vector<std::pair<int, long>> states = capture(e, transit);
+  // Money in the mail belongs to no account yet; InitBank only saves once the workers are done.
+  if (transit != 0) std::cerr << path << ": $" << transit << " in transit between partitions is not saved\n";
+  if (wal != nullptr) return write_checkpoint(path, states, wal->records(), wal->id());
+  return write_checkpoint(path, states, base.wal_records, base.wal_id);
+}
+
+/**
+ * @brief Restores the bank from a checkpoint. The file is mapped and only
+ *        its checksum is verified up front; each account is copied out of
+ *        the mapping the first time an operation uses it (see find()), so
+ *        restoring takes one pass over the file regardless of how many
+ *        accounts are later touched. Accounts already in the bank take
+ *        precedence over the checkpoint. Must run before any worker starts.
+ *
+ * @param path checkpoint file
+ * @return true on success, false if the file is missing or not a valid checkpoint
+ */
+bool Bank::restore(const std::string& path) {
+  auto file = std::make_unique<MappedFile>(path);
+  if (!file->valid()) return false;
+  CheckpointView view;
+  if (!checkpoint_view(*file, view)) {
+    std::cerr << path << ": not a valid checkpoint\n";
+    return false;
+  }
+
+  base_file = std::move(file);
+  base = view;
+  return true;
+}
+
+/**
+ * @brief Sum of all balances in a snapshot, plus the money in transit
+ *        between partitions.
+ *
+ * @return long total money in the bank
+ */
+long BankSnapshot::total() const {
+  long sum = in_transit;
+  for (auto& [id, balance] : balances) sum += balance;
+  return sum;
+}
+
+/**
+ * @brief Aggregates every thread's operation counters. Workers keep counting
+ *        while this runs, so the result is a recent, not an atomic, total.
+ *
+ * @return BankStats counts by op type and failure reason
+ */
+BankStats Bank::stats() {
+  BankStats totals;
+  counters.for_each([&totals](OpCounters& c) { c.add_to(totals); });
+  return totals;
+}
+
+/**
+ * @brief helper function to count a failed operation in this thread's
+ *        counters and queue the result for the logger. The failure goes to
+ *        the write-ahead log too, so a rerun does not retry the entry
+ *        against a bank where it might now succeed.
  * 
- * @param message message to be logged
+ * @param result operation result to be logged
+ * @param reason why the operation failed
  */
-void Bank::recordFail(std::string message) {
-  // Automatically unlocks when destroyed.
-  std::scoped_lock lock {bank_lock};
-  std::cout << message << "\n";
-  num_fail++;
+void Bank::recordFail(const LogRecord& result, FailReason reason) {
+  OpCounters& c = counters.local();
+  OpCounters::bump(c.fail[result.op]);
+  OpCounters::bump(c.reasons[reason]);
+  if (wal != nullptr && result.op != OP_BALANCE) wal->append(result);
+  logger.record(result);
 }
 
 /**
- * @brief helper function to increment the bank variable `num_succ` and log 
- *        message.
+ * @brief helper function to count a successful operation in this thread's
+ *        counters and queue the result for the logger.
  * 
- * @param message message to be logged
+ * @param result operation result to be logged
  */
-void Bank::recordSucc(std::string message) {
-  // Automatically unlocks when destroyed.
-  std::scoped_lock lock {bank_lock};
-  std::cout << message << "\n";
-  num_succ++;
+void Bank::recordSucc(const LogRecord& result) {
+  OpCounters::bump(counters.local().succ[result.op]);
+  if (wal != nullptr && result.op != OP_BALANCE) wal->append(result);
+  logger.record(result);
+}
+
+/**
+ * @brief Re-applies one operation from the write-ahead log. Amounts are
+ *        applied without funds checks: records of concurrent operations may
+ *        be logged in a different order than they ran, but their effects
+ *        add up to the same balances. Opens and closes are logged under the
+ *        account's write_lock, so they keep their order. Must run before any
+ *        worker starts.
+ *
+ * @param rec logged operation
+ * @param apply false for a record the restored checkpoint already includes;
+ *              only its ledger id is marked as recovered, as for a failure
+ */
+void Bank::replay(const WalRecord& rec, bool apply) {
+  if (apply && !(rec.op & WAL_FAILED)) replay_change(rec);
+  if (rec.ledger_id < 0) return;
+  if ((size_t)rec.ledger_id >= recovered.size()) recovered.resize(rec.ledger_id + 1);
+  recovered[rec.ledger_id] = true;
+}
+
+/**
+ * @brief Applies the balance or open/close change of one logged operation.
+ *
+ * @param rec logged operation
+ */
+void Bank::replay_change(const WalRecord& rec) {
+  Account* found = find(rec.acc_id);
+  Account& acc = found != nullptr ? *found : accounts[rec.acc_id];
+  switch (rec.op) {
+    case OP_DEPOSIT:  acc.adjust(rec.amount);  break;
+    case OP_WITHDRAW: acc.adjust(-rec.amount); break;
+    case OP_TRANSFER:
+      acc.adjust(-rec.amount);
+      if (Account* dest = find(rec.dest_id)) dest->adjust(rec.amount);
+      else accounts[rec.dest_id].adjust(rec.amount);
+      break;
+    case OP_OPEN:     acc.open();  break;
+    case OP_CLOSE:    acc.close(); break;
+  }
 }
 
 /**
@@ -59,15 +322,20 @@ void Bank::recordSucc(std::string message) {
  * @param N initial accounts
  */
 Bank::Bank(int N) {
+  accounts.reserve(N);
   for (int i = 0; i < N; ++i) {
     Account& acc = accounts[i];
-    acc.open = true;
+    acc.open();
   }
 }
 
 /**
  * @brief Deposits money into an account.
  * 
+ * The balance is updated with a single CAS and no lock, unless a transfer is
+ * in progress on the account. A hot account takes the deposit on the
+ * caller's delta stripe instead (see Account).
+ * 
  * If the account exists and is open, 
  * [amount] is added to the balance of the account and the following message is logged:
  *  - 'Worker [worker_id] completed ledger [ledger_id]: deposit $[amount] into account [acc_id].'
@@ -82,23 +350,31 @@ Bank::Bank(int N) {
  * @return int 0 on success, -1 on failure
  */
 int Bank::deposit(int worker_id, int ledger_id, int acc_id, int amount) {
-  char buffer[100];
-  if (accounts.find(acc_id) != accounts.end()) {
-    Account& acc = accounts[acc_id];
-
-    // Automatically unlocks when destroyed.
-    std::scoped_lock acc_lock {acc.write_lock};
-    if (acc.open) {
-      acc.balance += amount;
-      sprintf(buffer, "Worker %d completed ledger %d: deposit $%d into account %d", worker_id, ledger_id, amount, acc_id);
-      recordSucc(buffer);
+  EpochGuard guard {*this};
+  FailReason reason = FAIL_MISSING;
+  if (Account* found = find(acc_id)) {
+    Account& acc = *found;
+
+    // Lock-free unless a transfer has the account frozen or a snapshot needs
+    // its pre-image, in which case go through write_lock.
+    AccountResult result = guard.cow ? ACC_FROZEN : acc.deposit(amount);
+    if (result == ACC_FROZEN) {
+      TRACE_START(lock_start);
+      // Automatically unlocks when destroyed.
+      std::unique_lock<Account> acc_lock = lock_account(acc);
+      TRACE_RECORD(TRACE_LOCK, OP_DEPOSIT, lock_start);
+      guard.preserve(acc);
+      result = acc.deposit(amount);
+    }
+    if (result == ACC_OK) {
+      recordSucc({worker_id, ledger_id, acc_id, 0, amount, OP_DEPOSIT, true});
 
       return 0;
     }
+    reason = FAIL_CLOSED;
   }
 
-  sprintf(buffer, "Worker %d failed to complete ledger %d: deposit $%d into account %d", worker_id, ledger_id, amount, acc_id);
-  recordFail(buffer);
+  recordFail({worker_id, ledger_id, acc_id, 0, amount, OP_DEPOSIT, false}, reason);
 
   return -1;
 }
@@ -106,6 +382,10 @@ int Bank::deposit(int worker_id, int ledger_id, int acc_id, int amount) {
 /**
  * @brief Withdraws money from an account.
  * 
+ * The funds check and the update happen in a single CAS and no lock, unless
+ * a transfer is in progress on the account, or the account is hot and its
+ * word is short until its delta stripes are folded in.
+ * 
  * If the account exists and is open and has at least [amount] as a balance, 
  * [amount] is removed to the balance of the account and the following message is logged:
  *  - 'Worker [worker_id] completed ledger [ledger_id]: deposit $[amount] into account [acc_id].'
@@ -120,30 +400,274 @@ int Bank::deposit(int worker_id, int ledger_id, int acc_id, int amount) {
  * @return int 0 on success -1 on failure
  */
 int Bank::withdraw(int worker_id, int ledger_id, int acc_id, int amount) {
-  char buffer[100];
-  if (accounts.find(acc_id) != accounts.end()) {
-    Account& acc = accounts[acc_id];
-
-    // Automatically unlocks when destroyed.
-    std::scoped_lock acc_lock {acc.write_lock};
-    if (acc.open && amount <= acc.balance) {
-      acc.balance -= amount;
-      sprintf(buffer, "Worker %d completed ledger %d: withdraw $%d from account %d", worker_id, ledger_id, amount, acc_id);
-      recordSucc(buffer);
+  EpochGuard guard {*this};
+  FailReason reason = FAIL_MISSING;
+  if (Account* found = find(acc_id)) {
+    Account& acc = *found;
+
+    // Lock-free unless a transfer has the account frozen or a snapshot needs
+    // its pre-image, in which case go through write_lock.
+    AccountResult result = guard.cow ? ACC_FROZEN : acc.withdraw(amount);
+    if (result == ACC_FROZEN || result == ACC_SHORT) {
+      TRACE_START(lock_start);
+      // Automatically unlocks when destroyed.
+      std::unique_lock<Account> acc_lock = lock_account(acc);
+      TRACE_RECORD(TRACE_LOCK, OP_WITHDRAW, lock_start);
+      guard.preserve(acc);
+      // A hot account's word may be short only because deposits are still on its stripes.
+      acc.fold();
+      result = acc.withdraw(amount);
+      if (result == ACC_SHORT) result = ACC_FUNDS;
+    }
+    if (result == ACC_OK) {
+      recordSucc({worker_id, ledger_id, acc_id, 0, amount, OP_WITHDRAW, true});
 
       return 0;
     }
+    reason = result == ACC_FUNDS ? FAIL_FUNDS : FAIL_CLOSED;
+  }
+
+  recordFail({worker_id, ledger_id, acc_id, 0, amount, OP_WITHDRAW, false}, reason);
+
+  return -1;
+}
+
+/**
+ * @brief First half of a transfer whose destination belongs to another
+ *        worker's partition; only for `single_writer` banks. Checks both
+ *        accounts like transfer() and takes the amount out of the source.
+ *        Accounts are never reopened once closed, so a destination that is
+ *        closed now can be failed right away. Nothing is logged until the
+ *        destination's worker calls credit().
+ *
+ * @param worker_id the ID of the worker (thread)
+ * @param ledger_id the ID of the ledger entry
+ * @param src_id the account to transfer money out
+ * @param dest_id the account to receive the money
+ * @param amount the amount to transfer
+ * @return int 1 if the amount was taken and must be credited, -1 on failure (logged)
+ */
+int Bank::debit(int worker_id, int ledger_id, int src_id, int dest_id, unsigned int amount) {
+  EpochGuard guard {*this};
+  FailReason reason = src_id == dest_id ? FAIL_SAME_ACCOUNT : FAIL_MISSING;
+  Account* src  = src_id != dest_id ? find(src_id)  : nullptr;
+  Account* dest = src_id != dest_id ? find(dest_id) : nullptr;
+  if (src != nullptr && dest != nullptr) {
+    long src_state = src->read();
+    bool open = Account::open_of(src_state) && dest->is_open();
+    if (open && amount <= Account::balance_of(src_state)) {
+      guard.preserve(*src);
+      src->adjust(-(long)amount);
+      guard.move_transit(amount);
+      return 1;
+    }
+    reason = open ? FAIL_FUNDS : FAIL_CLOSED;
+  }
+
+  recordFail({worker_id, ledger_id, src_id, dest_id, (int)amount, OP_TRANSFER, false}, reason);
+
+  return -1;
+}
+
+/**
+ * @brief Second half of a transfer started by debit(), run by the worker
+ *        that owns the destination. Credits the destination and logs the
+ *        transfer, or fails it if the destination was closed in between; the
+ *        caller then has the amount refund()ed to the source.
+ *
+ * @return int 0 on success, -1 on failure
+ */
+int Bank::credit(int worker_id, int ledger_id, int src_id, int dest_id, unsigned int amount) {
+  EpochGuard guard {*this};
+  // debit() found the account, and accounts are never removed.
+  Account& dest = *find(dest_id);
+  if (dest.is_open()) {
+    guard.preserve(dest);
+    dest.adjust(amount);
+    guard.move_transit(-(long)amount);
+    recordSucc({worker_id, ledger_id, src_id, dest_id, (int)amount, OP_TRANSFER, true});
+
+    return 0;
+  }
+
+  recordFail({worker_id, ledger_id, src_id, dest_id, (int)amount, OP_TRANSFER, false}, FAIL_CLOSED);
+
+  return -1;
+}
+
+/**
+ * @brief Gives the amount of a failed credit() back to the source, run by
+ *        the worker that owns it. The source gets it even if it has been
+ *        closed since.
+ */
+void Bank::refund(int src_id, unsigned int amount) {
+  EpochGuard guard {*this};
+  Account& src = *find(src_id);
+  guard.preserve(src);
+  src.adjust(amount);
+  guard.move_transit(-(long)amount);
+}
+
+/**
+ * @brief Applies a run of deposits, withdrawals and balance checks on one
+ *        account, in order, as a single change of the account's balance.
+ *
+ * Every op is still checked and logged on its own, against the balance the
+ * ops before it leave. A withdrawal fails for insufficient funds exactly
+ * when it would if the ops were called one by one with nothing in between.
+ * Ops restored from the write-ahead log are skipped.
+ *
+ * A run of deposits alone is one deposit of their sum. Any other run goes
+ * in with a single CAS of the net change, unless a transfer has the account
+ * frozen, a snapshot needs its pre-image or the account is hot. In those
+ * cases it goes through write_lock, and a hot account's stripes are folded
+ * in first so that withdrawals and checks see the full balance.
+ *
+ * @param worker_id the ID of the worker (thread)
+ * @param acc_id the account every op of the run is on
+ * @param run ops in ledger order
+ * @return int 0 if every op succeeded, -1 otherwise
+ */
+int Bank::apply_run(int worker_id, int acc_id, const std::vector<RunOp>& run) {
+  EpochGuard guard {*this};
+  int failures = 0;
+
+  // Plays the run against `balance` and returns the balance it leaves. With
+  // `log` set, every outcome is also recorded.
+  auto play = [&](long balance, bool log) {
+    for (const RunOp& op : run) {
+      if (replayed(op.ledger_id)) continue;
+      bool ok = op.op != OP_WITHDRAW || op.amount <= balance;
+      if (ok && op.op == OP_DEPOSIT)  balance += op.amount;
+      if (ok && op.op == OP_WITHDRAW) balance -= op.amount;
+      if (!log) continue;
+
+      long amount = op.op == OP_BALANCE ? balance : op.amount;
+      if (ok) recordSucc({worker_id, op.ledger_id, acc_id, 0, amount, op.op, true});
+      else    recordFail({worker_id, op.ledger_id, acc_id, 0, amount, op.op, false}, FAIL_FUNDS);
+      failures += !ok;
+    }
+    return balance;
+  };
+
+  FailReason reason = FAIL_MISSING;
+  if (Account* found = find(acc_id)) {
+    Account& acc = *found;
+    bool deposits_only = true;
+    long total = 0;
+    for (const RunOp& op : run) {
+      if (replayed(op.ledger_id)) continue;
+      deposits_only &= op.op == OP_DEPOSIT;
+      total += op.amount;
+    }
+
+    long before = 0;
+    auto next = [&](long balance) { return play(balance, false); };
+    // A hot account's word alone may be short, so withdrawals and checks on it always fold.
+    AccountResult result = ACC_FROZEN;
+    if (!guard.cow) result = deposits_only ? acc.deposit(total) : acc.is_hot() ? ACC_SHORT : acc.update(next, before);
+    if (result == ACC_FROZEN || result == ACC_SHORT) {
+      TRACE_START(lock_start);
+      // Automatically unlocks when destroyed.
+      std::unique_lock<Account> acc_lock = lock_account(acc);
+      TRACE_RECORD(TRACE_LOCK, deposits_only ? OP_DEPOSIT : OP_WITHDRAW, lock_start);
+      guard.preserve(acc);
+      acc.fold();
+      result = deposits_only ? acc.deposit(total) : acc.update(next, before);
+    }
+    if (result == ACC_OK) {
+      play(before, true);
+
+      return -(failures > 0);
+    }
+    reason = FAIL_CLOSED;
   }
 
-  sprintf(buffer, "Worker %d failed to complete ledger %d: withdraw $%d from account %d", worker_id, ledger_id, amount, acc_id);
-  recordFail(buffer);
+  for (const RunOp& op : run) {
+    if (replayed(op.ledger_id)) continue;
+    recordFail({worker_id, op.ledger_id, acc_id, 0, op.op == OP_BALANCE ? 0 : op.amount, op.op, false}, reason);
+  }
 
   return -1;
 }
 
+/**
+ * @brief Optimistic check for transfer(): reads both accounts without any
+ *        lock and tells whether the transfer is bound to fail. The source is
+ *        read again after the destination, and the state word is its own
+ *        version stamp, so an unchanged source means both reads held at the
+ *        same time. A source that moved in between is read again, up to
+ *        OCC_RETRIES times.
+ *
+ * @param src account to take the money from
+ * @param dest account to receive it
+ * @param amount amount to move
+ * @param reason set to why the transfer fails, if it does
+ * @return true if the transfer fails as of the reads, false if it may succeed
+ *         (or the source kept changing)
+ */
+static bool transfer_fails(const Account& src, const Account& dest, unsigned int amount, FailReason& reason) {
+  for (int attempt = 0; attempt < OCC_RETRIES; ++attempt) {
+    long src_state = src.read_settled();
+    long dest_state = dest.read();
+    if (src.read_settled() != src_state) continue;
+
+    bool open = Account::open_of(src_state) && Account::open_of(dest_state);
+    if (open && amount <= Account::balance_of(src_state)) return false;
+    reason = open ? FAIL_FUNDS : FAIL_CLOSED;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Locks the accounts of a transfer that passed transfer_fails().
+ *        Instead of waiting on a busy lock (and holding the other one while
+ *        it waits), the transfer lets go, checks optimistically again and
+ *        gives up without locks as soon as it sees that it would fail. After
+ *        OCC_RETRIES busy rounds it takes the locks in id order and waits.
+ *
+ * @param first account to lock first (the lower id)
+ * @param second account to lock second, or nullptr
+ * @param src source of the transfer
+ * @param dest destination of the transfer
+ * @param amount amount to move
+ * @param reason set to why the transfer fails, if it gives up
+ * @return true with the locks held, false with none held if the transfer fails
+ */
+static bool lock_transfer(Account& first, Account* second, const Account& src, const Account& dest, unsigned int amount,
+                          FailReason& reason) {
+  int spins = 0;
+  for (int attempt = 0; attempt < OCC_RETRIES; ++attempt) {
+    if (first.write_lock.try_lock()) {
+      if (second == nullptr || second->write_lock.try_lock()) return true;
+      first.write_lock.unlock();
+      second->contended();
+    } else {
+      first.contended();
+    }
+    if (transfer_fails(src, dest, amount, reason)) return false;
+    spin_wait(spins);
+  }
+
+  first.lock();
+  if (second != nullptr) second->lock();
+  return true;
+}
+
 /**
  * @brief Transfer money from one account to another.
  * 
+ * Both accounts are locked in id order and frozen, so concurrent lock-free
+ * deposits and withdrawals wait until the debit and credit are both applied.
+ * If the destination is hot, only the source is locked and frozen, and the
+ * credit goes on one of the destination's delta stripes.
+ *
+ * Locks are only taken for transfers that can succeed: both accounts are
+ * first read optimistically, and a transfer that the reads show to fail
+ * (closed account, insufficient funds) fails right there. Busy locks are not
+ * waited on at first either; see lock_transfer().
+ * 
  * If both accounts exist and are open and source has at least [amount] as a balance, 
  * [amount] is removed to the balance of the source and added to the balance of destination, 
  * and the following message is logged:
@@ -160,26 +684,69 @@ int Bank::withdraw(int worker_id, int ledger_id, int acc_id, int amount) {
  * @return int 0 on success, -1 on error
  */
 int Bank::transfer(int worker_id, int ledger_id, int src_id, int dest_id, unsigned int amount) {
-  char buffer[100];
-  if (src_id != dest_id && accounts.find(src_id) != accounts.end() && accounts.find(dest_id) != accounts.end()) {
-    Account& src_acc = accounts[src_id];
-    Account& dest_acc = accounts[dest_id];
-
-    // Ensure strict ordering of locks by locking lowest id first; automatically unlocks when destroyed.
-    std::scoped_lock acc1_lock {src_id < dest_id ? src_acc.write_lock  : dest_acc.write_lock};
-    std::scoped_lock acc2_lock {src_id < dest_id ? dest_acc.write_lock : src_acc.write_lock};
-    if (src_acc.open && dest_acc.open && amount <= src_acc.balance) {
-      src_acc.balance -= amount;
-      dest_acc.balance += amount;
-      sprintf(buffer, "Worker %d completed ledger %d: transfer $%d from account %d to account %d", worker_id, ledger_id, amount, src_id, dest_id);
-      recordSucc(buffer);
+  EpochGuard guard {*this};
+  FailReason reason = src_id == dest_id ? FAIL_SAME_ACCOUNT : FAIL_MISSING;
+  Account* src_found  = src_id != dest_id ? find(src_id)  : nullptr;
+  Account* dest_found = src_id != dest_id ? find(dest_id) : nullptr;
+  if (src_found != nullptr && dest_found != nullptr) {
+    Account& src_acc = *src_found;
+    Account& dest_acc = *dest_found;
+
+    // A hot destination takes the credit on a stripe, so only the source is locked.
+    bool hot_dest = dest_acc.is_hot() && !guard.cow;
+    Account& first  = hot_dest || src_id < dest_id ? src_acc : dest_acc;
+    Account* second = hot_dest ? nullptr : src_id < dest_id ? &dest_acc : &src_acc;
+
+    bool done = false;
+    TRACE_START(lock_start);
+    // The only writer of both accounts needs neither the optimistic check nor the locks.
+    if (single_writer || (!transfer_fails(src_acc, dest_acc, amount, reason) && lock_transfer(first, second, src_acc, dest_acc, amount, reason))) {
+      TRACE_RECORD(TRACE_LOCK, OP_TRANSFER, lock_start);
+      // Locked by lock_transfer(); automatically unlocks when destroyed.
+      std::unique_lock<Account> acc1_lock, acc2_lock;
+      if (!single_writer) acc1_lock = std::unique_lock<Account> {first, std::adopt_lock};
+      if (!single_writer && second != nullptr) acc2_lock = std::unique_lock<Account> {*second, std::adopt_lock};
+
+      if (hot_dest) {
+        // The source stays frozen until the credit is in.
+        long src_state = src_acc.freeze(amount);
+        bool open = Account::open_of(src_state);
+        if (open && amount <= Account::balance_of(src_state)) {
+          open = dest_acc.deposit(amount) == ACC_OK;
+          if (open) {
+            src_state -= amount * Account::UNIT;
+            done = true;
+          }
+        }
+        src_acc.thaw(src_state);
+        reason = open ? FAIL_FUNDS : FAIL_CLOSED;
+      } else {
+        // Freezing both words stops lock-free deposits/withdrawals from slipping in
+        // between the debit and the credit; they wait on write_lock instead.
+        guard.preserve(src_acc);
+        guard.preserve(dest_acc);
+        long src_state  = src_acc.freeze(amount);
+        long dest_state = dest_acc.freeze();
+        bool open = Account::open_of(src_state) && Account::open_of(dest_state);
+        if (open && amount <= Account::balance_of(src_state)) {
+          src_state  -= amount * Account::UNIT;
+          dest_state += amount * Account::UNIT;
+          done = true;
+        }
+        src_acc.thaw(src_state);
+        dest_acc.thaw(dest_state);
+        reason = open ? FAIL_FUNDS : FAIL_CLOSED;
+      }
+    }
+
+    if (done) {
+      recordSucc({worker_id, ledger_id, src_id, dest_id, (int)amount, OP_TRANSFER, true});
 
       return 0;
     }
   }
 
-  sprintf(buffer, "Worker %d failed to complete ledger %d: transfer $%d from account %d to account %d", worker_id, ledger_id, amount, src_id, dest_id);
-  recordFail(buffer);
+  recordFail({worker_id, ledger_id, src_id, dest_id, (int)amount, OP_TRANSFER, false}, reason);
 
   return -1;
 }
@@ -187,10 +754,13 @@ int Bank::transfer(int worker_id, int ledger_id, int src_id, int dest_id, unsign
 /**
  * @brief Checks money in an account.
  * 
+ * The balance is read with a seqlock-style load of the account's state word,
+ * so balance checks never take a lock or block deposits and transfers.
+ * 
  * If the account exists and is open, the following message is logged:
  *  - 'Worker [worker_id] completed ledger [ledger_id]: balance of $[acc.balance] in account [acc_id].'
  * 
- * Otherwise, an error is returned and the following message is logged:
+ * Otherwise (including when the account is closed), an error is returned and the following message is logged:
  *  - 'Worker [worker_id] failed to completed ledger [ledger_id]: balance of account [acc_id].'
  * 
  * @param worker_id the ID of the worker (thread)
@@ -199,31 +769,19 @@ int Bank::transfer(int worker_id, int ledger_id, int src_id, int dest_id, unsign
  * @return int 0 on success, -1 on error
  */
 int Bank::check_balance(int worker_id, int ledger_id, int acc_id) {
-  char buffer[100];
-  if (accounts.find(acc_id) != accounts.end()) {
-    Account& acc = accounts[acc_id];
-    {
-      // Automatically unlocks when destroyed.
-      std::scoped_lock lock {acc.read_lock};
-      if (++acc.readers == 1) acc.write_lock.lock();
-    }
-    
-    if (acc.open) {
-      sprintf(buffer, "Worker %d completed ledger %d: balance of $%ld in account %d.", worker_id, ledger_id, acc.balance, acc_id);
-      recordSucc(buffer);
-    }
+  if (Account* found = find(acc_id)) {
+    // Loads of the state word (and a hot account's stripes); never locks or writes the account.
+    long state = found->read_settled();
+    bool open = Account::open_of(state);
+    long balance = Account::balance_of(state);
 
-    {
-      // Automatically unlocks when destroyed.
-      std::scoped_lock lock {acc.read_lock};
-      if (--acc.readers == 0) acc.write_lock.unlock();
-    }
+    if (open) recordSucc({worker_id, ledger_id, acc_id, 0, balance, OP_BALANCE, true});
+    else      recordFail({worker_id, ledger_id, acc_id, 0, 0, OP_BALANCE, false}, FAIL_CLOSED);
 
-    return -!acc.open;
+    return -!open;
   }
 
-  sprintf(buffer, "Worker %d failed to complete ledger %d: balance of account %d.", worker_id, ledger_id, acc_id);
-  recordFail(buffer);
+  recordFail({worker_id, ledger_id, acc_id, 0, 0, OP_BALANCE, false}, FAIL_MISSING);
 
   return -1;
 }
@@ -244,22 +802,27 @@ int Bank::check_balance(int worker_id, int ledger_id, int acc_id) {
  * @return int 0 on success, -1 on error 
  */
 int Bank::open_account(int worker_id, int ledger_id, int acc_id) {
-  char buffer[100];
-  if (accounts.find(acc_id) == accounts.end()) {
-    Account& acc = accounts[acc_id];
-
+  EpochGuard guard {*this};
+  // Only the caller that creates the account may open it.
+  // An account that so far only exists in the checkpoint already exists.
+  if (base.count != 0) find(acc_id);
+  auto [found, inserted] = accounts.insert(acc_id);
+  if (inserted) {
+    Account& acc = *found;
+
+    TRACE_START(lock_start);
     // Automatically unlocks when destroyed.
-    std::scoped_lock acc_lock {acc.write_lock};
-    if (!acc.open) {
-      acc.open = true;
-      sprintf(buffer, "Worker %d completed ledger %d: open account %d.", worker_id, ledger_id, acc_id);
-      recordSucc(buffer);
+    std::unique_lock<Account> acc_lock = lock_account(acc);
+    TRACE_RECORD(TRACE_LOCK, OP_OPEN, lock_start);
+    if (!acc.is_open()) {
+      guard.preserve(acc);
+      acc.open();
+      recordSucc({worker_id, ledger_id, acc_id, 0, 0, OP_OPEN, true});
       return 0;
     }
   }
 
-  sprintf(buffer, "Worker %d failed to complete ledger %d: open account %d.", worker_id, ledger_id, acc_id);
-  recordFail(buffer);
+  recordFail({worker_id, ledger_id, acc_id, 0, 0, OP_OPEN, false}, FAIL_EXISTS);
 
   return -1;
 }
@@ -279,22 +842,25 @@ int Bank::open_account(int worker_id, int ledger_id, int acc_id) {
  * @return int 0 on success, -1 on error 
  */
 int Bank::close_account(int worker_id, int ledger_id, int acc_id) {
-  char buffer[100];
-  if (accounts.find(acc_id) != accounts.end()) {
-    Account& acc = accounts[acc_id];
+  EpochGuard guard {*this};
+  FailReason reason = FAIL_MISSING;
+  if (Account* found = find(acc_id)) {
+    Account& acc = *found;
 
+    TRACE_START(lock_start);
     // Automatically unlocks when destroyed.
-    std::scoped_lock acc_lock {acc.write_lock};
-    if (acc.open) {
-      acc.open = false;
-      sprintf(buffer, "Worker %d completed ledger %d: close account %d.", worker_id, ledger_id, acc_id);
-      recordSucc(buffer);
+    std::unique_lock<Account> acc_lock = lock_account(acc);
+    TRACE_RECORD(TRACE_LOCK, OP_CLOSE, lock_start);
+    if (acc.is_open()) {
+      guard.preserve(acc);
+      acc.close();
+      recordSucc({worker_id, ledger_id, acc_id, 0, 0, OP_CLOSE, true});
       return 0;
     }
+    reason = FAIL_CLOSED;
   }
 
-  sprintf(buffer, "Worker %d failed to complete ledger %d: close account %d.", worker_id, ledger_id, acc_id);
-  recordFail(buffer);
+  recordFail({worker_id, ledger_id, acc_id, 0, 0, OP_CLOSE, false}, reason);
 
   return -1;
 }
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include <account.h>
+#include <checkpoint.h>
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Byte offsets of the three arrays for a checkpoint of `count` accounts.
+static size_t ids_offset(uint64_t)            { return sizeof(CheckpointHeader); }
+static size_t balances_offset(uint64_t count) { return (ids_offset(count) + count * sizeof(int32_t) + 7) & ~(size_t)7; }
+static size_t open_offset(uint64_t count)     { return balances_offset(count) + count * sizeof(int64_t); }
+static size_t open_words(uint64_t count)      { return (count + 63) / 64; }
+
+/**
+ * @brief Size in bytes of a checkpoint of `count` accounts.
+ *
+ * @param count number of accounts
+ * @return size_t file size
+ */
+size_t checkpoint_size(uint64_t count) {
+  return open_offset(count) + open_words(count) * sizeof(uint64_t);
+}
+
+/**
+ * @brief FNV-style hash of the id, balance and open arrays of a checkpoint.
+ *
+ * @param view arrays to hash
+ * @return uint64_t checksum
+ */
+uint64_t checkpoint_checksum(const CheckpointView& view) {
+  uint64_t h = 0xCBF29CE484222325ull;
+  for (uint64_t i = 0; i < view.count; ++i) {
+    h = (h ^ (uint32_t)view.ids[i]) * 0x100000001B3ull;
+    h = (h ^ (uint64_t)view.balances[i]) * 0x100000001B3ull;
+  }
+  for (size_t w = 0; w < open_words(view.count); ++w) h = (h ^ view.open[w]) * 0x100000001B3ull;
+  return h;
+}
+
+/**
+ * @brief Checks that a mapped file is a checkpoint of a supported version
+ *        with the right size and checksum, and points `view` at its arrays.
+ *
+ * @param file mapped file
+ * @param view set to the checkpoint's arrays
+ * @return true if the file is a valid checkpoint
+ */
+bool checkpoint_view(const MappedFile& file, CheckpointView& view) {
+  if (file.size() < sizeof(CheckpointHeader)) return false;
+  const CheckpointHeader* header = reinterpret_cast<const CheckpointHeader*>(file.data());
+  if (header->magic != CHECKPOINT_MAGIC || header->version != CHECKPOINT_VERSION) return false;
+  // Bound the count first, so checkpoint_size() cannot wrap around
+  if (header->count > (file.size() - sizeof(CheckpointHeader)) / (sizeof(int32_t) + sizeof(int64_t))) return false;
+  if (file.size() != checkpoint_size(header->count)) return false;
+
+  view.count = header->count;
+  view.ids = reinterpret_cast<const int32_t*>(file.data() + ids_offset(view.count));
+  view.balances = reinterpret_cast<const int64_t*>(file.data() + balances_offset(view.count));
+  view.open = reinterpret_cast<const uint64_t*>(file.data() + open_offset(view.count));
+  view.wal_records = header->wal_records;
+  view.wal_id = header->wal_id;
+  return checkpoint_checksum(view) == header->checksum;
+}
+
+/**
+ * @brief Writes a checkpoint. The file is written next to `path`, synced and
+ *        then renamed over it, so a crash never leaves a partial checkpoint.
+ *
+ * @param path checkpoint file
+ * @param states account id and Account state word of every account, sorted by id
+ * @param wal_records number of write-ahead log records the states already include
+ * @param wal_id id of the log those records are in
+ * @return true on success, false on error (an error is printed)
+ */
+bool write_checkpoint(const std::string& path, const std::vector<std::pair<int, long>>& states,
+                      uint64_t wal_records, uint64_t wal_id) {
+  uint64_t count = states.size();
+  std::vector<char> data(checkpoint_size(count), 0);
+  CheckpointHeader* header = reinterpret_cast<CheckpointHeader*>(data.data());
+  int32_t* ids = reinterpret_cast<int32_t*>(data.data() + ids_offset(count));
+  int64_t* balances = reinterpret_cast<int64_t*>(data.data() + balances_offset(count));
+  uint64_t* open = reinterpret_cast<uint64_t*>(data.data() + open_offset(count));
+
+  for (uint64_t i = 0; i < count; ++i) {
+    ids[i] = states[i].first;
+    balances[i] = Account::balance_of(states[i].second);
+    if (Account::open_of(states[i].second)) open[i / 64] |= 1ull << (i % 64);
+  }
+  *header = {CHECKPOINT_MAGIC, CHECKPOINT_VERSION, count, checkpoint_checksum({count, ids, balances, open}), wal_records, wal_id};
+
+  std::string tmp = path + ".tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror(tmp.c_str());
+    return false;
+  }
+  const char* p = data.data();
+  size_t left = data.size();
+  while (left > 0) {
+    ssize_t n = write(fd, p, left);
+    if (n < 0) break;
+    p += n;
+    left -= n;
+  }
+  bool ok = left == 0 && fsync(fd) == 0;
+  if (close(fd) != 0) ok = false;
+  if (ok && rename(tmp.c_str(), path.c_str()) != 0) ok = false;
+  if (!ok) {
+    perror(path.c_str());
+    remove(tmp.c_str());
+  }
+  return ok;
+}
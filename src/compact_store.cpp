@@ -0,0 +1,166 @@
+#include <compact_store.h>
+
+#include <stdio.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+
+/**
+ * @brief Reserves room for accounts 0 ... capacity-1, all closed with no
+ *        money. Memory is only committed as accounts are used. On failure an
+ *        error is printed and the store is left invalid.
+ *
+ * @param capacity number of account ids
+ */
+CompactStore::CompactStore(size_t capacity) : count(capacity) {
+  size_t bytes = capacity * bytes_per_account();
+  if (bytes == 0) return;
+  void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED) {
+    perror("CompactStore");
+    count = 0;
+    return;
+  }
+  mapped = bytes;
+  // Zero pages are valid values of both atomics, so no constructors need to run.
+  states = static_cast<std::atomic<long>*>(p);
+  locks = reinterpret_cast<std::atomic<uint8_t>*>(states + capacity);
+}
+
+CompactStore::~CompactStore() {
+  if (states != nullptr) munmap(states, mapped);
+}
+
+/**
+ * @brief Spins on an account's one-byte lock.
+ */
+void CompactStore::lock(int id) {
+  int spins = 0;
+  for (;;) {
+    if (locks[id].load(std::memory_order_relaxed) == 0 &&
+        locks[id].exchange(1, std::memory_order_acquire) == 0) return;
+    spin_wait(spins);
+  }
+}
+
+/**
+ * @brief Reads a state word that is not in the middle of a transfer.
+ *
+ * @param id account id
+ * @return long the state word, or 0 (closed, no money) for ids out of range
+ */
+long CompactStore::read(int id) const {
+  if (!contains(id)) return 0;
+  int spins = 0;
+  long s = states[id].load(std::memory_order_acquire);
+  while (s & Account::FROZEN) {
+    spin_wait(spins);
+    s = states[id].load(std::memory_order_acquire);
+  }
+  return s;
+}
+
+/**
+ * @brief Adds `amount` to an open account with one CAS, or under its lock
+ *        while a transfer has it frozen.
+ *
+ * @return AccountResult ACC_OK or ACC_CLOSED (also for ids out of range)
+ */
+AccountResult CompactStore::deposit(int id, long amount) {
+  if (!contains(id)) return ACC_CLOSED;
+  long s = states[id].load(std::memory_order_relaxed);
+  for (;;) {
+    if (s & Account::FROZEN) {
+      // Freezers hold the lock, so the word is thawed once we have it.
+      lock(id);
+      s = states[id].load(std::memory_order_relaxed);
+      AccountResult result = Account::open_of(s) ? ACC_OK : ACC_CLOSED;
+      if (result == ACC_OK) states[id].fetch_add(amount * Account::UNIT, std::memory_order_acq_rel);
+      unlock(id);
+      return result;
+    }
+    if (!Account::open_of(s)) return ACC_CLOSED;
+    if (states[id].compare_exchange_weak(s, s + amount * Account::UNIT, std::memory_order_acq_rel,
+                                         std::memory_order_relaxed)) return ACC_OK;
+  }
+}
+
+/**
+ * @brief Removes `amount` from an open account holding at least `amount`,
+ *        with one CAS, or under its lock while a transfer has it frozen.
+ *
+ * @return AccountResult ACC_OK, ACC_CLOSED (also for ids out of range) or ACC_FUNDS
+ */
+AccountResult CompactStore::withdraw(int id, long amount) {
+  if (!contains(id)) return ACC_CLOSED;
+  long s = states[id].load(std::memory_order_relaxed);
+  for (;;) {
+    if (s & Account::FROZEN) {
+      lock(id);
+      s = states[id].load(std::memory_order_relaxed);
+      AccountResult result = !Account::open_of(s) ? ACC_CLOSED : amount > Account::balance_of(s) ? ACC_FUNDS : ACC_OK;
+      if (result == ACC_OK) states[id].fetch_sub(amount * Account::UNIT, std::memory_order_acq_rel);
+      unlock(id);
+      return result;
+    }
+    if (!Account::open_of(s)) return ACC_CLOSED;
+    if (amount > Account::balance_of(s)) return ACC_FUNDS;
+    if (states[id].compare_exchange_weak(s, s - amount * Account::UNIT, std::memory_order_acq_rel,
+                                         std::memory_order_relaxed)) return ACC_OK;
+  }
+}
+
+/**
+ * @brief Moves `amount` between two different accounts. Both are locked in
+ *        id order and frozen, so lock-free updaters wait until the debit and
+ *        the credit are both in.
+ *
+ * @return AccountResult ACC_OK, ACC_CLOSED (either account closed or out of range) or ACC_FUNDS
+ */
+AccountResult CompactStore::transfer(int src_id, int dest_id, long amount) {
+  if (!contains(src_id) || !contains(dest_id) || src_id == dest_id) return ACC_CLOSED;
+  lock(std::min(src_id, dest_id));
+  lock(std::max(src_id, dest_id));
+
+  long src_state  = states[src_id].fetch_or(Account::FROZEN, std::memory_order_acq_rel);
+  long dest_state = states[dest_id].fetch_or(Account::FROZEN, std::memory_order_acq_rel);
+  AccountResult result = !Account::open_of(src_state) || !Account::open_of(dest_state) ? ACC_CLOSED :
+                         amount > Account::balance_of(src_state) ? ACC_FUNDS : ACC_OK;
+  if (result == ACC_OK) {
+    src_state  -= amount * Account::UNIT;
+    dest_state += amount * Account::UNIT;
+  }
+  states[src_id].store(src_state & ~Account::FROZEN, std::memory_order_release);
+  states[dest_id].store(dest_state & ~Account::FROZEN, std::memory_order_release);
+
+  unlock(std::max(src_id, dest_id));
+  unlock(std::min(src_id, dest_id));
+  return result;
+}
+
+/**
+ * @brief Opens a closed account. Takes the lock so a transfer holding the
+ *        account frozen does not write the old OPEN bit back over it.
+ *
+ * @return false if the account is already open or out of range
+ */
+bool CompactStore::open(int id) {
+  if (!contains(id)) return false;
+  lock(id);
+  bool was_open = Account::open_of(states[id].fetch_or(Account::OPEN, std::memory_order_acq_rel));
+  unlock(id);
+  return !was_open;
+}
+
+/**
+ * @brief Closes an open account, under its lock like open().
+ *
+ * @return false if the account is already closed or out of range
+ */
+bool CompactStore::close(int id) {
+  if (!contains(id)) return false;
+  lock(id);
+  bool was_open = Account::open_of(states[id].fetch_and(~Account::OPEN, std::memory_order_acq_rel));
+  unlock(id);
+  return was_open;
+}
@@ -0,0 +1,176 @@
+#include <engine.h>
+
+#include <algorithm>
+
+// The engine and worker id of the calling thread, if it is an engine worker.
+static thread_local const BankEngine* current_engine = nullptr;
+static thread_local int current_worker = -1;
+
+/**
+ * @brief Starts `num_workers` workers that run batches on `bank` until the
+ *        engine shuts down.
+ *
+ * @param bank bank to run batches on
+ * @param num_workers number of worker threads
+ * @param queue_size capacity of the chunk queue
+ */
+BankEngine::BankEngine(Bank& bank, int num_workers, size_t queue_size)
+    : bank(bank), num_workers(num_workers), chunks(queue_size) {
+  for (int i = 0; i < num_workers; ++i) threads.emplace_back(&BankEngine::work, this, i);
+}
+
+/**
+ * @brief Finishes every submitted batch and joins the workers.
+ */
+BankEngine::~BankEngine() {
+  shutdown();
+}
+
+/**
+ * @brief Stops accepting batches, lets the workers finish every batch already
+ *        submitted and joins them. Later submits fail every entry. Called
+ *        from a batch callback, it only stops taking batches: a worker cannot
+ *        join itself, and must not wait for `submit_lock`, whose holder may
+ *        be blocked on a full queue that only the workers drain. The
+ *        destructor then closes the queue and joins the workers.
+ */
+void BankEngine::shutdown() {
+  if (current_engine == this) {
+    stopped.store(true);
+    return;
+  }
+  {
+    // Automatically unlocks when destroyed.
+    std::scoped_lock lock {submit_lock};
+    stopped.store(true);
+    chunks.close();
+  }
+
+  // Automatically unlocks when destroyed.
+  std::scoped_lock lock {join_lock};
+  for (auto& thread : threads) {
+    if (thread.joinable()) thread.join();
+  }
+}
+
+/**
+ * @brief Submits a batch and returns a future for its results.
+ *
+ * @param entries entries to run; they are copied, so the span only has to
+ *                live for the call
+ * @return std::future<std::vector<int>> per-entry results, in entry order:
+ *         0 on success, -1 on failure
+ */
+std::future<std::vector<int>> BankEngine::submit(std::span<const Ledger> entries) {
+  Batch* batch = acquire(entries);
+  std::future<std::vector<int>> results = batch->promise.get_future();
+  start(batch);
+  return results;
+}
+
+/**
+ * @brief Submits a batch and calls `done` with its results on the worker that
+ *        finishes it. `done` should return quickly, since that worker runs no
+ *        other entries meanwhile.
+ *
+ * @param entries entries to run (copied)
+ * @param done called with the per-entry results, in entry order
+ */
+void BankEngine::submit(std::span<const Ledger> entries, Callback done) {
+  Batch* batch = acquire(entries);
+  batch->done = std::move(done);
+  start(batch);
+}
+
+/**
+ * @brief Takes a recycled batch (or a new one) and fills it for `entries`.
+ */
+BankEngine::Batch* BankEngine::acquire(std::span<const Ledger> entries) {
+  Batch* batch;
+  {
+    // Automatically unlocks when destroyed.
+    std::scoped_lock lock {batch_lock};
+    if (free_batches.empty()) {
+      batch = &batches.emplace_back();
+    } else {
+      batch = free_batches.back();
+      free_batches.pop_back();
+    }
+  }
+
+  batch->entries.assign(entries.begin(), entries.end());
+  batch->results.assign(entries.size(), -1);
+  batch->remaining.store(entries.size(), std::memory_order_relaxed);
+  batch->promise = std::promise<std::vector<int>>();
+  batch->done = nullptr;
+  return batch;
+}
+
+/**
+ * @brief Queues a filled batch in chunks. Chunks are sized so every worker
+ *        gets a few of them, up to ENGINE_CHUNK entries each. A batch
+ *        submitted from a callback runs on the calling worker instead.
+ */
+void BankEngine::start(Batch* batch) {
+  size_t n = batch->entries.size();
+  size_t chunk = std::clamp<size_t>(n / (4 * std::max(num_workers, 1)), 1, ENGINE_CHUNK);
+
+  // From a callback, without `submit_lock`: its holder may be waiting for this worker to drain the queue.
+  if (current_engine == this) {
+    if (stopped.load() || n == 0) finish(batch);
+    else                          run(batch, 0, n, current_worker);
+    return;
+  }
+
+  // Automatically unlocks when destroyed.
+  std::unique_lock<std::mutex> lock {submit_lock};
+  if (stopped.load() || n == 0) {
+    lock.unlock();
+    finish(batch);
+    return;
+  }
+  for (size_t begin = 0; begin < n; begin += chunk) chunks.push({batch, begin, std::min(begin + chunk, n)});
+}
+
+/**
+ * @brief Runs entries [begin, end) of a batch, and finishes the batch if they
+ *        were its last ones.
+ */
+void BankEngine::run(Batch* batch, size_t begin, size_t end, int worker_id) {
+  for (size_t i = begin; i < end; ++i) {
+    TRACE_QUEUED(batch->entries[i].mode);
+    batch->results[i] = execute_entry(bank, worker_id, batch->entries[i]);
+  }
+
+  size_t done = end - begin;
+  if (batch->remaining.fetch_sub(done, std::memory_order_acq_rel) == done) finish(batch);
+}
+
+/**
+ * @brief Hands a batch's results to its callback or future and recycles it.
+ *        A callback gets the results buffer by reference, so unless it moves
+ *        from it, the buffer stays with the batch for the next acquire().
+ */
+void BankEngine::finish(Batch* batch) {
+  if (batch->done) batch->done(std::move(batch->results));
+  else             batch->promise.set_value(std::move(batch->results));
+
+  // Automatically unlocks when destroyed.
+  std::scoped_lock lock {batch_lock};
+  free_batches.push_back(batch);
+}
+
+/**
+ * @brief Worker loop: runs chunks until the engine shuts down and the queue
+ *        is drained. The worker that completes a batch's last entry finishes
+ *        the batch.
+ *
+ * @param worker_id id of the worker
+ */
+void BankEngine::work(int worker_id) {
+  current_engine = this;
+  current_worker = worker_id;
+
+  Chunk c;
+  while (chunks.pop(c)) run(c.batch, c.begin, c.end, worker_id);
+}
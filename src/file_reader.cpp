@@ -0,0 +1,277 @@
+#include <file_reader.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/**
+ * @brief Reads a whole file with blocking read() calls.
+ *
+ * @param path file to read
+ * @param data receives the contents
+ * @return false if the file could not be read (an error is printed)
+ */
+static bool read_file(const std::string& path, std::vector<char>& data) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    perror(path.c_str());
+    if (fd >= 0) close(fd);
+    return false;
+  }
+
+  data.resize(st.st_size);
+  size_t filled = 0;
+  while (filled < data.size()) {
+    ssize_t n = read(fd, data.data() + filled, data.size() - filled);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) perror(path.c_str());
+    if (n <= 0) break;
+    filled += n;
+  }
+  close(fd);
+  // A file that shrank since fstat() ends where the reads did.
+  data.resize(filled);
+  return filled == (size_t)st.st_size;
+}
+
+/**
+ * @brief Sets up the io_uring, unless `use_uring` is false or the kernel
+ *        refuses it, in which case reads go through a thread pool.
+ *
+ * @param depth files read at once
+ * @param use_uring whether to try io_uring at all
+ */
+FileReader::FileReader(int depth, bool use_uring) : depth(std::max(depth, 1)) {
+  if (use_uring) setup_uring();
+}
+
+FileReader::~FileReader() {
+  if (sqes != nullptr) munmap(sqes, sqes_size);
+  if (cq_map != nullptr && cq_map != sq_map) munmap(cq_map, cq_size);
+  if (sq_map != nullptr) munmap(sq_map, sq_size);
+  if (ring_fd >= 0) close(ring_fd);
+}
+
+/**
+ * @brief Creates a ring with `depth` submission entries and maps its queues.
+ *
+ * @return false if io_uring is unavailable (the reader then stays without a ring)
+ */
+bool FileReader::setup_uring() {
+  io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  int fd = syscall(__NR_io_uring_setup, depth, &p);
+  if (fd < 0) return false;
+  // IORING_OP_READ came with the same kernel (5.6) as this feature flag.
+  if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+    close(fd);
+    return false;
+  }
+
+  sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+  bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single) sq_size = cq_size = std::max(sq_size, cq_size);
+  sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+
+  void* sq = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  void* cq = single ? sq : mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  void* entries = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sq == MAP_FAILED || cq == MAP_FAILED || entries == MAP_FAILED) {
+    perror("io_uring mmap");
+    if (entries != MAP_FAILED) munmap(entries, sqes_size);
+    if (cq != MAP_FAILED && cq != sq) munmap(cq, cq_size);
+    if (sq != MAP_FAILED) munmap(sq, sq_size);
+    close(fd);
+    return false;
+  }
+
+  ring_fd = fd;
+  sq_map = sq;
+  cq_map = cq;
+  sqes = static_cast<io_uring_sqe*>(entries);
+  char* s = static_cast<char*>(sq);
+  char* c = static_cast<char*>(cq);
+  sq_tail  = reinterpret_cast<unsigned*>(s + p.sq_off.tail);
+  sq_mask  = reinterpret_cast<unsigned*>(s + p.sq_off.ring_mask);
+  sq_array = reinterpret_cast<unsigned*>(s + p.sq_off.array);
+  cq_head  = reinterpret_cast<unsigned*>(c + p.cq_off.head);
+  cq_tail  = reinterpret_cast<unsigned*>(c + p.cq_off.tail);
+  cq_mask  = reinterpret_cast<unsigned*>(c + p.cq_off.ring_mask);
+  cqes     = reinterpret_cast<io_uring_cqe*>(c + p.cq_off.cqes);
+  return true;
+}
+
+/**
+ * @brief Reads every file in the list and hands each one to `done`; see
+ *        FileReader. Returns once every file has been handed over.
+ *
+ * @param files paths to read
+ * @param done called once per file
+ */
+void FileReader::read_all(const std::vector<std::string>& files, const Done& done) {
+  if (uring()) read_uring(files, done);
+  else         read_threads(files, done);
+}
+
+/**
+ * @brief Queues a read of the rest of a slot's file (up to URING_MAX_READ
+ *        bytes). It is submitted by the next io_uring_enter().
+ */
+void FileReader::submit_read(int slot, Slot& s) {
+  // Only this thread writes the tail; the kernel reads it.
+  unsigned tail = *sq_tail;
+  unsigned i = tail & *sq_mask;
+  io_uring_sqe& sqe = sqes[i];
+  memset(&sqe, 0, sizeof(sqe));
+  sqe.opcode = IORING_OP_READ;
+  sqe.fd = s.fd;
+  sqe.addr = reinterpret_cast<uint64_t>(s.data.data() + s.filled);
+  sqe.len = std::min<size_t>(s.data.size() - s.filled, URING_MAX_READ);
+  sqe.off = s.filled;
+  sqe.user_data = slot;
+  sq_array[i] = i;
+  std::atomic_ref<unsigned>(*sq_tail).store(tail + 1, std::memory_order_release);
+  to_submit++;
+}
+
+/**
+ * @brief read_all() on the ring: opens files up to the window, keeps one read
+ *        in flight per open file, and reaps completions until every file is
+ *        done. Short reads are resubmitted for the rest of the file.
+ */
+void FileReader::read_uring(const std::vector<std::string>& files, const Done& done) {
+  std::vector<Slot> slots(depth);
+  std::vector<int> free_slots;
+  for (int i = depth - 1; i >= 0; --i) free_slots.push_back(i);
+  std::vector<bool> finished(files.size());
+  size_t next = 0, first_unread = 0;
+  int in_flight = 0;
+
+  // Hands a file over and moves the window past every file read so far.
+  auto finish = [&](size_t index, std::vector<char>& data, bool ok) {
+    done(index, data, ok);
+    finished[index] = true;
+    while (first_unread < files.size() && finished[first_unread]) first_unread++;
+  };
+
+  while (first_unread < files.size()) {
+    while (!free_slots.empty() && next < files.size() && next < first_unread + depth) {
+      size_t index = next++;
+      std::vector<char> none;
+      int fd = open(files[index].c_str(), O_RDONLY | O_CLOEXEC);
+      struct stat st;
+      if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(files[index].c_str());
+        if (fd >= 0) close(fd);
+        finish(index, none, false);
+        continue;
+      }
+      if (st.st_size == 0) {
+        close(fd);
+        finish(index, none, true);
+        continue;
+      }
+
+      int slot = free_slots.back();
+      free_slots.pop_back();
+      Slot& s = slots[slot];
+      s.index = index;
+      s.fd = fd;
+      s.data.resize(st.st_size);
+      s.filled = 0;
+      submit_read(slot, s);
+      in_flight++;
+    }
+    if (in_flight == 0) continue;
+
+    // Submits the queued reads and waits for at least one to complete.
+    int submitted = syscall(__NR_io_uring_enter, ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+    if (submitted < 0 && errno == EINTR) continue;
+    if (submitted < 0) {
+      perror("io_uring_enter");
+      // The ring is unusable; fail what is left rather than hang.
+      for (int slot = 0; slot < depth; ++slot) {
+        if (std::find(free_slots.begin(), free_slots.end(), slot) != free_slots.end()) continue;
+        close(slots[slot].fd);
+        finish(slots[slot].index, slots[slot].data, false);
+      }
+      std::vector<char> none;
+      while (next < files.size()) finish(next++, none, false);
+      return;
+    }
+    to_submit -= submitted;
+
+    unsigned head = *cq_head;
+    unsigned tail = std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire);
+    for (; head != tail; ++head) {
+      const io_uring_cqe& cqe = cqes[head & *cq_mask];
+      int slot = cqe.user_data;
+      int res = cqe.res;
+      Slot& s = slots[slot];
+      if (res > 0) {
+        s.filled += res;
+        if (s.filled < s.data.size()) {
+          submit_read(slot, s);
+          continue;
+        }
+      }
+
+      // Read in full, cut short by a file that shrank (res == 0), or failed
+      close(s.fd);
+      if (res < 0) fprintf(stderr, "%s: %s\n", files[s.index].c_str(), strerror(-res));
+      s.data.resize(s.filled);
+      in_flight--;
+      free_slots.push_back(slot);
+      finish(s.index, s.data, res >= 0);
+    }
+    std::atomic_ref<unsigned>(*cq_head).store(head, std::memory_order_release);
+  }
+}
+
+/**
+ * @brief read_all() without io_uring: `depth` threads each take the next
+ *        file in the window and read it with blocking calls.
+ */
+void FileReader::read_threads(const std::vector<std::string>& files, const Done& done) {
+  std::mutex lock;
+  std::condition_variable window;
+  std::vector<bool> finished(files.size());
+  size_t next = 0, first_unread = 0;
+
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < std::min<size_t>(depth, files.size()); ++t) {
+    threads.emplace_back([&]() {
+      // Automatically unlocks when destroyed.
+      std::unique_lock<std::mutex> guard {lock};
+      for (;;) {
+        window.wait(guard, [&]() { return next >= files.size() || next < first_unread + depth; });
+        if (next >= files.size()) return;
+        size_t index = next++;
+        guard.unlock();
+        std::vector<char> data;
+        bool ok = read_file(files[index], data);
+        guard.lock();
+
+        done(index, data, ok);
+        finished[index] = true;
+        while (first_unread < files.size() && finished[first_unread]) first_unread++;
+        window.notify_all();
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+}
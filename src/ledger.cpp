@@ -1,104 +1,1047 @@
 #include <ledger.h>
+#include <affinity.h>
+#include <file_reader.h>
+#include <scheduler.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <deque>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+
+/**
+ * @brief Blocks SIGINT and SIGTERM in the calling thread, and in every
+ *        thread it starts, for as long as it lives (follow mode only).
+ *        read_follow() then takes them through a signalfd.
+ */
+class StopSignals {
+	public:
+		StopSignals(bool block) : blocked(block) {
+			if (!blocked) return;
+			sigset_t stop;
+			sigemptyset(&stop);
+			sigaddset(&stop, SIGINT);
+			sigaddset(&stop, SIGTERM);
+			pthread_sigmask(SIG_BLOCK, &stop, &old_mask);
+		}
+		~StopSignals() { if (blocked) pthread_sigmask(SIG_SETMASK, &old_mask, nullptr); }
+
+	private:
+		bool blocked;
+		sigset_t old_mask;
+};
 
 /**
  * @brief Creates a new bank object and sets up workers to read from the file and execute the ledger.
  *  
- * @param num_workers number of workers to create for both reading and executing the ledger
+ * @param num_workers number of workers to execute the ledger (and of readers, unless config.readers says otherwise)
  * @param filename file to read
+ * @param config runtime options (queue capacity, verbosity, ingestion mode, ...)
+ */
+void InitBank(int num_workers, std::string filename, const BankConfig& config) {
+	InitBank(num_workers, std::vector<std::string> {filename}, config);
+}
+
+/**
+ * @brief Like InitBank above, but for a list of ledger files and directories
+ *        (see ledger_files()). Several files are read with read_files(), and
+ *        their ledger ids run on from one file to the next.
+ *
+ * @param num_workers number of workers to execute the ledger (and of readers, unless config.readers says otherwise)
+ * @param paths ledger files and directories, in the order to read them
+ * @param config runtime options (queue capacity, verbosity, ingestion mode, ...)
  */
-void InitBank(int num_workers, std::string filename) {
-	Bank bank = Bank(10);
+void InitBank(int num_workers, const std::vector<std::string>& paths, const BankConfig& config) {
+	std::vector<std::string> files = ledger_files(paths);
+	if (files.empty() || (config.follow && files.size() > 1)) {
+		std::cerr << (files.empty() ? "No ledger files to read\n" : "--follow takes a single ledger file\n");
+		return;
+	}
+
+	// Before any thread starts, so that none of them is killed by the signals that end --follow
+	StopSignals stop_signals {config.follow};
+#ifdef BANK_TRACE
+	// Dumps the latency histograms on SIGUSR1 and once more when InitBank returns
+	TraceDumper dumper {config.trace_path};
+#endif
+
+	// Starts from a checkpoint if there is one, otherwise from accounts 0 ... 9
+	Bank bank = Bank(config.checkpoint_path.empty() ? 10 : 0);
+	std::unique_ptr<WriteAheadLog> wal;
+	if (!prepare_bank(bank, config, wal, ledger_fingerprint(files))) return;
+
+	// Ledger variables; the queue is split per worker when stealing or partitioned (never in ledger order mode)
+	bool partition = config.partition && !config.deterministic;
+	bool split = (config.steal || partition) && !config.deterministic && num_workers > 1;
+	LedgerQueue ledger {split ? (config.queue_size + num_workers - 1) / num_workers : config.queue_size, split ? num_workers : 1, !partition,
+	                    config.fuse && !config.deterministic};
+	bank.single_writer = partition;
+
+	// Thread arrays; a deterministic run uses one sequencer thread that owns its own worker pool
+	int num_readers = config.deterministic ? 1 : config.readers > 0 ? config.readers : num_workers;
+	std::thread wthreads[config.deterministic ? 1 : num_workers];
+	std::thread reporter;
+	ReportTimer timer;
+	std::vector<int> cpus;
+	if (config.pin) cpus = place_threads(CpuTopology::detect(), num_workers);
+
+	bank.print_accounts();
+	// Initializes all writer threads, runs the readers to completion and then joins the writers
+	if (config.deterministic) {
+		wthreads[0] = std::thread(sequence, std::ref(bank), num_workers, config.batch_size, std::ref(ledger), config.follow);
+	} else {
+		for (int i = 0; i < num_workers; ++i) {
+			wthreads[i] = std::thread([&, i]() {
+				if (!cpus.empty()) pin_thread(cpus[i]);
+				worker(bank, i, ledger);
+			});
+		}
+	}
+	if (config.report_ms > 0) reporter = std::thread(report, std::ref(bank), config.report_ms, std::ref(timer));
+	// A single reader pushes entries in ledger order, which the deterministic scheduler relies on.
+	if (config.follow) read_follow(files[0], ledger);
+	else               read_ledgers(num_readers, files, config.mmap, ledger);
+	for (auto& thread : wthreads) thread.join();
+	if (reporter.joinable()) {
+		{
+			// Automatically unlocks when destroyed.
+			std::scoped_lock lock {timer.lock};
+			timer.stop = true;
+		}
+		timer.stop_cv.notify_one();
+		reporter.join();
+	}
+	if (wal) wal->sync();
+	bank.print_accounts();
+	if (config.print_stats) bank.stats().print(std::cout);
+	if (!config.save_checkpoint.empty()) bank.checkpoint(config.save_checkpoint);
+}
+
+/**
+ * @brief Applies the start-up options to a new bank: restores the checkpoint,
+ *        sets the verbosity, replays the write-ahead log records the
+ *        checkpoint does not include yet and keeps appending to the log.
+ *
+ * @param bank bank to prepare (empty if a checkpoint is given)
+ * @param config runtime options
+ * @param wal receives the open write-ahead log, if any; must outlive the bank's use of it
+ * @param ledger ledger_fingerprint() of the files about to run, or 0 for a
+ *               server, which numbers its entries past the log instead
+ * @return false if the checkpoint or the log could not be used (an error is printed)
+ */
+bool prepare_bank(Bank& bank, const BankConfig& config, std::unique_ptr<WriteAheadLog>& wal, uint64_t ledger) {
+	if (!config.checkpoint_path.empty() && !bank.restore(config.checkpoint_path)) return false;
+	bank.logger.set_verbosity(config.verbosity);
+
+	if (!config.wal_path.empty()) {
+		std::vector<WalRecord> records;
+		if (!read_wal(config.wal_path, records, ledger)) return false;
+		wal = std::make_unique<WriteAheadLog>(config.wal_path, ledger);
+		if (!wal->valid()) return false;
+
+		// A checkpoint saved with this log already includes its first records; they only mark their ids.
+		uint64_t covered = bank.checkpointed_records(wal->id());
+		if (records.size() < covered) std::cerr << config.wal_path << ": holds fewer records than " << config.checkpoint_path << " already includes\n";
+		for (size_t i = 0; i < records.size(); ++i) bank.replay(records[i], i >= covered);
+		if (!records.empty()) std::cout << "Recovered " << records.size() << " operations from " << config.wal_path << "\n";
+		bank.wal = wal.get();
+	}
+	return true;
+}
+
+/**
+ * @brief Prints a line built from a live snapshot of the bank every
+ *        `interval_ms` milliseconds until told to stop:
+ *  - 'Report [n]: [accounts] open accounts, total $[total]'
+ *
+ * @param bank bank to report on
+ * @param interval_ms time between reports
+ * @param timer tells the reporter when to stop
+ */
+void report(Bank& bank, int interval_ms, ReportTimer& timer) {
+	// Automatically unlocks when destroyed.
+	std::unique_lock<std::mutex> lock {timer.lock};
+	for (int n = 0; !timer.stop_cv.wait_for(lock, std::chrono::milliseconds(interval_ms), [&]() { return timer.stop; }); ++n) {
+		BankSnapshot snap = bank.snapshot();
+		std::string line = "Report " + std::to_string(n) + ": " + std::to_string(snap.balances.size()) +
+						   " open accounts, total $" + std::to_string(snap.total()) + "\n";
+		std::cout.write(line.data(), line.size()).flush();
+	}
+}
+
+/**
+ * @brief Reads ledger files into the buffer with the reader that suits them:
+ *        read_files() for several files, read_mapped() for a binary ledger
+ *        or with `mmap`, and read_stream() otherwise.
+ *
+ * @param num_readers number of reader threads
+ * @param files ledger files, in the order of their ledger ids
+ * @param mmap whether to map a single text ledger (see --mmap)
+ * @param ledger buffer ledger (closed once every file is read)
+ */
+void read_ledgers(int num_readers, const std::vector<std::string>& files, bool mmap, LedgerQueue& ledger) {
+	if (files.size() > 1)                        read_files(num_readers, files, ledger);
+	else if (mmap || is_binary_ledger(files[0])) read_mapped(num_readers, files[0], ledger);
+	else                                         read_stream(num_readers, files[0], ledger);
+}
+
+/**
+ * @brief Records in a ledger file read into memory: a binary ledger's count,
+ *        or a text ledger's non-blank lines.
+ */
+static int count_file(const std::vector<char>& data) {
+	if (const LedgerHeader* header = binary_header(data.data(), data.size())) return header->count;
+	if (ledger_magic(data.data(), data.size())) return 0;
+	return count_records({data.data(), data.data() + data.size()});
+}
+
+/**
+ * @brief Pushes the records of a ledger file read into memory, numbered from
+ *        `first_id`. A binary ledger whose header or checksum is bad is
+ *        skipped.
+ */
+static void push_file(const std::string& filename, const std::vector<char>& data, int first_id, LedgerQueue& ledger) {
+	const LedgerHeader* header = binary_header(data.data(), data.size());
+	if (header == nullptr && ledger_magic(data.data(), data.size())) {
+		std::cerr << filename << ": unsupported binary ledger version or length\n";
+		return;
+	}
+	if (header == nullptr) {
+		push_chunk({data.data(), data.data() + data.size()}, first_id, ledger);
+		return;
+	}
+
+	const Ledger* records = reinterpret_cast<const Ledger*>(header + 1);
+	uint64_t checksum = 0;
+	for (uint64_t i = 0; i < header->count; ++i) checksum += record_checksum(records[i]);
+	if (checksum != header->checksum) {
+		std::cerr << filename << ": binary ledger checksum mismatch\n";
+		return;
+	}
+	push_records(records, records + header->count, first_id, ledger);
+}
+
+/**
+ * @brief Reads a list of ledger files, text or binary, while a FileReader
+ *        keeps up to READ_DEPTH of them in flight, and parses them with
+ *        `num_readers` threads.
+ *
+ * Ledger ids run on from one file to the next in list order, so every
+ * record gets the id it would have in one ledger holding all the files one
+ * after another. Each file's records are counted as soon as it has been
+ * read, and a file goes to the parsers, with its first id, once every file
+ * before it has been counted. With one parser, files are pushed in list
+ * order. At most READ_DEPTH read files wait for a parser, and the reader
+ * keeps at most READ_DEPTH more in its window, so with each parser holding
+ * the file it is pushing, up to 2 * READ_DEPTH + `num_readers` files can be
+ * in memory at once.
+ *
+ * @param num_readers number of parser threads
+ * @param files ledger files, in the order of their ledger ids
+ * @param ledger buffer ledger (closed once every file is pushed)
+ */
+void read_files(int num_readers, const std::vector<std::string>& files, LedgerQueue& ledger) {
+	// A read file waiting for a parser
+	struct Job {
+		size_t index;
+		int first_id;
+		std::vector<char> data;
+	};
+	std::mutex jobs_lock;
+	std::condition_variable has_job, has_room;
+	std::deque<Job> jobs;
+	bool reading = true;
+
+	std::thread parsers[num_readers];
+	for (auto& thread : parsers) {
+		thread = std::thread([&]() {
+			for (;;) {
+				Job job;
+				{
+					// Automatically unlocks when destroyed.
+					std::unique_lock<std::mutex> lock {jobs_lock};
+					has_job.wait(lock, [&]() { return !jobs.empty() || !reading; });
+					if (jobs.empty()) return;
+					job = std::move(jobs.front());
+					jobs.pop_front();
+				}
+				has_room.notify_one();
+				push_file(files[job.index], job.data, job.first_id, ledger);
+			}
+		});
+	}
+
+	// Files read ahead of one that is still being read wait here to be counted in order.
+	std::vector<std::vector<char>> read(files.size());
+	std::vector<int> counts(files.size(), -1);
+	size_t next = 0;
+	int first_id = 0;
+	FileReader reader;
+	reader.read_all(files, [&](size_t index, std::vector<char>& data, bool ok) {
+		// A file that could not be read in full is skipped.
+		if (!ok) data.clear();
+		counts[index] = count_file(data);
+		read[index] = std::move(data);
+		for (; next < files.size() && counts[next] >= 0; ++next) {
+			// Automatically unlocks when destroyed.
+			std::unique_lock<std::mutex> lock {jobs_lock};
+			has_room.wait(lock, [&]() { return jobs.size() < READ_DEPTH; });
+			jobs.push_back({next, first_id, std::move(read[next])});
+			has_job.notify_one();
+			first_id += counts[next];
+		}
+	});
+
+	{
+		// Automatically unlocks when destroyed.
+		std::scoped_lock lock {jobs_lock};
+		reading = false;
+	}
+	has_job.notify_all();
+	for (auto& thread : parsers) thread.join();
+	ledger.close();
+}
 
+/**
+ * @brief Reads a text ledger with `num_readers` threads sharing one locked
+ *        file stream.
+ *
+ * @param num_readers number of reader threads
+ * @param filename file to read
+ * @param ledger buffer ledger (closed once the whole file is read)
+ */
+void read_stream(int num_readers, std::string filename, LedgerQueue& ledger) {
 	// File reading variables
-	bool done = false;
+	std::atomic<int> readers {num_readers};
 	std::ifstream file {filename};
 	std::mutex file_lock;
-
-	// Ledger variables
 	int ledger_id = 0;
-	std::queue<Ledger> ledger;
-	std::mutex ledger_lock;
-	std::condition_variable empty, fill;
 
-	// Thread arrays
-	std::thread rthreads[num_workers];
-	std::thread wthreads[num_workers];
+	std::thread rthreads[num_readers];
+	for (int i = 0; i < num_readers; ++i) {
+		rthreads[i] = std::thread(load_ledger, std::ref(readers), std::ref(ledger_id), std::ref(file), std::ref(file_lock),
+								  std::ref(ledger));
+	}
+	for (auto& thread : rthreads) thread.join();
+}
 
-	bank.print_accounts();
-	// Initializes all reader and writer threads and then joins them
-	for (int i = 0; i < num_workers; ++i) {
-		rthreads[i] = std::thread(load_ledger, std::ref(done), std::ref(ledger_id), std::ref(file), std::ref(file_lock),
-								  std::ref(ledger), std::ref(ledger_lock), std::ref(empty), std::ref(fill));
-		wthreads[i] = std::thread(worker, std::ref(bank), std::ref(done), i, 
-								  std::ref(ledger), std::ref(ledger_lock), std::ref(empty), std::ref(fill));
+/**
+ * @brief Tells whether a file starts with the binary ledger magic number.
+ *
+ * @param filename file to check
+ * @return true if the file looks like a binary ledger
+ */
+bool is_binary_ledger(std::string filename) {
+	std::ifstream file {filename, std::ios::binary};
+	uint32_t magic = 0;
+	file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+	return file && magic == LEDGER_MAGIC;
+}
+
+/**
+ * @brief Reads a ledger by mapping it into memory and giving each of
+ *        `num_readers` threads its own part of the file.
+ *
+ * Binary ledgers are split into equal record ranges. Readers verify the
+ * checksum of their range, and records are only pushed once the whole file
+ * has checked out. Records then go into the buffer with no parsing, numbered
+ * by their position in the file as read_files() numbers them. A file that
+ * starts with the binary magic number but has an unsupported version or the
+ * wrong length is rejected without reading.
+ *
+ * Text ledgers are split into newline-aligned chunks. Readers first count the
+ * records in their chunk so every chunk knows its first ledger id, which keeps
+ * numbering identical to a sequential read.
+ *
+ * @param num_readers number of reader threads
+ * @param filename file to read
+ * @param ledger buffer ledger (closed once the whole file is read)
+ */
+void read_mapped(int num_readers, std::string filename, LedgerQueue& ledger) {
+	MappedFile file {filename};
+	const LedgerHeader* header = binary_header(file);
+	if (header == nullptr && ledger_magic(file.data(), file.size())) {
+		std::cerr << filename << ": unsupported binary ledger version or length\n";
+		ledger.close();
+		return;
+	}
+	std::vector<LedgerChunk> chunks = split_chunks(file.data(), file.size(), num_readers);
+	std::vector<uint64_t> counts(num_readers);
+	std::barrier counted {num_readers};
+	std::atomic<int> readers {num_readers};
+
+	std::thread rthreads[num_readers];
+	for (int i = 0; i < num_readers; ++i) {
+		rthreads[i] = std::thread([&, i]() {
+			if (header != nullptr) {
+				const Ledger* records = reinterpret_cast<const Ledger*>(header + 1);
+				int first_id = header->count * i / num_readers;
+				const Ledger* begin = records + first_id;
+				const Ledger* end   = records + header->count * (i + 1) / num_readers;
+				for (const Ledger* l = begin; l < end; ++l) counts[i] += record_checksum(*l);
+				counted.arrive_and_wait();
+
+				uint64_t checksum = 0;
+				for (uint64_t count : counts) checksum += count;
+				if (checksum != header->checksum) {
+					if (i == 0) std::cerr << filename << ": binary ledger checksum mismatch\n";
+					end = begin;
+				}
+				load_records(readers, begin, end, first_id, ledger);
+				return;
+			}
+
+			counts[i] = count_records(chunks[i]);
+			counted.arrive_and_wait();
+
+			int first_id = 0;
+			for (int j = 0; j < i; ++j) first_id += counts[j];
+			load_chunk(readers, chunks[i], first_id, ledger);
+		});
 	}
 	for (auto& thread : rthreads) thread.join();
-	for (auto& thread : wthreads) thread.join();
-	bank.print_accounts();
 }
 
 /**
- * @brief Parse a ledger file and store each line into a list
+ * @brief Reads a text ledger and then follows it as it grows, like
+ *        `tail -f`, until SIGINT or SIGTERM arrives. Then the buffer is closed.
+ *
+ * inotify wakes the reader as soon as the file is written to, and each wake
+ * reads only the bytes appended since the last one. Complete lines are
+ * parsed and pushed right away; a last line that has no newline yet waits
+ * for the rest of it. Ledger ids keep counting across appends. A file
+ * truncated under the reader is read again from its start, with ids still
+ * counting on.
+ *
+ * SIGINT and SIGTERM must be blocked in every thread of the process (see
+ * InitBank), so that they reach the reader's signalfd instead of killing it.
+ *
+ * @param filename text ledger to follow
+ * @param ledger buffer ledger (closed once following stops)
+ */
+void read_follow(std::string filename, LedgerQueue& ledger) {
+	if (is_binary_ledger(filename)) {
+		std::cerr << filename << ": --follow only reads text ledgers\n";
+		ledger.close();
+		return;
+	}
+
+	sigset_t stop;
+	sigemptyset(&stop);
+	sigaddset(&stop, SIGINT);
+	sigaddset(&stop, SIGTERM);
+	// The watch goes in before the first read, so no write after that read is missed.
+	int watch_fd  = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	int signal_fd = signalfd(-1, &stop, SFD_NONBLOCK | SFD_CLOEXEC);
+	int fd = -1;
+	if (watch_fd < 0 || signal_fd < 0 || inotify_add_watch(watch_fd, filename.c_str(), IN_MODIFY) < 0 ||
+	    (fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC)) < 0) {
+		perror(filename.c_str());
+	} else {
+		std::vector<char> pending;  // bytes read but not parsed yet
+		std::vector<Ledger> batch;
+		batch.reserve(READ_BATCH);
+		int ledger_id = 0;
+		off_t offset = 0;
+		pollfd fds[2] = {{watch_fd, POLLIN, 0}, {signal_fd, POLLIN, 0}};
+		for (;;) {
+			struct stat st;
+			if (fstat(fd, &st) == 0 && st.st_size < offset) {
+				std::cerr << filename << ": file truncated, reading it again from the start\n";
+				lseek(fd, 0, SEEK_SET);
+				offset = 0;
+				pending.clear();
+			}
+
+			// Everything appended since the last wake, parsed up to the last complete line
+			ssize_t n;
+			do {
+				size_t size = pending.size();
+				pending.resize(size + FOLLOW_READ_SIZE);
+				n = read(fd, pending.data() + size, FOLLOW_READ_SIZE);
+				pending.resize(size + std::max<ssize_t>(n, 0));
+				offset += std::max<ssize_t>(n, 0);
+
+				const char* last = static_cast<const char*>(memrchr(pending.data() + size, '\n', pending.size() - size));
+				if (last == nullptr) continue;
+				Ledger l;
+				bool ok;
+				const char* p = pending.data();
+				while ((p = parse_record(p, last + 1, l, ok)) != nullptr) {
+					// Malformed lines are skipped but keep their id, as in load_chunk().
+					l.ledgerID = ledger_id++;
+					if (ok) batch.push_back(l);
+					else    std::cerr << "Skipping malformed ledger entry " << l.ledgerID << "\n";
+				}
+				push_batch(batch.data(), batch.data() + batch.size(), ledger);
+				batch.clear();
+				pending.erase(pending.begin(), pending.begin() + (last + 1 - pending.data()));
+			} while (n > 0);
+			if (n < 0) perror(filename.c_str());
+
+			if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+				perror("poll");
+				break;
+			}
+			if (fds[1].revents & POLLIN) {
+				// Taken here, or it would still be pending once InitBank unblocks it.
+				signalfd_siginfo info;
+				if (read(signal_fd, &info, sizeof(info)) < 0) perror("signalfd");
+				break;
+			}
+			// The events only say that the file changed; reading it tells what changed.
+			char events[4096];
+			while (read(watch_fd, events, sizeof(events)) > 0) {}
+		}
+
+		const char* p = pending.data();
+		while (p < pending.data() + pending.size() && isspace(*p)) p++;
+		if (p < pending.data() + pending.size()) std::cerr << filename << ": ignoring the incomplete last line\n";
+	}
+
+	for (int f : {fd, watch_fd, signal_fd}) {
+		if (f >= 0) close(f);
+	}
+	ledger.close();
+}
+
+/**
+ * @brief Parse a ledger file and push each line into the ledger buffer,
+ *        READ_BATCH lines per turn at the stream. The last reader to reach
+ *        the end of the file closes the buffer.
  * 
- * @param done boolean representing if we have finished reading the file stream
+ * @param readers number of readers still parsing the file stream
  * @param ledger_id current ledger id
  * @param file file stream to parse from
- * @param stream_lock mutex lock around the stream
+ * @param stream_lock mutex lock around the stream and `ledger_id`
  * @param ledger buffer ledger
- * @param ledger_lock mutex lock around the ledger buffer
- * @param empty condition variable for emptying the ledger buffer 
- * @param fill condition variable for filling the ledger buffer 
  */
-void load_ledger(bool& done, int& ledger_id, std::ifstream& file, std::mutex& stream_lock, 
-				 std::queue<Ledger>& ledger, std::mutex& ledger_lock, std::condition_variable& empty, std::condition_variable& fill) {
+void load_ledger(std::atomic<int>& readers, int& ledger_id, std::ifstream& file, std::mutex& stream_lock, LedgerQueue& ledger) {
+	std::vector<Ledger> batch;
+	batch.reserve(READ_BATCH);
 	// Automatically unlocks when destroyed.
 	std::unique_lock<std::mutex> file_lock {stream_lock};
 	int f, t, a, m;
-	while (file >> f >> t >> a >> m) {
-		file_lock.unlock();
-		{
-			// Automatically unlocks when destroyed.
-			std::unique_lock<std::mutex> lock {ledger_lock};
-			while (ledger.size() == MAX_SIZE) empty.wait(lock);
-			ledger.push({f, t, a, m, ledger_id++});
-			fill.notify_one();
+	for (;;) {
+		// Ids are taken under the stream lock so they follow file order.
+		batch.clear();
+		int taken = 0;
+		for (; taken < READ_BATCH && file >> f >> t >> a >> m; ++taken) {
+			// Entries with an unknown mode are skipped but keep their id, as in push_chunk().
+			if (valid_mode(m)) batch.push_back({f, t, a, m, ledger_id++});
+			else               std::cerr << "Skipping malformed ledger entry " << ledger_id++ << "\n";
 		}
+		if (taken == 0) break;
+		file_lock.unlock();
+		push_batch(batch.data(), batch.data() + batch.size(), ledger);
 		file_lock.lock();
 	}
+	file_lock.unlock();
+
+	if (--readers == 0) ledger.close();
+}
+
+/**
+ * @brief Parse one chunk of a mapped text ledger and push each record into the
+ *        ledger buffer. The last reader to finish closes the buffer.
+ *
+ * @param readers number of readers still parsing the file
+ * @param chunk newline-aligned chunk to parse
+ * @param first_id ledger id of the first record in the chunk
+ * @param ledger buffer ledger
+ */
+void load_chunk(std::atomic<int>& readers, const LedgerChunk& chunk, int first_id, LedgerQueue& ledger) {
+	push_chunk(chunk, first_id, ledger);
+
+	if (--readers == 0) ledger.close();
+}
+
+/**
+ * @brief Parse a chunk of a text ledger and push each record into the ledger
+ *        buffer, numbered from `first_id`.
+ *
+ * @param chunk newline-aligned chunk to parse
+ * @param first_id ledger id of the first record in the chunk
+ * @param ledger buffer ledger
+ */
+void push_chunk(const LedgerChunk& chunk, int first_id, LedgerQueue& ledger) {
+	std::vector<Ledger> batch;
+	batch.reserve(READ_BATCH);
+	Ledger l;
+	bool ok;
+	int ledger_id = first_id;
+	const char* p = chunk.begin;
+	while ((p = parse_record(p, chunk.end, l, ok)) != nullptr) {
+		// Malformed lines are skipped but keep their id so numbering stays deterministic.
+		l.ledgerID = ledger_id++;
+		if (ok) batch.push_back(l);
+		else    std::cerr << "Skipping malformed ledger entry " << l.ledgerID << "\n";
+		if (batch.size() == READ_BATCH) {
+			push_batch(batch.data(), batch.data() + batch.size(), ledger);
+			batch.clear();
+		}
+	}
+	push_batch(batch.data(), batch.data() + batch.size(), ledger);
+}
+
+/**
+ * @brief Push a range of binary ledger records into the ledger buffer,
+ *        numbered from `first_id`. The last reader to finish closes the
+ *        buffer.
+ *
+ * @param readers number of readers still reading the file
+ * @param begin first record
+ * @param end one past the last record
+ * @param first_id ledger id of the first record (its position in the file)
+ * @param ledger buffer ledger
+ */
+void load_records(std::atomic<int>& readers, const Ledger* begin, const Ledger* end, int first_id, LedgerQueue& ledger) {
+	push_records(begin, end, first_id, ledger);
+
+	if (--readers == 0) ledger.close();
+}
+
+/**
+ * @brief Push binary ledger records into the ledger buffer, READ_BATCH at a
+ *        time. Records are numbered by position, like text lines, whatever
+ *        ids they were stored with. Records with an unknown mode are skipped,
+ *        like malformed text lines.
+ *
+ * @param begin first record
+ * @param end one past the last record
+ * @param first_id ledger id of the first record, counting on from there
+ * @param ledger buffer ledger
+ */
+void push_records(const Ledger* begin, const Ledger* end, int first_id, LedgerQueue& ledger) {
+	std::vector<Ledger> batch;
+	batch.reserve(READ_BATCH);
+	for (const Ledger* l = begin; l < end; ++l) {
+		Ledger entry = *l;
+		entry.ledgerID = first_id + (l - begin);
+		if (valid_mode(entry.mode)) batch.push_back(entry);
+		else                        std::cerr << "Skipping malformed ledger entry " << entry.ledgerID << "\n";
+		if (batch.size() == READ_BATCH) {
+			push_batch(batch.data(), batch.data() + batch.size(), ledger);
+			batch.clear();
+		}
+	}
+	push_batch(batch.data(), batch.data() + batch.size(), ledger);
+}
 
-	done = true;
+/**
+ * @brief Push entries, given in ledger order, into the ledger buffer.
+ *
+ * A fusing buffer gets every READ_BATCH entries as runs: each account's
+ * deposits, withdrawals and balance checks in the batch are gathered into
+ * one ITEM_RUN item, which a worker applies as a single change of the
+ * account (see Bank::apply_run()) while still logging each op. A run ends
+ * where a transfer, open or close of the batch touches its account, so
+ * every account still sees its entries in ledger order. Each run is pushed
+ * where its first entry was, and entries outside runs are pushed as they are.
+ *
+ * @param begin first entry
+ * @param end one past the last entry
+ * @param ledger buffer ledger
+ */
+void push_batch(const Ledger* begin, const Ledger* end, LedgerQueue& ledger) {
+	if (!ledger.fuses()) {
+		for (const Ledger* l = begin; l < end; ++l) ledger.push(*l);
+		return;
+	}
+
+	for (; begin < end; begin += std::min<ptrdiff_t>(end - begin, READ_BATCH)) {
+		int n = std::min<ptrdiff_t>(end - begin, READ_BATCH);
+		int lead[READ_BATCH];  // entry that starts the run an entry is in (itself if in no run)
+		int size[READ_BATCH];  // entries in the run an entry starts
+		std::pair<int, int> open[READ_BATCH];  // accounts with a run still open, and its first entry
+		int num_open = 0;
+
+		for (int i = 0; i < n; ++i) {
+			const Ledger& l = begin[i];
+			lead[i] = i;
+			size[i] = 1;
+			bool fusable = l.mode == 0 || l.mode == 1 || l.mode == 3;
+			for (int k = 0; k < num_open; ++k) {
+				if (open[k].first == l.from && fusable) {
+					lead[i] = open[k].second;
+					size[lead[i]]++;
+				} else if (!fusable && (open[k].first == l.from || (l.mode == 2 && open[k].first == l.to))) {
+					open[k--] = open[--num_open];
+				}
+			}
+			if (fusable && lead[i] == i) open[num_open++] = {l.from, i};
+		}
+
+		for (int i = 0; i < n; ++i) {
+			const Ledger& l = begin[i];
+			if (lead[i] != i) continue;
+			if (size[i] == 1) {
+				ledger.push(l);
+				continue;
+			}
+
+			int slot = ledger.acquire_run();
+			std::vector<RunOp>& ops = ledger.run(slot);
+			ops.clear();
+			// Ledger modes 0, 1 and 3 are OP_DEPOSIT, OP_WITHDRAW and OP_BALANCE.
+			for (int j = i; j < n; ++j) {
+				if (lead[j] == i) ops.push_back({begin[j].ledgerID, begin[j].amount, (Op)begin[j].mode});
+			}
+			ledger.push({l.from, slot, size[i], l.mode, l.ledgerID}, ITEM_RUN);
+		}
+	}
 }
 
 /**
- * @brief Remove items from the list and execute the instruction.
+ * @brief Remove items from the ledger buffer and execute the instruction
+ *        until the buffer is closed and drained.
  * 
  * @param bank bank to process the information from
- * @param done boolean representing if we have finished reading the file stream
  * @param worker_id id of the worker processing 
  * @param ledger buffer ledger
- * @param ledger_lock mutex lock around the ledger buffer
- * @param empty condition variable for emptying the ledger buffer  
- * @param fill condition variable for filling the ledger buffer 
  */
-void worker(Bank& bank, bool& done, int worker_id, 
-			std::queue<Ledger>& ledger, std::mutex& ledger_lock, std::condition_variable& empty, std::condition_variable& fill) {
-	// Automatically unlocks when destroyed.
-	std::unique_lock<std::mutex> lock {ledger_lock};
-	while (!done || ledger.size()) {
-		while (ledger.empty()) fill.wait(lock);
-		Ledger l = ledger.front();
-		ledger.pop();
-		empty.notify_one();
-
-		lock.unlock();
-		switch (l.mode) {
-			case 0: bank.deposit      (worker_id, l.ledgerID, l.from,       l.amount); break;
-			case 1:	bank.withdraw     (worker_id, l.ledgerID, l.from,       l.amount); break;
-			case 2: bank.transfer     (worker_id, l.ledgerID, l.from, l.to, l.amount); break;
-			case 3: bank.check_balance(worker_id, l.ledgerID, l.from                ); break;
-			case 4: bank.open_account (worker_id, l.ledgerID, l.from                ); break;
-			case 5: bank.close_account(worker_id, l.ledgerID, l.from                ); break;
+void worker(Bank& bank, int worker_id, LedgerQueue& ledger) {
+	LedgerItem item;
+	while (ledger.pop(worker_id, item)) {
+		const Ledger& l = item.l;
+		if (item.kind == ITEM_RUN) {
+			bank.apply_run(worker_id, l.from, ledger.run(l.to));
+			ledger.release_run(l.to);
+			continue;
+		}
+		if (item.kind == ITEM_ENTRY) {
+			TRACE_QUEUED(l.mode);
+		}
+		if (ledger.partitioned()) execute_owned(bank, worker_id, item, ledger);
+		else                      execute_entry(bank, worker_id, l);
+	}
+}
+
+/**
+ * @brief Execute one ledger entry on the bank, unless it was restored from
+ *        the write-ahead log.
+ * 
+ * @param bank bank to process the information from
+ * @param worker_id id of the worker processing 
+ * @param l entry to execute
+ * @return int 0 on success (or if already applied), -1 on failure or an unknown mode
+ */
+int execute_entry(Bank& bank, int worker_id, const Ledger& l) {
+	// Already applied before a crash and restored from the write-ahead log
+	if (bank.replayed(l.ledgerID)) return 0;
+
+	TRACE_START(exec_start);
+	int result = -1;
+	switch (l.mode) {
+		case 0: result = bank.deposit      (worker_id, l.ledgerID, l.from,       l.amount); break;
+		case 1:	result = bank.withdraw     (worker_id, l.ledgerID, l.from,       l.amount); break;
+		case 2: result = bank.transfer     (worker_id, l.ledgerID, l.from, l.to, l.amount); break;
+		case 3: result = bank.check_balance(worker_id, l.ledgerID, l.from                ); break;
+		case 4: result = bank.open_account (worker_id, l.ledgerID, l.from                ); break;
+		case 5: result = bank.close_account(worker_id, l.ledgerID, l.from                ); break;
+	}
+	TRACE_RECORD(TRACE_EXEC, l.mode, exec_start);
+	return result;
+}
+
+/**
+ * @brief Execute one entry or message of a partitioned queue. A transfer to
+ *        an account of another partition only takes the money out of the
+ *        source here and mails the credit to the destination's worker, which
+ *        mails it back if the destination has been closed in between.
+ * 
+ * @param bank bank to process the information from (a single_writer bank)
+ * @param worker_id id of the worker processing, which owns the entry's `from` account
+ * @param item entry or message to execute
+ * @param ledger partitioned buffer ledger to mail other workers through
+ */
+void execute_owned(Bank& bank, int worker_id, const LedgerItem& item, LedgerQueue& ledger) {
+	const Ledger& l = item.l;
+	switch (item.kind) {
+		case ITEM_CREDIT:
+			if (bank.credit(worker_id, l.ledgerID, l.from, l.to, l.amount) == 0) ledger.end_transfer();
+			else ledger.post(ledger.owner(l.from), l, ITEM_REFUND);
+			return;
+		case ITEM_REFUND:
+			bank.refund(l.from, l.amount);
+			ledger.end_transfer();
+			return;
+		default:
+			break;
+	}
+	if (l.mode == 2) {
+		int dest_owner = ledger.owner(l.to);
+		if (dest_owner != worker_id && !bank.replayed(l.ledgerID)) {
+			TRACE_START(exec_start);
+			if (bank.debit(worker_id, l.ledgerID, l.from, l.to, l.amount) > 0) {
+				ledger.begin_transfer();
+				ledger.post(dest_owner, l, ITEM_CREDIT);
+			}
+			TRACE_RECORD(TRACE_EXEC, l.mode, exec_start);
+			return;
+		}
+	}
+	execute_entry(bank, worker_id, l);
+}
+
+/**
+ * @brief Construct a new ledger queue.
+ *
+ * @param capacity minimum number of slots of each ring
+ * @param num_queues 1 for one shared ring, otherwise one ring per worker
+ * @param steal whether workers may pop other workers' rings; without it the
+ *        queue is partitioned (see LedgerQueue)
+ * @param fuse whether readers push fused runs, which need a pool of run slots
+ */
+LedgerQueue::LedgerQueue(size_t capacity, int num_queues, bool steal, bool fuse) {
+	for (int i = 0; i < std::max(num_queues, 1); ++i) rings.push_back(std::make_unique<RingBuffer<LedgerItem>>(capacity));
+	if (fuse) {
+		// One run slot per queue slot, up to MAX_RUN_SLOTS
+		runs.resize(std::min<size_t>(this->capacity(), MAX_RUN_SLOTS));
+		free_runs = std::make_unique<RingBuffer<int>>(runs.size());
+		for (size_t i = 0; i < runs.size(); ++i) free_runs->push(i);
+	}
+	if (steal || rings.size() == 1) return;
+	for (size_t i = 0; i < rings.size(); ++i) boxes.push_back(std::make_unique<Mailbox>());
+	draining.store(rings.size());
+}
+
+size_t LedgerQueue::capacity() const {
+	return rings.size() * rings[0]->capacity();
+}
+
+/**
+ * @brief Takes a free run slot, waiting for a worker to release one if every
+ *        slot is queued or running. Workers release a slot once they have
+ *        applied its run.
+ *
+ * @return int the slot, to fill through run()
+ */
+int LedgerQueue::acquire_run() {
+	int slot;
+	free_runs->pop(slot);
+	return slot;
+}
+
+/**
+ * @brief Enqueues an entry on the ring of its home worker if there is room.
+ *        Accounts are split over the workers by AccountIndex::partition().
+ *
+ * @return true if the entry was enqueued, false if that ring is full
+ */
+bool LedgerQueue::try_push(const Ledger& l, ItemKind kind) {
+	int home = owner(l.from);
+	if (!rings[home]->try_push({l, kind})) return false;
+	wake(home);
+	return true;
+}
+
+/**
+ * @brief Enqueues an entry on its home ring, waiting for room if it is full.
+ *
+ * @return true once enqueued, false if the queue was closed first
+ */
+bool LedgerQueue::push(const Ledger& l, ItemKind kind) {
+	int home = owner(l.from);
+	if (!rings[home]->push({l, kind})) return false;
+	wake(home);
+	return true;
+}
+
+/**
+ * @brief Dequeues an entry if one is available. Like pop(worker_id, l), this
+ *        is for queues whose items are all entries.
+ *
+ * @return true if an entry was dequeued, false if every ring is empty
+ */
+bool LedgerQueue::try_pop(Ledger& l) {
+	LedgerItem item;
+	if (!take(0, item)) return false;
+	l = item.l;
+	return true;
+}
+
+/**
+ * @brief pop(worker_id, item) for queues that neither fuse nor partition,
+ *        whose items are all entries (the scheduler's and the shard routers').
+ *
+ * @return true if an entry was dequeued, false once the queue is closed and empty
+ */
+bool LedgerQueue::pop(int worker_id, Ledger& l) {
+	LedgerItem item;
+	if (!pop(worker_id, item)) return false;
+	l = item.l;
+	return true;
+}
+
+/**
+ * @brief Dequeues an entry from the worker's own ring, or steals one from
+ *        the next non-empty ring after it. A partitioned queue never steals.
+ *
+ * @return true if an entry was dequeued, false if every ring is empty
+ */
+bool LedgerQueue::take(int worker_id, LedgerItem& item) {
+	int n = partitioned() ? 1 : rings.size();
+	for (int i = 0; i < n; ++i) {
+		if (rings[(worker_id + i) % rings.size()]->try_pop(item)) return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Dequeues an item for a worker, waiting for one if every ring is
+ *        empty. Waiting works like RingBuffer::pop, but on a signal shared
+ *        by all rings, since work may show up on any of them.
+ *
+ * @param worker_id worker whose ring is tried first
+ * @param item receives the item
+ * @return true if an item was dequeued, false once the queue is closed and empty
+ */
+bool LedgerQueue::pop(int worker_id, LedgerItem& item) {
+	if (rings.size() == 1) return rings[0]->pop(item);
+	if (partitioned()) return pop_owned(worker_id, item);
+
+	for (int i = 0; i < RING_SPIN; ++i) {
+		if (take(worker_id, item)) return true;
+		cpu_relax();
+	}
+	for (;;) {
+		waiters.fetch_add(1);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		uint32_t seen = signal.load(std::memory_order_acquire);
+		bool popped = take(worker_id, item);
+		bool finished = !popped && is_closed();
+		// Entries pushed before close() must still be drained.
+		if (finished) popped = take(worker_id, item);
+		else if (!popped) signal.wait(seen);
+		waiters.fetch_sub(1);
+		if (popped) return true;
+		if (finished) return false;
+	}
+}
+
+/**
+ * @brief Takes the worker's next message, or else the next entry of its
+ *        ring. Messages go first, since they finish transfers in flight.
+ */
+bool LedgerQueue::take_owned(int worker_id, LedgerItem& item) {
+	Mailbox& box = *boxes[worker_id];
+	if (box.next == box.local.size() && box.has_mail.load(std::memory_order_acquire)) {
+		box.local.clear();
+		box.next = 0;
+		// Automatically unlocks when destroyed.
+		std::scoped_lock lock {box.lock};
+		box.local.swap(box.items);
+		box.has_mail.store(false, std::memory_order_relaxed);
+	}
+	if (box.next < box.local.size()) {
+		item = box.local[box.next++];
+		return true;
+	}
+	return rings[worker_id]->try_pop(item);
+}
+
+/**
+ * @brief Whether a partitioned worker is done: every ring has been drained
+ *        and no transfer is in flight, so no message can come any more.
+ */
+bool LedgerQueue::finished(const Mailbox& box) const {
+	return box.input_done && draining.load() == 0 && in_flight.load() == 0;
+}
+
+/**
+ * @brief pop() for a partitioned queue. A worker notes when its own ring is
+ *        closed and drained; it keeps taking messages until finished().
+ */
+bool LedgerQueue::pop_owned(int worker_id, LedgerItem& item) {
+	Mailbox& box = *boxes[worker_id];
+	for (int spins = 0;; ++spins) {
+		bool was_closed = is_closed();
+		if (take_owned(worker_id, item)) return true;
+		// Nothing is pushed after close(), so the ring stays empty from here on.
+		if (was_closed && !box.input_done) {
+			box.input_done = true;
+			if (--draining == 0) wake_all();
+		}
+		if (finished(box)) return false;
+		if (spins < RING_SPIN) {
+			cpu_relax();
+			continue;
 		}
-		lock.lock();
+
+		box.waiting.store(1);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		uint32_t seen = box.signal.load(std::memory_order_acquire);
+		bool popped = take_owned(worker_id, item);
+		if (!popped && !finished(box) && !(is_closed() && !box.input_done)) box.signal.wait(seen);
+		box.waiting.store(0);
+		if (popped) return true;
+	}
+}
+
+/**
+ * @brief Mails a message to a worker of a partitioned queue. Never blocks.
+ */
+void LedgerQueue::post(int worker_id, const Ledger& l, ItemKind kind) {
+	Mailbox& box = *boxes[worker_id];
+	{
+		// Automatically unlocks when destroyed.
+		std::scoped_lock lock {box.lock};
+		box.items.push_back({l, kind});
+		box.has_mail.store(true, std::memory_order_release);
+	}
+	wake(worker_id);
+}
+
+/**
+ * @brief Ends a transfer started with begin_transfer(). The last one after
+ *        every ring is drained lets the workers finish.
+ */
+void LedgerQueue::end_transfer() {
+	if (--in_flight == 0 && draining.load() == 0) wake_all();
+}
+
+/**
+ * @brief Wakes a parked worker that may have work now; see RingBuffer::wake.
+ *        A partitioned queue wakes the worker itself, otherwise any worker
+ *        will do.
+ */
+void LedgerQueue::wake(int worker_id) {
+	if (rings.size() == 1) return;
+	std::atomic<uint32_t>& parked = partitioned() ? boxes[worker_id]->waiting : waiters;
+	std::atomic<uint32_t>& bell   = partitioned() ? boxes[worker_id]->signal  : signal;
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (parked.load(std::memory_order_relaxed) != 0) {
+		bell.fetch_add(1, std::memory_order_release);
+		bell.notify_one();
 	}
 }
+
+/**
+ * @brief Wakes every parked worker of a partitioned queue to recheck
+ *        whether it is finished.
+ */
+void LedgerQueue::wake_all() {
+	for (auto& box : boxes) {
+		box->signal.fetch_add(1);
+		box->signal.notify_all();
+	}
+}
+
+/**
+ * @brief Marks the end of input on every ring and wakes every parked thread.
+ *        Must only be called once all readers are done pushing.
+ */
+void LedgerQueue::close() {
+	closed.store(true, std::memory_order_seq_cst);
+	for (auto& ring : rings) ring->close();
+	signal.fetch_add(1);
+	signal.notify_all();
+	wake_all();
+}
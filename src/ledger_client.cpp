@@ -0,0 +1,212 @@
+#include <server.h>
+#include <workload.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <chrono>
+
+typedef std::chrono::steady_clock Clock;
+
+// What one connection measured.
+struct ClientResult {
+  std::vector<uint32_t> latency_us;
+  long failures {0};
+  bool ok {false};
+};
+
+static void usage(const char* prog) {
+  std::cerr << "Usage: " << prog << " [--connections N] [--pipeline N] [--entries N] [--accounts N] [--zipf S] [--binary] <address>\n"
+            << "Sends a synthetic ledger to a bank_app --listen server and reports throughput and latency.\n"
+            << "Each connection sends --entries entries and keeps up to --pipeline of them outstanding.\n";
+  exit(-1);
+}
+
+/**
+ * @brief Parses a whole-number option, or prints usage if it is not one
+ *        from min to max.
+ */
+static int parse_count(const char* prog, const char* name, const char* arg, long min, long max) {
+  char* end;
+  errno = 0;
+  long value = strtol(arg, &end, 10);
+  if (errno != 0 || end == arg || *end != '\0' || value < min || value > max) {
+    std::cerr << prog << ": " << name << " must be a number from " << min << " to " << max << ", not '" << arg << "'\n";
+    usage(prog);
+  }
+  return value;
+}
+
+/**
+ * @brief Parses a non-negative real option, or prints usage.
+ */
+static double parse_real(const char* prog, const char* name, const char* arg) {
+  char* end;
+  errno = 0;
+  double value = strtod(arg, &end);
+  if (errno != 0 || end == arg || *end != '\0' || !(value >= 0)) {
+    std::cerr << prog << ": " << name << " must be a number of at least 0, not '" << arg << "'\n";
+    usage(prog);
+  }
+  return value;
+}
+
+/**
+ * @brief Writes all of `size` bytes to a blocking socket.
+ */
+static bool send_all(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+/**
+ * @brief Runs one connection: sends its entries with at most `pipeline`
+ *        outstanding, and times each from send to reply.
+ *
+ * @param address server address
+ * @param entries entries to send; entry i has ledger id i
+ * @param pipeline most entries waiting for a reply
+ * @param binary send binary records instead of text lines
+ * @param result receives the latencies and the number of failed entries
+ */
+static void run_connection(const std::string& address, const std::vector<Ledger>& entries, int pipeline, bool binary,
+                           ClientResult& result) {
+  int fd = connect_to(address);
+  if (fd < 0) return;
+  if (binary) {
+    uint32_t magic = LEDGER_MAGIC;
+    if (!send_all(fd, reinterpret_cast<const char*>(&magic), sizeof(magic))) return;
+  }
+
+  std::vector<Clock::time_point> sent(entries.size());
+  result.latency_us.reserve(entries.size());
+  size_t next = 0, received = 0;
+  std::string out, in;
+  char buf[SERVER_READ_SIZE];
+
+  while (received < entries.size()) {
+    // Tops the window up in one write
+    out.clear();
+    size_t first = next;
+    while (next < entries.size() && next - received < (size_t)pipeline) {
+      Ledger l = entries[next];
+      l.ledgerID = next;
+      if (binary) out.append(reinterpret_cast<const char*>(&l), sizeof(l));
+      else        out += std::to_string(l.from) + " " + std::to_string(l.to) + " " + std::to_string(l.amount) + " " +
+                         std::to_string(l.mode) + "\n";
+      next++;
+    }
+    Clock::time_point now = Clock::now();
+    for (size_t i = first; i < next; ++i) sent[i] = now;
+    if (!out.empty() && !send_all(fd, out.data(), out.size())) break;
+    if (next == entries.size() && first != next) shutdown(fd, SHUT_WR);  // nothing more to send
+
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0) break;
+    in.append(buf, n);
+    now = Clock::now();
+
+    // Replies carry the ledger id, so out-of-order replies match up.
+    size_t used = 0;
+    for (;;) {
+      LedgerReply reply;
+      if (binary) {
+        if (in.size() - used < sizeof(reply)) break;
+        memcpy(&reply, in.data() + used, sizeof(reply));
+        used += sizeof(reply);
+      } else {
+        size_t eol = in.find('\n', used);
+        if (eol == std::string::npos) break;
+        if (sscanf(in.c_str() + used, "%d %d", &reply.ledgerID, &reply.result) != 2) reply = {-1, -1};
+        used = eol + 1;
+      }
+      if (reply.ledgerID < 0 || (size_t)reply.ledgerID >= entries.size()) continue;
+      auto us = std::chrono::duration_cast<std::chrono::microseconds>(now - sent[reply.ledgerID]).count();
+      result.latency_us.push_back(us);
+      if (reply.result != 0) result.failures++;
+      received++;
+    }
+    in.erase(0, used);
+  }
+
+  close(fd);
+  result.ok = received == entries.size();
+  if (!result.ok) std::cerr << "Connection closed after " << received << " of " << entries.size() << " replies\n";
+}
+
+int main(int argc, char* argv[]) {
+  WorkloadConfig workload;
+  workload.accounts = 10;          // the accounts a fresh bank starts with
+  workload.open_accounts = false;  // other connections would race the opens
+  int connections = 4, pipeline = 64;
+  bool binary = false;
+
+  static const struct option options[] = {
+    {"connections", required_argument, nullptr, 'c'},
+    {"pipeline",    required_argument, nullptr, 'p'},
+    {"entries",     required_argument, nullptr, 'n'},
+    {"accounts",    required_argument, nullptr, 'a'},
+    {"zipf",        required_argument, nullptr, 'z'},
+    {"binary",      no_argument,       nullptr, 'b'},
+    {nullptr,       0,                 nullptr,  0 },
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "c:p:n:a:z:b", options, nullptr)) != -1) {
+    switch (opt) {
+      case 'c': connections = parse_count(argv[0], "--connections", optarg, 1, INT_MAX); break;
+      case 'p': pipeline = parse_count(argv[0], "--pipeline", optarg, 1, INT_MAX); break;
+      case 'n': workload.entries = parse_count(argv[0], "--entries", optarg, 1, INT_MAX); break;
+      case 'a': workload.accounts = parse_count(argv[0], "--accounts", optarg, 1, INT_MAX); break;
+      case 'z': workload.zipf = parse_real(argv[0], "--zipf", optarg); break;
+      case 'b': binary = true; break;
+      default:  usage(argv[0]);
+    }
+  }
+  if (argc - optind != 1) usage(argv[0]);
+  std::string address = argv[optind];
+
+  // Every connection gets its own stream of the same workload
+  std::vector<std::vector<Ledger>> streams(connections);
+  for (int i = 0; i < connections; ++i) {
+    workload.seed = 377 + i;
+    streams[i] = generate_ledger(workload);
+  }
+
+  std::vector<ClientResult> results(connections);
+  std::vector<std::thread> threads;
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < connections; ++i) {
+    threads.emplace_back(run_connection, std::cref(address), std::cref(streams[i]), pipeline, binary, std::ref(results[i]));
+  }
+  for (auto& thread : threads) thread.join();
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  std::vector<uint32_t> latency;
+  long failures = 0;
+  bool ok = true;
+  for (ClientResult& r : results) {
+    latency.insert(latency.end(), r.latency_us.begin(), r.latency_us.end());
+    failures += r.failures;
+    ok = ok && r.ok;
+  }
+  if (latency.empty()) return 1;
+  std::sort(latency.begin(), latency.end());
+
+  printf("%zu entries over %d connections (pipeline %d, %s) in %.3f s\n", latency.size(), connections, pipeline,
+         binary ? "binary" : "text", seconds);
+  printf("Throughput: %.0f entries/s, %ld failed\n", latency.size() / seconds, failures);
+  printf("Latency: p50 %u us, p99 %u us, p999 %u us, max %u us\n", latency[latency.size() / 2],
+         latency[latency.size() * 99 / 100], latency[latency.size() * 999 / 1000], latency.back());
+  return ok ? 0 : 1;
+}
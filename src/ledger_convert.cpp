@@ -0,0 +1,11 @@
+#include <ledger.h>
+
+int main(int argc, char* argv[]) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " <input_ledger> <output_ledger>\n"
+              << "Converts a text ledger to binary, or a binary ledger back to text.\n";
+    exit(-1);
+  }
+
+  return convert_ledger(argv[1], argv[2]) ? 0 : 1;
+}
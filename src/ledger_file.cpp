@@ -0,0 +1,310 @@
+#include <ledger.h>
+#include <ledger_file.h>
+
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <stdio.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Maps a file read-only. On failure an error is printed and the
+ *        mapping is left invalid.
+ *
+ * @param filename file to map
+ */
+MappedFile::MappedFile(const std::string& filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    perror(filename.c_str());
+    return;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    perror(filename.c_str());
+    close(fd);
+    return;
+  }
+
+  length = st.st_size;
+  if (length > 0) {
+    void* addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      perror(filename.c_str());
+      close(fd);
+      length = 0;
+      return;
+    }
+    madvise(addr, length, MADV_SEQUENTIAL);
+    base = static_cast<const char*>(addr);
+  }
+
+  close(fd);
+  ok = true;
+}
+
+/**
+ * @brief Unmaps the file.
+ */
+MappedFile::~MappedFile() {
+  if (base != nullptr) munmap(const_cast<char*>(base), length);
+}
+
+/**
+ * @brief Splits a text ledger into roughly equal chunks. Each split point is
+ *        moved forward to just past the next newline so no line is cut in two.
+ *
+ * @param data start of the text
+ * @param size length of the text
+ * @param num_chunks number of chunks wanted
+ * @return std::vector<LedgerChunk> exactly num_chunks chunks (some may be empty)
+ */
+std::vector<LedgerChunk> split_chunks(const char* data, size_t size, int num_chunks) {
+  std::vector<LedgerChunk> chunks;
+  const char* end = data + size;
+  const char* begin = data;
+  for (int i = 1; i <= num_chunks; ++i) {
+    const char* split = i == num_chunks ? end : data + size * i / num_chunks;
+    if (split < begin) split = begin;
+    if (split < end && split > data && split[-1] != '\n') {
+      const char* newline = static_cast<const char*>(memchr(split, '\n', end - split));
+      split = newline == nullptr ? end : newline + 1;
+    }
+    chunks.push_back({begin, split});
+    begin = split;
+  }
+  return chunks;
+}
+
+/**
+ * @brief Tells whether a line holds anything besides whitespace.
+ */
+static bool is_blank(const char* begin, const char* end) {
+  for (const char* p = begin; p < end; ++p) {
+    if (*p != ' ' && *p != '\t' && *p != '\r') return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Counts the records in a chunk, one per non-blank line. Used to give
+ *        every chunk its first ledger id before any chunk is parsed.
+ *
+ * @param chunk chunk to count
+ * @return int number of records
+ */
+int count_records(const LedgerChunk& chunk) {
+  int count = 0;
+  const char* p = chunk.begin;
+  while (p < chunk.end) {
+    const char* newline = static_cast<const char*>(memchr(p, '\n', chunk.end - p));
+    const char* line_end = newline == nullptr ? chunk.end : newline;
+    if (!is_blank(p, line_end)) count++;
+    p = line_end + 1;
+  }
+  return count;
+}
+
+/**
+ * @brief Parses the next "FROM_ID TO_ID AMOUNT MODE" line with std::from_chars,
+ *        skipping blank lines. `l.ledgerID` is left untouched.
+ *
+ * @param p where to start parsing
+ * @param end end of the chunk
+ * @param l receives the parsed fields
+ * @param ok set to false if the line was malformed or its mode is unknown
+ * @return const char* start of the following line, or nullptr if no record was left
+ */
+const char* parse_record(const char* p, const char* end, Ledger& l, bool& ok) {
+  const char* line_end;
+  for (;;) {
+    if (p >= end) return nullptr;
+    const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+    line_end = newline == nullptr ? end : newline;
+    if (!is_blank(p, line_end)) break;
+    p = line_end + 1;
+  }
+
+  int* fields[] = {&l.from, &l.to, &l.amount, &l.mode};
+  ok = true;
+  for (int* field : fields) {
+    while (p < line_end && (*p == ' ' || *p == '\t')) p++;
+    auto [next, ec] = std::from_chars(p, line_end, *field);
+    if (ec != std::errc()) ok = false;
+    p = next;
+  }
+  while (p < line_end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+  if (p != line_end || !valid_mode(l.mode)) ok = false;
+
+  return line_end + 1;
+}
+
+/**
+ * @brief Tells whether a file's contents start with the binary ledger magic
+ *        number, whether or not the rest of the header is valid. Readers use
+ *        it to reject a damaged binary ledger instead of parsing it as text.
+ *
+ * @param data contents of the file
+ * @param size length of the contents
+ * @return true if the contents start with LEDGER_MAGIC
+ */
+bool ledger_magic(const char* data, size_t size) {
+  uint32_t magic = 0;
+  if (size >= sizeof(magic)) memcpy(&magic, data, sizeof(magic));
+  return magic == LEDGER_MAGIC;
+}
+
+/**
+ * @brief Checks whether a mapped file is a binary ledger of a supported
+ *        version whose size matches its record count.
+ *
+ * @param file mapped file
+ * @return const LedgerHeader* the header, or nullptr if the file is not a valid binary ledger
+ */
+const LedgerHeader* binary_header(const MappedFile& file) {
+  return binary_header(file.data(), file.size());
+}
+
+/**
+ * @brief Checks whether a file's contents are a binary ledger; see above.
+ *
+ * @param data contents of the file
+ * @param size length of the contents
+ * @return const LedgerHeader* the header, or nullptr if the contents are not a valid binary ledger
+ */
+const LedgerHeader* binary_header(const char* data, size_t size) {
+  if (size < sizeof(LedgerHeader)) return nullptr;
+  const LedgerHeader* header = reinterpret_cast<const LedgerHeader*>(data);
+  if (header->magic != LEDGER_MAGIC || header->version != LEDGER_VERSION) return nullptr;
+  // Compared by division, so a huge count cannot wrap around to the file's size
+  if (header->count > (size - sizeof(LedgerHeader)) / sizeof(Ledger)) return nullptr;
+  if (size != sizeof(LedgerHeader) + header->count * sizeof(Ledger)) return nullptr;
+  return header;
+}
+
+/**
+ * @brief Mixes one record into 64 bits. The file checksum is the sum of these,
+ *        so readers can verify disjoint ranges in parallel and add the results.
+ *
+ * @param l record to mix
+ * @return uint64_t the record's contribution to the checksum
+ */
+uint64_t record_checksum(const Ledger& l) {
+  uint64_t h = 0xCBF29CE484222325ull;
+  for (int field : {l.from, l.to, l.amount, l.mode, l.ledgerID}) {
+    h ^= (uint32_t)field;
+    h *= 0x100000001B3ull;
+  }
+  return h;
+}
+
+/**
+ * @brief Writes the records of a text ledger as a binary ledger.
+ */
+static bool write_binary(const MappedFile& text, FILE* out) {
+  std::vector<Ledger> records;
+  LedgerHeader header {LEDGER_MAGIC, LEDGER_VERSION, 0, 0};
+
+  Ledger l;
+  bool ok;
+  int ledger_id = 0;
+  const char* p = text.data();
+  const char* end = p + text.size();
+  while ((p = parse_record(p, end, l, ok)) != nullptr) {
+    l.ledgerID = ledger_id++;
+    if (!ok) {
+      std::cerr << "Skipping malformed ledger entry " << l.ledgerID << "\n";
+      continue;
+    }
+    records.push_back(l);
+    header.checksum += record_checksum(l);
+  }
+  header.count = records.size();
+
+  return fwrite(&header, sizeof(header), 1, out) == 1 &&
+         fwrite(records.data(), sizeof(Ledger), records.size(), out) == records.size();
+}
+
+/**
+ * @brief Writes the records of a binary ledger as a text ledger, after
+ *        verifying its checksum.
+ */
+static bool write_text(const MappedFile& binary, FILE* out) {
+  const LedgerHeader* header = binary_header(binary);
+  const Ledger* records = reinterpret_cast<const Ledger*>(header + 1);
+
+  uint64_t checksum = 0;
+  for (uint64_t i = 0; i < header->count; ++i) checksum += record_checksum(records[i]);
+  if (checksum != header->checksum) {
+    std::cerr << "Binary ledger checksum mismatch\n";
+    return false;
+  }
+
+  for (uint64_t i = 0; i < header->count; ++i) {
+    const Ledger& l = records[i];
+    if (fprintf(out, "%d %d %d %d\n", l.from, l.to, l.amount, l.mode) < 0) return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Expands the ledger paths given on the command line. A directory
+ *        stands for the regular files directly inside it, sorted by name,
+ *        leaving out hidden files. Other paths are kept as they are.
+ *
+ * @param paths files and directories, in the order they were given
+ * @return std::vector<std::string> the ledger files, in the order to read them
+ */
+std::vector<std::string> ledger_files(const std::vector<std::string>& paths) {
+  std::vector<std::string> files;
+  for (const std::string& path : paths) {
+    std::error_code ec;
+    if (!std::filesystem::is_directory(path, ec)) {
+      files.push_back(path);
+      continue;
+    }
+
+    std::vector<std::string> entries;
+    for (const auto& entry : std::filesystem::directory_iterator(path, ec)) {
+      if (entry.path().filename().string()[0] == '.' || !entry.is_regular_file(ec)) continue;
+      entries.push_back(entry.path().string());
+    }
+    if (ec) std::cerr << path << ": " << ec.message() << "\n";
+    std::sort(entries.begin(), entries.end());
+    files.insert(files.end(), entries.begin(), entries.end());
+  }
+  return files;
+}
+
+/**
+ * @brief Converts a text ledger to a binary one or a binary ledger back to
+ *        text, depending on the format of `in`.
+ *
+ * @param in ledger to read
+ * @param out file to write
+ * @return true on success, false on error (an error is printed)
+ */
+bool convert_ledger(const std::string& in, const std::string& out) {
+  MappedFile file {in};
+  if (!file.valid()) return false;
+  const LedgerHeader* header = binary_header(file);
+  if (header == nullptr && ledger_magic(file.data(), file.size())) {
+    std::cerr << in << ": unsupported binary ledger version or length\n";
+    return false;
+  }
+
+  FILE* output = fopen(out.c_str(), "wb");
+  if (output == nullptr) {
+    perror(out.c_str());
+    return false;
+  }
+
+  bool ok = header != nullptr ? write_text(file, output) : write_binary(file, output);
+  if (fclose(output) != 0) ok = false;
+  if (!ok) std::cerr << "Failed to convert " << in << " to " << out << "\n";
+  return ok;
+}
@@ -0,0 +1,53 @@
+#include <workload.h>
+
+#include <getopt.h>
+#include <string.h>
+
+static void usage(const char* prog) {
+  std::cerr << "Usage: " << prog << " [--entries N] [--accounts N] [--zipf S] [--mix D,W,T,B,O,C] [--locality P] [--seed N] [--no-open] [--binary] <output_ledger>\n"
+            << "Generates a synthetic ledger. --mix gives the relative weight of each mode (deposit, withdraw,\n"
+            << "transfer, balance, open, close); --locality is the chance a transfer stays near its source.\n";
+  exit(-1);
+}
+
+int main(int argc, char* argv[]) {
+  WorkloadConfig config;
+  bool binary = false;
+
+  static const struct option options[] = {
+    {"entries",  required_argument, nullptr, 'n'},
+    {"accounts", required_argument, nullptr, 'a'},
+    {"zipf",     required_argument, nullptr, 'z'},
+    {"mix",      required_argument, nullptr, 'x'},
+    {"locality", required_argument, nullptr, 'l'},
+    {"seed",     required_argument, nullptr, 's'},
+    {"no-open",  no_argument,       nullptr, 'N'},
+    {"binary",   no_argument,       nullptr, 'b'},
+    {nullptr,    0,                 nullptr,  0 },
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "n:a:z:x:l:s:Nb", options, nullptr)) != -1) {
+    switch (opt) {
+      case 'n': config.entries = atoi(optarg); break;
+      case 'a': config.accounts = atoi(optarg); break;
+      case 'z': config.zipf = atof(optarg); break;
+      case 'x': {
+        char* p = optarg;
+        for (int m = 0; m < 6; ++m) {
+          config.mix[m] = strtod(p, &p);
+          if (m < 5 && *p++ != ',') usage(argv[0]);
+        }
+        break;
+      }
+      case 'l': config.locality = atof(optarg); break;
+      case 's': config.seed = atoi(optarg); break;
+      case 'N': config.open_accounts = false; break;
+      case 'b': binary = true; break;
+      default:  usage(argv[0]);
+    }
+  }
+  if (argc - optind != 1 || config.entries < 0 || config.accounts < 1) usage(argv[0]);
+
+  return write_ledger(argv[optind], generate_ledger(config), binary) ? 0 : 1;
+}
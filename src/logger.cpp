@@ -0,0 +1,189 @@
+#include <logger.h>
+
+#include <charconv>
+#include <chrono>
+
+/**
+ * @brief Stops the sink thread after it has written every pending record.
+ */
+Logger::~Logger() {
+  if (!running.load()) return;
+  {
+    // Automatically unlocks when destroyed.
+    std::scoped_lock lock {sink_lock};
+    stopping = true;
+  }
+  wake_sink.notify_one();
+  sink_thread.join();
+}
+
+/**
+ * @brief Starts the sink thread. Called once, on the first record.
+ */
+void Logger::start() {
+  sink_thread = std::thread(&Logger::sink, this);
+  running.store(true);
+}
+
+/**
+ * @brief Queues the result of an operation for the sink, unless the current
+ *        verbosity filters it out. Only blocks if this thread's buffer is full.
+ *
+ * @param r operation result
+ */
+void Logger::record(const LogRecord& r) {
+  Verbosity v = verbosity();
+  if (v == QUIET || (v == FAILURES && r.success)) return;
+  std::call_once(started, &Logger::start, this);
+
+  Buffer& buf = buffers.local();
+  size_t head = buf.head.load(std::memory_order_relaxed);
+  while (head - buf.tail.load(std::memory_order_acquire) == LOG_BUFFER_SIZE) {
+    wake_sink.notify_one();
+    std::this_thread::yield();
+  }
+  buf.records[head & (LOG_BUFFER_SIZE - 1)] = r;
+  buf.head.store(head + 1, std::memory_order_release);
+}
+
+/**
+ * @brief Blocks until every record queued before the call has been written
+ *        to the output stream.
+ */
+void Logger::flush() {
+  if (!running.load()) return;
+
+  // Automatically unlocks when destroyed.
+  std::unique_lock<std::mutex> lock {sink_lock};
+  uint64_t ticket = ++flush_requested;
+  wake_sink.notify_one();
+  flushed.wait(lock, [&]() { return flush_done >= ticket; });
+}
+
+/**
+ * @brief Sink thread: drains and writes every buffer, then sleeps until woken
+ *        by a flush, a full buffer, or a short timeout.
+ */
+void Logger::sink() {
+  std::string text;
+  text.reserve(2 * LOG_WRITE_SIZE);
+
+  // Automatically unlocks when destroyed.
+  std::unique_lock<std::mutex> lock {sink_lock};
+  for (;;) {
+    uint64_t requested = flush_requested;
+    bool stop = stopping;
+    lock.unlock();
+
+    bool drained = drain(text);
+    if (!text.empty()) {
+      out.write(text.data(), text.size());
+      out.flush();
+      text.clear();
+    }
+
+    lock.lock();
+    flush_done = requested;
+    flushed.notify_all();
+    if (stop) return;
+    if (!drained && flush_requested == requested && !stopping) {
+      wake_sink.wait_for(lock, std::chrono::milliseconds(1));
+    }
+  }
+}
+
+/**
+ * @brief Formats every record currently queued in any buffer into `text`,
+ *        writing it out whenever it grows past LOG_WRITE_SIZE.
+ *
+ * @param text output buffer
+ * @return true if any record was drained
+ */
+bool Logger::drain(std::string& text) {
+  bool drained = false;
+  buffers.for_each([&](Buffer& buf) {
+    size_t start = buf.tail.load(std::memory_order_relaxed);
+    size_t head = buf.head.load(std::memory_order_acquire);
+    size_t tail = start;
+    for (; tail != head; ++tail) {
+      format(buf.records[tail & (LOG_BUFFER_SIZE - 1)], text);
+      if (text.size() >= LOG_WRITE_SIZE) {
+        buf.tail.store(tail + 1, std::memory_order_release);
+        out.write(text.data(), text.size());
+        text.clear();
+      }
+    }
+    if (tail != start) drained = true;
+    buf.tail.store(tail, std::memory_order_release);
+  });
+  return drained;
+}
+
+/**
+ * @brief Appends an integer to `text` without allocating.
+ */
+static void append(std::string& text, long value) {
+  char digits[24];
+  auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), value);
+  text.append(digits, end);
+}
+
+/**
+ * @brief Appends the log line for one record, e.g.
+ *  - 'Worker [worker_id] completed ledger [ledger_id]: deposit $[amount] into account [acc_id]'
+ *  - 'Worker [worker_id] failed to complete ledger [ledger_id]: deposit $[amount] into account [acc_id]'
+ *
+ * @param r record to format
+ * @param text output buffer
+ */
+void Logger::format(const LogRecord& r, std::string& text) {
+  text += "Worker ";
+  append(text, r.worker_id);
+  text += r.success ? " completed ledger " : " failed to complete ledger ";
+  append(text, r.ledger_id);
+
+  switch (r.op) {
+    case OP_DEPOSIT:
+      text += ": deposit $";
+      append(text, r.amount);
+      text += " into account ";
+      append(text, r.acc_id);
+      break;
+    case OP_WITHDRAW:
+      text += ": withdraw $";
+      append(text, r.amount);
+      text += " from account ";
+      append(text, r.acc_id);
+      break;
+    case OP_TRANSFER:
+      text += ": transfer $";
+      append(text, r.amount);
+      text += " from account ";
+      append(text, r.acc_id);
+      text += " to account ";
+      append(text, r.dest_id);
+      break;
+    case OP_BALANCE:
+      if (r.success) {
+        text += ": balance of $";
+        append(text, r.amount);
+        text += " in account ";
+      } else {
+        text += ": balance of account ";
+      }
+      append(text, r.acc_id);
+      text += ".";
+      break;
+    case OP_OPEN:
+      text += ": open account ";
+      append(text, r.acc_id);
+      text += ".";
+      break;
+    case OP_CLOSE:
+      text += ": close account ";
+      append(text, r.acc_id);
+      text += ".";
+      break;
+  }
+  text += "\n";
+}
@@ -1,12 +1,110 @@
 #include <ledger.h>
+#include <server.h>
+#include <shard.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdlib.h>
+
+#define MAX_THREADS 1024     // most workers, readers or shards one run may ask for
+#define MAX_QUEUE_SIZE (1 << 24)
+
+static void usage(const char* prog) {
+  std::cerr << "Usage: " << prog << " [--queue-size N] [--verbosity 0|1|2] [--quiet] [--stats] [--report-ms N] [--deterministic] [--batch-size N] [--wal FILE] [--checkpoint FILE] [--save-checkpoint FILE] [--trace-file FILE] [--mmap] [--readers N] [--steal] [--partition] [--pin] [--fuse] [--follow] [--shards N] <num_of_threads> <leader_file|dir>...\n"
+            << "       " << prog << " [options] --listen ADDR <num_of_threads>\n";
+  exit(-1);
+}
+
+/**
+ * @brief Parses a whole-number option, or prints the usage and exits if it is
+ *        not a number in [min, max].
+ *
+ * @param prog program name for the usage message
+ * @param name option name for the error message
+ * @param arg text to parse
+ * @param min smallest value allowed
+ * @param max largest value allowed
+ * @return int the value
+ */
+static int parse_count(const char* prog, const char* name, const char* arg, long min, long max) {
+  char* end;
+  errno = 0;
+  long value = strtol(arg, &end, 10);
+  if (errno != 0 || end == arg || *end != '\0' || value < min || value > max) {
+    std::cerr << prog << ": " << name << " must be a number from " << min << " to " << max << ", not '" << arg << "'\n";
+    usage(prog);
+  }
+  return value;
+}
 
 int main(int argc, char* argv[]) {
-  if (argc != 3) {
-    std::cerr << "Usage: " << argv[0] << " <num_of_threads> <leader_file>\n";
-    exit(-1);
+  BankConfig config;
+  std::string listen;
+
+  static const struct option options[] = {
+    {"queue-size", required_argument, nullptr, 'q'},
+    {"verbosity",  required_argument, nullptr, 'v'},
+    {"quiet",      no_argument,       nullptr, 'Q'},
+    {"stats",      no_argument,       nullptr, 's'},
+    {"report-ms",  required_argument, nullptr, 'r'},
+    {"deterministic", no_argument,    nullptr, 'd'},
+    {"batch-size", required_argument, nullptr, 'b'},
+    {"wal",        required_argument, nullptr, 'w'},
+    {"checkpoint", required_argument, nullptr, 'c'},
+    {"save-checkpoint", required_argument, nullptr, 'C'},
+    {"trace-file", required_argument, nullptr, 't'},
+    {"mmap",       no_argument,       nullptr, 'm'},
+    {"listen",     required_argument, nullptr, 'l'},
+    {"readers",    required_argument, nullptr, 'R'},
+    {"steal",      no_argument,       nullptr, 'S'},
+    {"pin",        no_argument,       nullptr, 'p'},
+    {"partition",  no_argument,       nullptr, 'o'},
+    {"shards",     required_argument, nullptr, 'P'},
+    {"fuse",       no_argument,       nullptr, 'F'},
+    {"follow",     no_argument,       nullptr, 'f'},
+    {nullptr,      0,                 nullptr,  0 },
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "q:v:Qsr:db:w:c:C:t:ml:R:SpoP:Ff", options, nullptr)) != -1) {
+    switch (opt) {
+      case 'q': config.queue_size = parse_count(argv[0], "--queue-size", optarg, 1, MAX_QUEUE_SIZE); break;
+      case 'v': config.verbosity = (Verbosity)parse_count(argv[0], "--verbosity", optarg, QUIET, ALL); break;
+      case 'Q': config.verbosity = QUIET; break;
+      case 's': config.print_stats = true; break;
+      case 'r': config.report_ms = parse_count(argv[0], "--report-ms", optarg, 0, INT_MAX); break;
+      case 'd': config.deterministic = true; break;
+      case 'b': config.batch_size = parse_count(argv[0], "--batch-size", optarg, 1, INT_MAX); break;
+      case 'w': config.wal_path = optarg; break;
+      case 'c': config.checkpoint_path = optarg; break;
+      case 'C': config.save_checkpoint = optarg; break;
+      case 't': config.trace_path = optarg; break;
+      case 'm': config.mmap = true; break;
+      case 'l': listen = optarg; break;
+      case 'R': config.readers = parse_count(argv[0], "--readers", optarg, 1, MAX_THREADS); break;
+      case 'S': config.steal = true; break;
+      case 'p': config.pin = true; break;
+      case 'o': config.partition = true; break;
+      case 'P': config.shards = parse_count(argv[0], "--shards", optarg, 1, MAX_THREADS); break;
+      case 'F': config.fuse = true; break;
+      case 'f': config.follow = true; break;
+      default: usage(argv[0]);
+    }
+  }
+
+  if (!listen.empty()) {
+    if (argc - optind != 1) usage(argv[0]);
+    ServeBank(parse_count(argv[0], "<num_of_threads>", argv[optind], 1, MAX_THREADS), listen, config);
+    return 0;
   }
+  if (argc - optind < 2) usage(argv[0]);
+  int num_workers = parse_count(argv[0], "<num_of_threads>", argv[optind], 1, MAX_THREADS);
 
-  InitBank(atoi(argv[1]), argv[2]);
+  // Ledger files and directories, read one after another
+  std::vector<std::string> paths(argv + optind + 1, argv + argc);
+  if (config.shards > 0) ShardBank(num_workers, paths, config);
+  else                   InitBank(num_workers, paths, config);
 
   return 0;
 }
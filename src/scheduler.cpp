@@ -0,0 +1,187 @@
+#include <scheduler.h>
+#include <spin.h>
+
+/**
+ * @brief Starts a pool of `num_workers` threads that wait for batches.
+ *
+ * @param bank bank to execute entries on
+ * @param num_workers number of worker threads
+ */
+Scheduler::Scheduler(Bank& bank, int num_workers) : bank(bank) {
+  for (int i = 0; i < num_workers; ++i) threads.emplace_back(&Scheduler::work, this, i);
+}
+
+/**
+ * @brief Stops and joins the worker pool.
+ */
+Scheduler::~Scheduler() {
+  {
+    // Automatically unlocks when destroyed.
+    std::scoped_lock lock {batch_lock};
+    stopping = true;
+  }
+  batch_start.notify_all();
+  for (auto& thread : threads) thread.join();
+}
+
+/**
+ * @brief Runs one batch of entries, given in ledger order, and returns once
+ *        all of them have been applied. The outcome is the same as applying
+ *        them one by one in order.
+ *
+ * @param batch entries to run
+ */
+void Scheduler::execute(const std::vector<Ledger>& batch) {
+  build(batch);
+  if (remaining.load() == 0) return;
+
+  // Automatically unlocks when destroyed.
+  std::unique_lock<std::mutex> lock {batch_lock};
+  entries = &batch;
+  generation++;
+  batch_start.notify_all();
+  batch_done.wait(lock, [&]() { return remaining.load() == 0 && idle == (int)threads.size(); });
+}
+
+/**
+ * @brief Records that entry `after` may only run once entry `before` is done.
+ */
+void Scheduler::depend(int before, int after) {
+  successors[before].push_back(after);
+  deps[after].fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Adds one account access of `entry` to the dependency graph.
+ *
+ * @param entry index of the entry in the batch
+ * @param acc_id account the entry touches
+ * @param write whether the entry may change the account
+ */
+void Scheduler::use(int entry, int acc_id, bool write) {
+  AccountUse& u = uses[acc_id];
+  if (!write) {
+    if (u.last_write >= 0) depend(u.last_write, entry);
+    u.reads.push_back(entry);
+    return;
+  }
+
+  // A write waits for the reads since the last write (which themselves
+  // waited for that write), or for the last write directly.
+  if (u.reads.empty()) {
+    if (u.last_write >= 0) depend(u.last_write, entry);
+  } else {
+    for (int read : u.reads) depend(read, entry);
+    u.reads.clear();
+  }
+  u.last_write = entry;
+}
+
+/**
+ * @brief Builds the dependency graph of a batch and queues the entries that
+ *        can run right away.
+ *
+ * @param batch entries in ledger order
+ */
+void Scheduler::build(const std::vector<Ledger>& batch) {
+  int n = batch.size();
+  deps = std::make_unique<std::atomic<int>[]>(n);
+  if ((int)successors.size() < n) successors.resize(n);
+  for (int i = 0; i < n; ++i) successors[i].clear();
+  uses.clear();
+
+  for (int i = 0; i < n; ++i) {
+    const Ledger& l = batch[i];
+    switch (l.mode) {
+      case 0: case 1: case 4: case 5:
+        use(i, l.from, true);
+        break;
+      case 2:
+        use(i, l.from, true);
+        if (l.to != l.from) use(i, l.to, true);
+        break;
+      case 3:
+        use(i, l.from, false);
+        break;
+    }
+  }
+
+  if (ready == nullptr || ready->capacity() < (size_t)n) ready = std::make_unique<RingBuffer<int>>(n);
+  for (int i = 0; i < n; ++i) {
+    if (deps[i].load(std::memory_order_relaxed) == 0) ready->try_push(i);
+  }
+  remaining.store(n);
+}
+
+/**
+ * @brief Worker loop: waits for a batch, then runs ready entries and releases
+ *        their successors until the batch is finished.
+ *
+ * @param worker_id id of the worker
+ */
+void Scheduler::work(int worker_id) {
+  uint64_t seen = 0;
+
+  // Automatically unlocks when destroyed.
+  std::unique_lock<std::mutex> lock {batch_lock};
+  for (;;) {
+    idle++;
+    batch_done.notify_all();
+    batch_start.wait(lock, [&]() { return stopping || generation != seen; });
+    if (stopping) return;
+    seen = generation;
+    idle--;
+    lock.unlock();
+
+    int spins = 0;
+    int i;
+    while (remaining.load(std::memory_order_acquire) > 0) {
+      if (!ready->try_pop(i)) {
+        spin_wait(spins);
+        continue;
+      }
+      spins = 0;
+
+      execute_entry(bank, worker_id, (*entries)[i]);
+      for (int next : successors[i]) {
+        if (deps[next].fetch_sub(1, std::memory_order_acq_rel) == 1) ready->try_push(next);
+      }
+      remaining.fetch_sub(1, std::memory_order_release);
+    }
+
+    lock.lock();
+  }
+}
+
+/**
+ * @brief Reads entries from the ledger buffer in the order they were pushed,
+ *        groups them into batches of `batch_size`, and runs each batch on a
+ *        Scheduler. With a single reader, push order is ledger order.
+ *
+ * @param bank bank to execute entries on
+ * @param num_workers number of worker threads
+ * @param batch_size entries per batch
+ * @param ledger buffer ledger
+ * @param eager also end a batch where the buffer runs dry, instead of waiting
+ *        for it to fill (for ledgers that grow slowly, see --follow)
+ */
+void sequence(Bank& bank, int num_workers, size_t batch_size, LedgerQueue& ledger, bool eager) {
+  Scheduler scheduler {bank, num_workers};
+  std::vector<Ledger> batch;
+  batch.reserve(batch_size);
+
+  Ledger l;
+  while (ledger.pop(l)) {
+    TRACE_QUEUED(l.mode);
+    batch.push_back(l);
+    while (eager && batch.size() < batch_size && ledger.try_pop(l)) {
+      TRACE_QUEUED(l.mode);
+      batch.push_back(l);
+    }
+    if (batch.size() == batch_size || eager) {
+      scheduler.execute(batch);
+      batch.clear();
+    }
+  }
+  if (!batch.empty()) scheduler.execute(batch);
+}
@@ -0,0 +1,525 @@
+#include <server.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/**
+ * @brief Splits an address into a Unix socket path or a TCP host and port.
+ *        Addresses containing '/' are Unix socket paths; anything else is
+ *        "[host]:port", where an empty host means every interface.
+ *
+ * @return sockaddr for the address, or length 0 if it cannot be resolved
+ */
+static socklen_t resolve(const std::string& address, sockaddr_storage& addr) {
+  memset(&addr, 0, sizeof(addr));
+  if (address.find('/') != std::string::npos) {
+    sockaddr_un* un = reinterpret_cast<sockaddr_un*>(&addr);
+    if (address.size() >= sizeof(un->sun_path)) return 0;
+    un->sun_family = AF_UNIX;
+    strcpy(un->sun_path, address.c_str());
+    return sizeof(sockaddr_un);
+  }
+
+  size_t colon = address.rfind(':');
+  if (colon == std::string::npos) return 0;
+  std::string host = address.substr(0, colon), port = address.substr(colon + 1);
+  addrinfo hints {}, *result = nullptr;
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result) != 0) return 0;
+  socklen_t len = result->ai_addrlen;
+  memcpy(&addr, result->ai_addr, len);
+  freeaddrinfo(result);
+  return len;
+}
+
+/**
+ * @brief Opens a non-blocking listening socket. A stale Unix socket file is
+ *        replaced.
+ *
+ * @param address Unix socket path or "[host]:port"
+ * @return int the socket, or -1 on error (an error is printed)
+ */
+int listen_on(const std::string& address) {
+  sockaddr_storage addr;
+  socklen_t len = resolve(address, addr);
+  if (len == 0) {
+    std::cerr << address << ": bad address\n";
+    return -1;
+  }
+
+  int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror(address.c_str());
+    return -1;
+  }
+  int one = 1;
+  if (addr.ss_family == AF_UNIX) unlink(address.c_str());
+  else setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  if (bind(fd, reinterpret_cast<sockaddr*>(&addr), len) < 0 || listen(fd, SOMAXCONN) < 0) {
+    perror(address.c_str());
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * @brief Opens a blocking connection to a server.
+ *
+ * @param address Unix socket path or "host:port"
+ * @return int the socket, or -1 on error (an error is printed)
+ */
+int connect_to(const std::string& address) {
+  sockaddr_storage addr;
+  socklen_t len = resolve(address, addr);
+  if (len == 0) {
+    std::cerr << address << ": bad address\n";
+    return -1;
+  }
+
+  int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), len) < 0) {
+    perror(address.c_str());
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+  int one = 1;
+  if (addr.ss_family != AF_UNIX) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+/**
+ * @brief Listens on `address` and sets up the event loop. On failure an
+ *        error is printed and the server is left invalid.
+ *
+ * @param engine engine that executes the entries
+ * @param address Unix socket path or "[host]:port"
+ * @param first_id ledger id of the first entry the bank gets
+ * @param wal the bank's write-ahead log, if it has one
+ */
+LedgerServer::LedgerServer(BankEngine& engine, const std::string& address, int first_id, WriteAheadLog* wal)
+    : engine(engine), wal(wal), next_id(first_id) {
+  listen_fd = listen_on(address);
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (!valid()) return;
+
+  epoll_event ev {};
+  ev.events = EPOLLIN;
+  ev.data.fd = listen_fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+  ev.data.fd = wake_fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+  submitter = std::thread(&LedgerServer::submit_all, this);
+}
+
+/**
+ * @brief Closes every socket. Batches still running keep their connection
+ *        alive until they finish; their replies are dropped unless drain()
+ *        was called once they were done.
+ */
+LedgerServer::~LedgerServer() {
+  stop_submitter();
+  for (auto& [fd, conn] : connections) {
+    close(fd);
+    conn->fd = -1;
+  }
+  if (listen_fd >= 0) close(listen_fd);
+  if (epoll_fd >= 0) close(epoll_fd);
+  if (wake_fd >= 0) close(wake_fd);
+}
+
+/**
+ * @brief Makes run() return. Safe to call from any thread.
+ */
+void LedgerServer::stop() {
+  stopping = true;
+  uint64_t one = 1;
+  if (write(wake_fd, &one, sizeof(one)) < 0) perror("stop");
+}
+
+/**
+ * @brief Submitter loop: hands parsed batches to the engine, waiting for
+ *        room in its queue when it is full, until stop_submitter(). The
+ *        callback makes the batch durable before queueing its replies.
+ */
+void LedgerServer::submit_all() {
+  for (;;) {
+    Submission next;
+    {
+      // Automatically unlocks when destroyed.
+      std::unique_lock<std::mutex> lock {submit_lock};
+      has_submission.wait(lock, [&]() { return !submissions.empty() || !submitting; });
+      if (submissions.empty()) return;
+      next = std::move(submissions.front());
+      submissions.pop_front();
+    }
+    engine.submit(next.entries, [this, conn = next.conn, ids = std::move(next.ids)](std::vector<int>&& results) {
+      // Concurrent batches share one group commit.
+      if (wal != nullptr) wal->sync();
+      reply(conn, ids, results);
+    });
+  }
+}
+
+/**
+ * @brief Hands the batches still waiting to the engine and joins the
+ *        submitter.
+ */
+void LedgerServer::stop_submitter() {
+  {
+    // Automatically unlocks when destroyed.
+    std::scoped_lock lock {submit_lock};
+    submitting = false;
+  }
+  has_submission.notify_one();
+  if (submitter.joinable()) submitter.join();
+}
+
+/**
+ * @brief Event loop: accepts, reads, parses and flushes replies until stop().
+ *        Every parsed batch has been handed to the engine when it returns.
+ */
+void LedgerServer::run() {
+  epoll_event events[SERVER_MAX_EVENTS];
+  while (!stopping) {
+    int n = epoll_wait(epoll_fd, events, SERVER_MAX_EVENTS, -1);
+    if (n < 0 && errno != EINTR) {
+      perror("epoll_wait");
+      return;
+    }
+
+    for (int i = 0; i < n; ++i) {
+      int fd = events[i].data.fd;
+      if (fd == listen_fd) {
+        accept_all();
+      } else if (fd == wake_fd) {
+        uint64_t count;
+        if (read(wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("eventfd");
+      } else {
+        auto it = connections.find(fd);
+        if (it == connections.end()) continue;
+        std::shared_ptr<Connection> conn = it->second;
+        if (events[i].events & EPOLLOUT) flush(conn);
+        if (!conn->eof && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) read_from(conn);
+      }
+    }
+
+    // Replies queued by the workers since the last round
+    std::vector<std::shared_ptr<Connection>> ready;
+    {
+      // Automatically unlocks when destroyed.
+      std::scoped_lock lock {flush_lock};
+      ready.swap(to_flush);
+    }
+    for (auto& conn : ready) flush(conn);
+  }
+  stop_submitter();
+}
+
+/**
+ * @brief Writes out the replies left once run() has returned. Call it after
+ *        the engine has finished every batch (BankEngine::shutdown()), so no
+ *        reply is still to come. Reading and accepting stop, and every
+ *        connection is closed once its replies are written, or once its
+ *        client has taken none of them for SERVER_DRAIN_MS.
+ */
+void LedgerServer::drain() {
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, listen_fd, nullptr);
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, wake_fd, nullptr);
+  std::vector<std::shared_ptr<Connection>> open;
+  for (auto& [fd, conn] : connections) open.push_back(conn);
+  for (auto& conn : open) {
+    conn->eof = true;
+    watch(conn);
+    flush(conn);
+  }
+  {
+    // Automatically unlocks when destroyed.
+    std::scoped_lock lock {flush_lock};
+    to_flush.clear();
+  }
+
+  epoll_event events[SERVER_MAX_EVENTS];
+  while (!connections.empty()) {
+    int n = epoll_wait(epoll_fd, events, SERVER_MAX_EVENTS, SERVER_DRAIN_MS);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    for (int i = 0; i < n; ++i) {
+      auto it = connections.find(events[i].data.fd);
+      if (it == connections.end()) continue;
+      std::shared_ptr<Connection> conn = it->second;
+      flush(conn);
+    }
+  }
+}
+
+/**
+ * @brief Accepts every pending connection.
+ */
+void LedgerServer::accept_all() {
+  for (;;) {
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+      return;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    auto conn = std::make_shared<Connection>();
+    conn->fd = fd;
+    connections[fd] = conn;
+    watch(conn);
+  }
+}
+
+/**
+ * @brief Reads everything available from a connection and submits the
+ *        complete records as one batch.
+ */
+void LedgerServer::read_from(const std::shared_ptr<Connection>& conn) {
+  for (;;) {
+    size_t size = conn->in.size();
+    conn->in.resize(size + SERVER_READ_SIZE);
+    ssize_t n = read(conn->fd, conn->in.data() + size, SERVER_READ_SIZE);
+    conn->in.resize(size + std::max<ssize_t>(n, 0));
+    if (n > 0) continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    if (n < 0 && errno == EINTR) continue;
+
+    // End of input (or an error): answer what was sent, then close.
+    conn->eof = true;
+    watch(conn);
+    break;
+  }
+
+  parse(conn);
+  if (conn->eof) flush(conn);
+}
+
+/**
+ * @brief Turns the complete records at the front of the input buffer into
+ *        an engine batch. A trailing partial record stays for the next read.
+ */
+void LedgerServer::parse(const std::shared_ptr<Connection>& conn) {
+  std::vector<char>& in = conn->in;
+  size_t used = 0;
+  if (!conn->detected) {
+    if (in.size() < sizeof(uint32_t)) return;
+    uint32_t magic;
+    memcpy(&magic, in.data(), sizeof(magic));
+    conn->binary = magic == LEDGER_MAGIC;
+    conn->detected = true;
+    if (conn->binary) used = sizeof(magic);
+  }
+
+  std::vector<Ledger> batch;
+  std::vector<int> ids;  // what the client knows each entry by
+  if (conn->binary) {
+    size_t count = (in.size() - used) / sizeof(Ledger);
+    batch.resize(count);
+    memcpy(batch.data(), in.data() + used, count * sizeof(Ledger));
+    used += count * sizeof(Ledger);
+    for (Ledger& l : batch) {
+      if (!valid_mode(l.mode)) l.mode = -1;  // fails in execute_entry
+      // The client's id only goes back in the reply.
+      ids.push_back(l.ledgerID);
+      l.ledgerID = next_id++;
+    }
+  } else {
+    // Only whole lines; an unterminated last line counts once the client is done.
+    const char* begin = in.data() + used;
+    const char* end = in.data() + in.size();
+    if (!conn->eof) {
+      while (end > begin && end[-1] != '\n') end--;
+    }
+    Ledger l;
+    bool ok;
+    for (const char* p = begin; (p = parse_record(p, end, l, ok)) != nullptr; ) {
+      if (!ok) l.mode = -1;  // fails in execute_entry
+      ids.push_back(conn->next_id++);
+      l.ledgerID = next_id++;
+      batch.push_back(l);
+    }
+    used = end - in.data();
+  }
+  in.erase(in.begin(), in.begin() + used);
+  if (batch.empty()) return;
+
+  if (++conn->pending >= SERVER_MAX_PENDING) {
+    conn->throttled = true;
+    watch(conn);
+  }
+  {
+    // Automatically unlocks when destroyed.
+    std::scoped_lock lock {submit_lock};
+    submissions.push_back({conn, std::move(batch), std::move(ids)});
+  }
+  has_submission.notify_one();
+}
+
+/**
+ * @brief Runs on the worker that finishes a batch: formats the batch's
+ *        replies, appends them to the connection's output and wakes the loop.
+ */
+void LedgerServer::reply(const std::shared_ptr<Connection>& conn, const std::vector<int>& ids, const std::vector<int>& results) {
+  std::string out;
+  if (conn->binary) {
+    out.resize(ids.size() * sizeof(LedgerReply));
+    LedgerReply* replies = reinterpret_cast<LedgerReply*>(out.data());
+    for (size_t i = 0; i < ids.size(); ++i) replies[i] = {ids[i], results[i]};
+  } else {
+    for (size_t i = 0; i < ids.size(); ++i) out += std::to_string(ids[i]) + " " + std::to_string(results[i]) + "\n";
+  }
+
+  bool wake = false;
+  {
+    // Automatically unlocks when destroyed.
+    std::scoped_lock lock {conn->out_lock};
+    conn->out += out;
+    conn->pending--;
+    if (!conn->queued) {
+      conn->queued = true;
+      wake = true;
+    }
+  }
+  if (wake) {
+    {
+      // Automatically unlocks when destroyed.
+      std::scoped_lock lock {flush_lock};
+      to_flush.push_back(conn);
+    }
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) perror("eventfd");
+  }
+}
+
+/**
+ * @brief Writes as much queued output as the socket takes, asking for
+ *        EPOLLOUT if some is left. Closes a finished connection whose
+ *        client is done sending.
+ */
+void LedgerServer::flush(const std::shared_ptr<Connection>& conn) {
+  if (conn->fd < 0) return;
+  bool done;
+  {
+    // Automatically unlocks when destroyed.
+    std::scoped_lock lock {conn->out_lock};
+    conn->queued = false;
+    size_t written = 0;
+    bool was_eof = conn->eof;
+    while (written < conn->out.size()) {
+      ssize_t n = send(conn->fd, conn->out.data() + written, conn->out.size() - written, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR) continue;
+      if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        // The client is gone; drop its replies.
+        conn->eof = true;
+        written = conn->out.size();
+      }
+      if (n <= 0) break;
+      written += n;
+    }
+    conn->out.erase(0, written);
+
+    bool throttled = conn->throttled && conn->pending >= SERVER_MAX_PENDING;
+    if (conn->want_write != !conn->out.empty() || conn->eof != was_eof || conn->throttled != throttled) {
+      conn->want_write = !conn->out.empty();
+      conn->throttled = throttled;
+      watch(conn);
+    }
+    done = conn->eof && conn->out.empty() && conn->pending == 0;
+  }
+  if (done) close_connection(conn);
+}
+
+/**
+ * @brief Points epoll at what the connection still needs: input until the
+ *        client is done (unless it is throttled), output while replies are
+ *        left over. A connection
+ *        that needs neither leaves the epoll set, so a hung-up client does
+ *        not keep waking the loop while its batches finish.
+ */
+void LedgerServer::watch(const std::shared_ptr<Connection>& conn) {
+  epoll_event ev {};
+  ev.events = (conn->eof || conn->throttled ? 0u : EPOLLIN | EPOLLRDHUP) | (conn->want_write ? EPOLLOUT : 0u);
+  ev.data.fd = conn->fd;
+  if (ev.events == 0) {
+    if (conn->watched) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, nullptr);
+    conn->watched = false;
+  } else {
+    epoll_ctl(epoll_fd, conn->watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, conn->fd, &ev);
+    conn->watched = true;
+  }
+}
+
+/**
+ * @brief Forgets a connection and closes its socket.
+ */
+void LedgerServer::close_connection(const std::shared_ptr<Connection>& conn) {
+  connections.erase(conn->fd);
+  close(conn->fd);
+  conn->fd = -1;
+}
+
+/**
+ * @brief Runs the bank as a server on `address` until SIGINT or SIGTERM,
+ *        then prints the accounts like InitBank.
+ *
+ * @param num_workers number of execution workers
+ * @param address Unix socket path or "[host]:port"
+ * @param config runtime options
+ */
+void ServeBank(int num_workers, std::string address, const BankConfig& config) {
+  // SIGINT/SIGTERM are taken by the waiter below; threads started from here on inherit the mask.
+  sigset_t stop_signals, old_mask;
+  sigemptyset(&stop_signals);
+  sigaddset(&stop_signals, SIGINT);
+  sigaddset(&stop_signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+
+  {
+#ifdef BANK_TRACE
+    TraceDumper dumper {config.trace_path};
+#endif
+    Bank bank = Bank(config.checkpoint_path.empty() ? 10 : 0);
+    std::unique_ptr<WriteAheadLog> wal;
+    if (prepare_bank(bank, config, wal)) {
+      BankEngine engine {bank, num_workers, config.queue_size};
+      LedgerServer server {engine, address, bank.next_ledger_id(), wal.get()};
+      if (server.valid()) {
+        std::thread waiter([&]() {
+          int sig;
+          sigwait(&stop_signals, &sig);
+          server.stop();
+        });
+        std::cerr << "Listening on " << address << "\n";
+        server.run();
+        waiter.join();
+        engine.shutdown();
+        server.drain();
+
+        if (wal) wal->sync();
+        bank.print_accounts();
+        if (config.print_stats) bank.stats().print(std::cout);
+        if (!config.save_checkpoint.empty()) bank.checkpoint(config.save_checkpoint);
+      }
+    }
+  }
+
+  pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+}
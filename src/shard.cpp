@@ -0,0 +1,587 @@
+#include <shard.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <deque>
+#include <new>
+
+#define SHARD_TABLE_SLOTS ((size_t)1 << SHARD_TABLE_BITS)
+#define SHARD_TABLE_LIMIT (SHARD_TABLE_SLOTS / 4 * 3)  // accounts a table takes before opens fail
+
+static size_t align_up(size_t n, size_t a) {
+  return (n + a - 1) / a * a;
+}
+
+static size_t slot_of(int acc_id) {
+  return ((uint32_t)acc_id * 0x9E3779B1u) >> (32 - SHARD_TABLE_BITS);
+}
+
+/**
+ * @brief Reserves the shared mapping for `num_shards` shard processes: the
+ *        region header, one ShardState each and one account table each.
+ *        Table memory is only committed as accounts are added. On failure an
+ *        error is printed and the bank is left invalid.
+ *
+ * @param num_shards shard processes to run, 1 ... MAX_SHARDS
+ * @param verbosity which operations the shards log
+ */
+ShardedBank::ShardedBank(int num_shards, Verbosity verbosity) : num_shards(num_shards), verbosity(verbosity) {
+  if (num_shards < 1 || num_shards > MAX_SHARDS) {
+    std::cerr << "Shard count must be between 1 and " << MAX_SHARDS << "\n";
+    return;
+  }
+  size_t states_at = align_up(sizeof(ShardRegion), alignof(ShardState));
+  size_t tables_at = align_up(states_at + num_shards * sizeof(ShardState), 4096);
+  size_t slots_at = tables_at + num_shards * SHARD_TABLE_SLOTS * sizeof(ShardAccount);
+  size_t bytes = slots_at + num_shards * SHARD_TABLE_LIMIT * sizeof(uint32_t);
+  void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED) {
+    perror("ShardedBank");
+    return;
+  }
+  mapped = bytes;
+  char* base = static_cast<char*>(p);
+  region = new (base) ShardRegion;
+  states = reinterpret_cast<ShardState*>(base + states_at);
+  // Zero pages are unused account slots, so the tables need no constructors.
+  tables = reinterpret_cast<ShardAccount*>(base + tables_at);
+  used_slots = reinterpret_cast<uint32_t*>(base + slots_at);
+  for (int s = 0; s < num_shards; ++s) {
+    new (&states[s]) ShardState;
+    sem_init(&states[s].wakeup, 1, 0);
+  }
+  region->draining.store(num_shards);
+}
+
+/**
+ * @brief Waits for running shards and releases the mapping.
+ */
+ShardedBank::~ShardedBank() {
+  if (region == nullptr) return;
+  if (monitor_thread.joinable()) {
+    close();
+    wait();
+  }
+  for (int s = 0; s < num_shards; ++s) {
+    sem_destroy(&states[s].wakeup);
+    states[s].~ShardState();
+  }
+  region->~ShardRegion();
+  munmap(region, mapped);
+}
+
+/**
+ * @brief Looks an account up in a shard's table.
+ *
+ * @return the account, or nullptr if it does not exist
+ */
+ShardAccount* ShardedBank::find(int shard, int acc_id) const {
+  ShardAccount* t = table(shard);
+  for (size_t i = slot_of(acc_id);; i = (i + 1) & (SHARD_TABLE_SLOTS - 1)) {
+    if (!t[i].used) return nullptr;
+    if (t[i].id == acc_id) return &t[i];
+  }
+}
+
+/**
+ * @brief Adds a closed account with no money to a shard's table. Only the
+ *        shard's process (or the parent before start()) may call this.
+ *
+ * @return the new account, or nullptr if it already exists or the table is full
+ */
+ShardAccount* ShardedBank::insert(int shard, int acc_id) {
+  ShardState& st = state(shard);
+  if (st.accounts >= SHARD_TABLE_LIMIT) return nullptr;
+  ShardAccount* t = table(shard);
+  size_t i = slot_of(acc_id);
+  for (; t[i].used; i = (i + 1) & (SHARD_TABLE_SLOTS - 1)) {
+    if (t[i].id == acc_id) return nullptr;
+  }
+  t[i] = {acc_id, true, false, 0};
+  used_slots[shard * SHARD_TABLE_LIMIT + st.accounts++] = i;
+  return &t[i];
+}
+
+/**
+ * @brief Opens an account with a starting balance. Only valid before start().
+ *
+ * @return false if the account already exists or its shard's table is full
+ */
+bool ShardedBank::seed(int acc_id, long balance) {
+  ShardAccount* acc = insert(owner(acc_id), acc_id);
+  if (acc == nullptr) return false;
+  acc->open = true;
+  acc->balance = balance;
+  return true;
+}
+
+/**
+ * @brief Wakes a shard if it is parked. The fence pairs with the one the
+ *        shard issues after setting `sleeping`, as in RingBuffer::wake.
+ */
+void ShardedBank::notify(int shard) const {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (state(shard).sleeping.load(std::memory_order_relaxed)) sem_post(&state(shard).wakeup);
+}
+
+/**
+ * @brief Wakes every shard so it rechecks whether it is done. Posts even to
+ *        shards that are not parked yet; a spare post only costs one extra
+ *        round of the shard's loop.
+ */
+void ShardedBank::wake_all() const {
+  for (int s = 0; s < num_shards; ++s) sem_post(&state(s).wakeup);
+}
+
+/**
+ * @brief The loop of one shard process. Runs entries from its input ring and
+ *        messages from its peer ring until the whole bank is done.
+ */
+class ShardProcess {
+  public:
+    ShardProcess(ShardedBank& bank, int shard)
+        : bank(bank), region(*bank.region), shard(shard), self(bank.state(shard)) {
+      logger.set_verbosity(bank.verbosity);
+    }
+
+    void run();
+
+  private:
+    void execute(const Ledger& l);
+    void transfer(const Ledger& l);
+    void handle(const ShardMsg& m);
+    void resolve(const ShardMsg& m, bool committed);
+    void send(int to, const ShardMsg& m);
+    bool flush();
+    void park();
+    bool finished() const;
+
+    void succeed(const LogRecord& r) {
+      OpCounters::bump(self.counters.succ[r.op]);
+      logger.record(r);
+    }
+    void fail(const LogRecord& r, FailReason reason) {
+      OpCounters::bump(self.counters.fail[r.op]);
+      OpCounters::bump(self.counters.reasons[reason]);
+      logger.record(r);
+    }
+
+    ShardedBank& bank;
+    ShardRegion& region;
+    int shard;
+    ShardState& self;
+    Logger logger;
+    std::deque<std::pair<int, ShardMsg>> outbox;  // messages whose peer ring was full
+};
+
+void ShardProcess::run() {
+  Ledger l;
+  ShardMsg m;
+  for (;;) {
+    bool progress = flush();
+    // Replies first: they finish transfers other shards are waiting on.
+    while (self.peers.try_pop(m)) {
+      handle(m);
+      progress = true;
+    }
+    for (int i = 0; i < SHARD_BATCH && self.input.try_pop(l); ++i) {
+      execute(l);
+      progress = true;
+    }
+    if (progress) continue;
+
+    // Nothing can be pushed after input_closed, so an empty ring then stays empty.
+    if (!self.input_done.load() && region.input_closed.load() && self.input.empty()) {
+      if (!self.input_done.exchange(true) && --region.draining == 0) bank.wake_all();
+    } else if (finished()) {
+      break;
+    } else {
+      park();
+    }
+  }
+  logger.flush();
+}
+
+/**
+ * @brief Whether this shard may exit: every shard has finished its input and
+ *        no transfer is waiting for a reply (unless a dead shard owes one).
+ */
+bool ShardProcess::finished() const {
+  return self.input_done.load() && region.draining.load() == 0 &&
+         (region.in_flight.load() == 0 || region.failed.load());
+}
+
+/**
+ * @brief Sleeps until another process pushes to one of our rings or the
+ *        bank's progress changes. With messages waiting for room in a peer
+ *        ring, yields instead, since nobody signals room.
+ */
+void ShardProcess::park() {
+  if (!outbox.empty()) {
+    std::this_thread::yield();
+    return;
+  }
+  self.sleeping.store(true);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  bool idle = self.peers.empty() && self.input.empty() && !finished() &&
+              !(region.input_closed.load() && !self.input_done.load());
+  if (idle) {
+    while (sem_wait(&self.wakeup) != 0 && errno == EINTR) {}
+  }
+  self.sleeping.store(false);
+}
+
+/**
+ * @brief Runs one ledger entry whose `from` account this shard owns. Results
+ *        and log lines match Bank's.
+ */
+void ShardProcess::execute(const Ledger& l) {
+  ShardAccount* acc = l.mode == 2 || l.mode == 4 ? nullptr : bank.find(shard, l.from);
+  FailReason reason = acc == nullptr ? FAIL_MISSING : FAIL_CLOSED;
+  switch (l.mode) {
+    case 0:
+      if (acc != nullptr && acc->open) {
+        acc->balance += l.amount;
+        succeed({shard, l.ledgerID, l.from, 0, l.amount, OP_DEPOSIT, true});
+      } else {
+        fail({shard, l.ledgerID, l.from, 0, l.amount, OP_DEPOSIT, false}, reason);
+      }
+      break;
+    case 1:
+      if (acc != nullptr && acc->open && l.amount <= acc->balance) {
+        acc->balance -= l.amount;
+        succeed({shard, l.ledgerID, l.from, 0, l.amount, OP_WITHDRAW, true});
+      } else {
+        fail({shard, l.ledgerID, l.from, 0, l.amount, OP_WITHDRAW, false}, acc != nullptr && acc->open ? FAIL_FUNDS : reason);
+      }
+      break;
+    case 2:
+      transfer(l);
+      break;
+    case 3:
+      if (acc != nullptr && acc->open) succeed({shard, l.ledgerID, l.from, 0, acc->balance, OP_BALANCE, true});
+      else                             fail({shard, l.ledgerID, l.from, 0, 0, OP_BALANCE, false}, reason);
+      break;
+    case 4:
+      acc = bank.insert(shard, l.from);
+      if (acc != nullptr) {
+        acc->open = true;
+        succeed({shard, l.ledgerID, l.from, 0, 0, OP_OPEN, true});
+      } else {
+        if (self.accounts >= SHARD_TABLE_LIMIT) std::cerr << "Shard " << shard << ": account table is full\n";
+        fail({shard, l.ledgerID, l.from, 0, 0, OP_OPEN, false}, FAIL_EXISTS);
+      }
+      break;
+    case 5:
+      if (acc != nullptr && acc->open) {
+        acc->open = false;
+        succeed({shard, l.ledgerID, l.from, 0, 0, OP_CLOSE, true});
+      } else {
+        fail({shard, l.ledgerID, l.from, 0, 0, OP_CLOSE, false}, reason);
+      }
+      break;
+  }
+}
+
+/**
+ * @brief Runs a transfer from an account of this shard. With both accounts
+ *        here it runs in one step; otherwise this is phase one: vote, hold
+ *        the amount on a yes, and send the vote to the destination's shard.
+ */
+void ShardProcess::transfer(const Ledger& l) {
+  LogRecord r {shard, l.ledgerID, l.from, l.to, l.amount, OP_TRANSFER, false};
+  unsigned int amount = l.amount;
+  if (l.from == l.to) return fail(r, FAIL_SAME_ACCOUNT);
+
+  ShardAccount* src = bank.find(shard, l.from);
+  int vote = src == nullptr ? FAIL_MISSING : !src->open ? FAIL_CLOSED : amount > src->balance ? FAIL_FUNDS : VOTE_YES;
+  int to = bank.owner(l.to);
+  if (to != shard) {
+    if (vote == VOTE_YES) src->balance -= amount;
+    region.in_flight++;
+    return send(to, {l, MSG_PREPARE, vote, 0});
+  }
+
+  ShardAccount* dest = bank.find(shard, l.to);
+  if (vote == FAIL_MISSING || dest == nullptr) return fail(r, FAIL_MISSING);
+  if (vote == FAIL_CLOSED || !dest->open)      return fail(r, FAIL_CLOSED);
+  if (vote == FAIL_FUNDS)                      return fail(r, FAIL_FUNDS);
+  src->balance -= amount;
+  dest->balance += amount;
+  r.success = true;
+  succeed(r);
+}
+
+/**
+ * @brief Handles a message from another shard: phase two of a transfer into
+ *        one of our accounts, or the reply to one of ours.
+ */
+void ShardProcess::handle(const ShardMsg& m) {
+  if (m.kind != MSG_PREPARE) return resolve(m, m.kind == MSG_COMMIT);
+
+  const Ledger& l = m.entry;
+  ShardAccount* dest = bank.find(shard, l.to);
+  int reason = m.vote == FAIL_MISSING || dest == nullptr ? FAIL_MISSING :
+               m.vote == FAIL_CLOSED || !dest->open      ? FAIL_CLOSED :
+               m.vote;
+  if (reason == VOTE_YES) dest->balance += (unsigned int)l.amount;
+  send(bank.owner(l.from), {l, reason == VOTE_YES ? MSG_COMMIT : MSG_ABORT, m.vote, reason});
+}
+
+/**
+ * @brief Ends one of our cross-shard transfers: logs it and, if it was
+ *        aborted after a yes vote, gives the held amount back.
+ */
+void ShardProcess::resolve(const ShardMsg& m, bool committed) {
+  const Ledger& l = m.entry;
+  LogRecord r {shard, l.ledgerID, l.from, l.to, l.amount, OP_TRANSFER, committed};
+  if (committed) {
+    succeed(r);
+  } else {
+    // Accounts are never removed, so the source is still there.
+    if (m.vote == VOTE_YES) bank.find(shard, l.from)->balance += (unsigned int)l.amount;
+    fail(r, (FailReason)m.reason);
+  }
+  if (--region.in_flight == 0 && region.draining.load() == 0) bank.wake_all();
+}
+
+/**
+ * @brief Sends a message to another shard, or keeps it for flush() if that
+ *        shard's peer ring is full. Messages keep their order.
+ */
+void ShardProcess::send(int to, const ShardMsg& m) {
+  if (outbox.empty() && !bank.state(to).failed.load() && bank.state(to).peers.try_push(m)) {
+    bank.notify(to);
+    return;
+  }
+  outbox.emplace_back(to, m);
+  flush();
+}
+
+/**
+ * @brief Retries the messages that did not fit into a peer ring. A prepare
+ *        for a dead shard is aborted here, as if its account were missing;
+ *        replies to a dead shard are dropped.
+ *
+ * @return true if any message left the outbox
+ */
+bool ShardProcess::flush() {
+  bool sent = false;
+  while (!outbox.empty()) {
+    auto& [to, m] = outbox.front();
+    if (bank.state(to).failed.load()) {
+      ShardMsg dropped = m;
+      outbox.pop_front();
+      if (dropped.kind == MSG_PREPARE) resolve({dropped.entry, MSG_ABORT, dropped.vote, FAIL_MISSING}, false);
+    } else if (bank.state(to).peers.try_push(m)) {
+      bank.notify(to);
+      outbox.pop_front();
+    } else {
+      break;
+    }
+    sent = true;
+  }
+  return sent;
+}
+
+/**
+ * @brief Forks the shard processes and starts watching them. Output buffered
+ *        so far is flushed first so the children do not repeat it.
+ *
+ * @return false if a process could not be forked (an error is printed); the
+ *         shards already running still finish once close() is called
+ */
+bool ShardedBank::start() {
+  std::cout.flush();
+  fflush(stdout);
+  bool started = true;
+  pid_t parent = getpid();
+  for (int s = 0; s < num_shards; ++s) {
+    pid_t pid = started ? fork() : -1;
+    if (pid == 0) {
+      // Without the parent nobody closes the input, so go down with it.
+      prctl(PR_SET_PDEATHSIG, SIGKILL);
+      if (getppid() != parent) _exit(1);
+      {
+        ShardProcess process {*this, s};
+        process.run();
+      }
+      std::cout.flush();
+      _exit(0);
+    }
+    if (pid < 0) {
+      if (started) perror("fork");
+      started = false;
+      state(s).failed.store(true);
+      region->failed.store(true);
+      if (!state(s).input_done.exchange(true)) region->draining--;
+    }
+    state(s).pid = pid;
+  }
+  monitor_thread = std::thread(&ShardedBank::monitor, this);
+  return started;
+}
+
+/**
+ * @brief Reaps the shard processes. A shard that did not exit cleanly is
+ *        marked failed and counted as done with its input, and every other
+ *        shard is woken to stop waiting for it.
+ */
+void ShardedBank::monitor() {
+  int left = 0;
+  for (int s = 0; s < num_shards; ++s) left += state(s).pid > 0;
+  while (left > 0) {
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    int s = 0;
+    while (s < num_shards && state(s).pid != pid) ++s;
+    if (s == num_shards) continue;
+    left--;
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) continue;
+
+    std::cerr << "Shard " << s << " (pid " << pid << ") exited abnormally\n";
+    state(s).failed.store(true);
+    region->failed.store(true);
+    if (!state(s).input_done.exchange(true)) region->draining--;
+    wake_all();
+  }
+}
+
+/**
+ * @brief Routes an entry to the shard that owns its `from` account, waiting
+ *        for room in that shard's input ring.
+ *
+ * @return false if the shard has died and the entry was dropped
+ */
+bool ShardedBank::submit(const Ledger& l) {
+  int s = owner(l.from);
+  int spins = 0;
+  while (!state(s).input.try_push(l)) {
+    if (state(s).failed.load()) return false;
+    spin_wait(spins);
+  }
+  notify(s);
+  return true;
+}
+
+/**
+ * @brief Tells the shards that every entry has been submitted.
+ */
+void ShardedBank::close() {
+  region->input_closed.store(true);
+  wake_all();
+}
+
+/**
+ * @brief Waits until every shard process has exited.
+ *
+ * @return false if any shard died
+ */
+bool ShardedBank::wait() {
+  if (monitor_thread.joinable()) monitor_thread.join();
+  return !region->failed.load();
+}
+
+/**
+ * @brief Balances of every open account, sorted by id. Only meaningful
+ *        before start() or after wait().
+ */
+std::vector<std::pair<int, long>> ShardedBank::balances() const {
+  std::vector<std::pair<int, long>> result;
+  for (int s = 0; s < num_shards; ++s) {
+    const ShardAccount* t = table(s);
+    for (size_t i = 0; i < state(s).accounts; ++i) {
+      const ShardAccount& acc = t[used_slots[s * SHARD_TABLE_LIMIT + i]];
+      if (acc.open) result.emplace_back(acc.id, acc.balance);
+    }
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+/**
+ * @brief Operation counts summed over every shard.
+ */
+BankStats ShardedBank::stats() const {
+  BankStats stats;
+  for (int s = 0; s < num_shards; ++s) state(s).counters.add_to(stats);
+  return stats;
+}
+
+/**
+ * @brief Prints the accounts and the success/fail summary in Bank's format.
+ */
+void ShardedBank::print_accounts() const {
+  for (auto& [id, balance] : balances()) {
+    std::cout << "ID# " << id << " | " << balance << "\n";
+  }
+
+  BankStats totals = stats();
+  std::cout << "Success: " << totals.successes() << " Fails: " << totals.failures() << "\n";
+}
+
+/**
+ * @brief Runs a ledger file on `config.shards` shard processes. This process
+ *        reads the file and routes the entries: readers feed a LedgerQueue,
+ *        and `num_workers` router threads move entries from it to the shards.
+ *
+ * @param num_workers router threads (and readers, unless config.readers says otherwise)
+ * @param filename file to read
+ * @param config runtime options; write-ahead logs, checkpoints, deterministic
+ *        mode, reports and follow mode need the single-process bank and are refused
+ */
+void ShardBank(int num_workers, std::string filename, const BankConfig& config) {
+  ShardBank(num_workers, std::vector<std::string> {filename}, config);
+}
+
+/**
+ * @brief Like ShardBank above, but for a list of ledger files and directories
+ *        (see ledger_files()), read one after another as by InitBank.
+ */
+void ShardBank(int num_workers, const std::vector<std::string>& paths, const BankConfig& config) {
+  if (config.deterministic || config.report_ms > 0 || !config.wal_path.empty() || !config.checkpoint_path.empty() ||
+      !config.save_checkpoint.empty() || config.follow) {
+    std::cerr << "--shards cannot be combined with --deterministic, --report-ms, --wal, checkpoints or --follow\n";
+    return;
+  }
+  std::vector<std::string> files = ledger_files(paths);
+  if (files.empty()) {
+    std::cerr << "No ledger files to read\n";
+    return;
+  }
+  ShardedBank bank {config.shards, config.verbosity};
+  if (!bank.valid()) return;
+  for (int id = 0; id < 10; ++id) bank.seed(id, 0);
+
+  bank.print_accounts();
+  bank.start();
+
+  LedgerQueue ledger {config.queue_size};
+  int num_readers = config.readers > 0 ? config.readers : num_workers;
+  std::atomic<long> dropped {0};
+  std::thread routers[num_workers];
+  for (auto& thread : routers) {
+    thread = std::thread([&]() {
+      Ledger l;
+      while (ledger.pop(l)) dropped += !bank.submit(l);
+    });
+  }
+  read_ledgers(num_readers, files, config.mmap, ledger);
+  for (auto& thread : routers) thread.join();
+  bank.close();
+  if (!bank.wait() && dropped > 0) std::cerr << dropped << " ledger entries for dead shards were dropped\n";
+
+  bank.print_accounts();
+  if (config.print_stats) bank.stats().print(std::cout);
+}
@@ -0,0 +1,82 @@
+#include <stats.h>
+
+/**
+ * @brief Total number of successful operations.
+ *
+ * @return uint64_t successes across all op types
+ */
+uint64_t BankStats::successes() const {
+  uint64_t total = 0;
+  for (uint64_t count : succ) total += count;
+  return total;
+}
+
+/**
+ * @brief Total number of failed operations.
+ *
+ * @return uint64_t failures across all op types
+ */
+uint64_t BankStats::failures() const {
+  uint64_t total = 0;
+  for (uint64_t count : fail) total += count;
+  return total;
+}
+
+/**
+ * @brief Prints the per-op and per-reason breakdown, one "name: count" pair
+ *        per line so it is easy to parse.
+ *
+ * @param out stream to print to
+ */
+void BankStats::print(std::ostream& out) const {
+  for (int op = 0; op < NUM_OPS; ++op) {
+    out << op_name((Op)op) << ": " << succ[op] << " succeeded, " << fail[op] << " failed\n";
+  }
+  for (int reason = 0; reason < NUM_FAIL_REASONS; ++reason) {
+    out << "failed (" << reason_name((FailReason)reason) << "): " << reasons[reason] << "\n";
+  }
+}
+
+/**
+ * @brief Adds this thread's counts into an aggregate.
+ *
+ * @param stats aggregate to add to
+ */
+void OpCounters::add_to(BankStats& stats) const {
+  for (int op = 0; op < NUM_OPS; ++op) {
+    stats.succ[op] += succ[op].load(std::memory_order_relaxed);
+    stats.fail[op] += fail[op].load(std::memory_order_relaxed);
+  }
+  for (int reason = 0; reason < NUM_FAIL_REASONS; ++reason) {
+    stats.reasons[reason] += reasons[reason].load(std::memory_order_relaxed);
+  }
+}
+
+/**
+ * @brief Printable name of an op type.
+ */
+const char* op_name(Op op) {
+  switch (op) {
+    case OP_DEPOSIT:  return "deposit";
+    case OP_WITHDRAW: return "withdraw";
+    case OP_TRANSFER: return "transfer";
+    case OP_BALANCE:  return "balance";
+    case OP_OPEN:     return "open";
+    case OP_CLOSE:    return "close";
+  }
+  return "unknown";
+}
+
+/**
+ * @brief Printable name of a failure reason.
+ */
+const char* reason_name(FailReason reason) {
+  switch (reason) {
+    case FAIL_MISSING:      return "missing account";
+    case FAIL_CLOSED:       return "closed account";
+    case FAIL_FUNDS:        return "insufficient funds";
+    case FAIL_SAME_ACCOUNT: return "same-account transfer";
+    case FAIL_EXISTS:       return "account exists";
+    default:                return "unknown";
+  }
+}
@@ -0,0 +1,157 @@
+#include <trace.h>
+#include <thread_slots.h>
+
+#include <stdio.h>
+#include <pthread.h>
+
+// Every thread's histograms; threads register on their first sample.
+static PerThread<OpTrace>& traces() {
+  static PerThread<OpTrace> slots;
+  return slots;
+}
+
+/**
+ * @brief Smallest value that falls in a bucket.
+ *
+ * @param bucket bucket index
+ * @return uint64_t the bucket's lower bound in ns
+ */
+uint64_t LatencyHistogram::lowest(size_t bucket) {
+  if (bucket < (1u << TRACE_SUB_BITS)) return bucket;
+  int e = (bucket >> TRACE_SUB_BITS) + TRACE_SUB_BITS - 1;
+  uint64_t sub = bucket & ((1u << TRACE_SUB_BITS) - 1);
+  return ((1ull << TRACE_SUB_BITS) + sub) << (e - TRACE_SUB_BITS);
+}
+
+/**
+ * @brief Records one latency sample in the calling thread's histograms.
+ *
+ * @param kind what was measured
+ * @param op ledger mode / Op of the operation (others are ignored)
+ * @param ns latency in nanoseconds
+ */
+void trace_record(TraceKind kind, int op, uint64_t ns) {
+  if (op < 0 || op >= NUM_OPS) return;
+  traces().local().hist[op][kind].record(ns);
+}
+
+static const char* kind_name(int kind) {
+  switch (kind) {
+    case TRACE_QUEUE: return "queue_wait";
+    case TRACE_LOCK:  return "lock_wait";
+    case TRACE_EXEC:  return "exec";
+  }
+  return "unknown";
+}
+
+/**
+ * @brief Writes one merged histogram as a JSON object: the sample count,
+ *        percentiles and the non-empty buckets as [lower bound, count] pairs.
+ *        Percentiles are bucket lower bounds, in ns.
+ */
+static void write_histogram(FILE* out, const uint64_t* counts) {
+  uint64_t total = 0;
+  for (size_t b = 0; b < TRACE_BUCKETS; ++b) total += counts[b];
+
+  fprintf(out, "{\"count\": %llu", (unsigned long long)total);
+  const double quantiles[] = {0.5, 0.9, 0.99, 0.999, 1.0};
+  const char* names[] = {"p50", "p90", "p99", "p999", "max"};
+  uint64_t seen = 0;
+  size_t b = 0;
+  for (int q = 0; q < 5; ++q) {
+    uint64_t rank = total == 0 ? 0 : (uint64_t)(quantiles[q] * (total - 1)) + 1;
+    while (b < TRACE_BUCKETS && seen + counts[b] < rank) seen += counts[b++];
+    uint64_t value = total == 0 || b == TRACE_BUCKETS ? 0 : LatencyHistogram::lowest(b);
+    fprintf(out, ", \"%s\": %llu", names[q], (unsigned long long)value);
+  }
+
+  fprintf(out, ", \"buckets\": [");
+  const char* sep = "";
+  for (size_t i = 0; i < TRACE_BUCKETS; ++i) {
+    if (counts[i] == 0) continue;
+    fprintf(out, "%s[%llu, %llu]", sep, (unsigned long long)LatencyHistogram::lowest(i), (unsigned long long)counts[i]);
+    sep = ", ";
+  }
+  fprintf(out, "]}");
+}
+
+/**
+ * @brief Merges every thread's histograms and writes them as JSON, keyed by
+ *        op and then by kind of sample. Threads may keep recording meanwhile.
+ *        The file is written next to `path` and renamed over it, so readers
+ *        never see a half-written dump.
+ *
+ * @param path file to write
+ * @return true on success, false on error (an error is printed)
+ */
+bool trace_dump(const std::string& path) {
+  static std::mutex dump_lock;
+  // Automatically unlocks when destroyed.
+  std::scoped_lock lock {dump_lock};
+  static uint64_t merged[NUM_OPS][NUM_TRACE_KINDS][TRACE_BUCKETS];
+  for (auto& op : merged) for (auto& kind : op) for (uint64_t& b : kind) b = 0;
+  traces().for_each([](OpTrace& t) {
+    for (int op = 0; op < NUM_OPS; ++op) {
+      for (int kind = 0; kind < NUM_TRACE_KINDS; ++kind) {
+        for (size_t b = 0; b < TRACE_BUCKETS; ++b) merged[op][kind][b] += t.hist[op][kind].buckets[b].load(std::memory_order_relaxed);
+      }
+    }
+  });
+
+  std::string tmp = path + ".tmp";
+  FILE* out = fopen(tmp.c_str(), "w");
+  if (out == nullptr) {
+    perror(tmp.c_str());
+    return false;
+  }
+  fprintf(out, "{\"unit\": \"ns\", \"ops\": {");
+  for (int op = 0; op < NUM_OPS; ++op) {
+    fprintf(out, "%s\n  \"%s\": {", op == 0 ? "" : ",", op_name((Op)op));
+    for (int kind = 0; kind < NUM_TRACE_KINDS; ++kind) {
+      fprintf(out, "%s\n    \"%s\": ", kind == 0 ? "" : ",", kind_name(kind));
+      write_histogram(out, merged[op][kind]);
+    }
+    fprintf(out, "\n  }");
+  }
+  fprintf(out, "\n}}\n");
+
+  bool ok = fclose(out) == 0 && rename(tmp.c_str(), path.c_str()) == 0;
+  if (!ok) perror(path.c_str());
+  return ok;
+}
+
+/**
+ * @brief Blocks SIGUSR1 in the calling thread and starts the dumper thread.
+ *
+ * @param path stats file to write
+ */
+TraceDumper::TraceDumper(const std::string& path) : path(path) {
+  sigset_t usr1;
+  sigemptyset(&usr1);
+  sigaddset(&usr1, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &usr1, &old_mask);
+  dumper = std::thread(&TraceDumper::wait_signals, this);
+}
+
+/**
+ * @brief Stops the dumper thread, writes the final dump and restores the
+ *        signal mask.
+ */
+TraceDumper::~TraceDumper() {
+  stop = true;
+  pthread_kill(dumper.native_handle(), SIGUSR1);
+  dumper.join();
+  trace_dump(path);
+  pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+}
+
+/**
+ * @brief Dumper loop: writes the stats file for every SIGUSR1 until stopped.
+ */
+void TraceDumper::wait_signals() {
+  sigset_t usr1;
+  sigemptyset(&usr1);
+  sigaddset(&usr1, SIGUSR1);
+  int sig;
+  while (sigwait(&usr1, &sig) == 0 && !stop) trace_dump(path);
+}
@@ -0,0 +1,219 @@
+#include <wal.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <random>
+
+/**
+ * @brief FNV-1a hash of a record's fields, excluding the checksum itself.
+ *
+ * @param rec record to hash
+ * @return uint64_t checksum
+ */
+uint64_t wal_checksum(const WalRecord& rec) {
+  uint64_t h = 0xCBF29CE484222325ull;
+  for (int64_t field : {(int64_t)rec.ledger_id, (int64_t)rec.acc_id, (int64_t)rec.dest_id, (int64_t)rec.op, rec.amount}) {
+    h ^= (uint64_t)field;
+    h *= 0x100000001B3ull;
+  }
+  return h;
+}
+
+/**
+ * @brief Identifies the ledger a write-ahead log belongs to, so the ids of
+ *        one ledger's records are never taken for another's. It hashes the
+ *        resolved path of every file in order, so it does not notice a file
+ *        that was rewritten in place.
+ *
+ * @param files ledger files, in the order they are read
+ * @return uint64_t fingerprint
+ */
+uint64_t ledger_fingerprint(const std::vector<std::string>& files) {
+  uint64_t h = 0xCBF29CE484222325ull;
+  for (const std::string& name : files) {
+    char* real = realpath(name.c_str(), nullptr);
+    std::string path = real != nullptr ? real : name;
+    free(real);
+    for (char c : path + '\0') h = (h ^ (unsigned char)c) * 0x100000001B3ull;
+  }
+  return h;
+}
+
+/**
+ * @brief Reads every intact record of a write-ahead log. Reading stops at the
+ *        first record that is cut short or fails its checksum, and the file
+ *        is truncated there so new records follow the last good one.
+ *
+ * @param path log file; a missing file is an empty log
+ * @param records filled with the records in log order
+ * @param ledger ledger_fingerprint() of the ledger about to run
+ * @return false if the file exists but is not a write-ahead log, or belongs
+ *         to another ledger
+ */
+bool read_wal(const std::string& path, std::vector<WalRecord>& records, uint64_t ledger) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == nullptr) return true;
+
+  WalHeader header;
+  long good = 0;
+  if (fread(&header, sizeof(header), 1, file) == 1) {
+    if (header.magic != WAL_MAGIC || header.version != WAL_VERSION) {
+      fprintf(stderr, "%s: not a write-ahead log\n", path.c_str());
+      fclose(file);
+      return false;
+    }
+    if (header.ledger != ledger) {
+      fprintf(stderr, "%s: write-ahead log of another ledger\n", path.c_str());
+      fclose(file);
+      return false;
+    }
+    good = sizeof(header);
+    WalRecord rec;
+    while (fread(&rec, sizeof(rec), 1, file) == 1 && rec.checksum == wal_checksum(rec)) {
+      records.push_back(rec);
+      good += sizeof(rec);
+    }
+  }
+  fclose(file);
+
+  if (truncate(path.c_str(), good) < 0) perror(path.c_str());
+  return true;
+}
+
+/**
+ * @brief Opens a log for appending, writing the header if the file is new,
+ *        and starts the committer. The file should have been through
+ *        read_wal() first, so it ends on a whole record. On failure an error
+ *        is printed and the log is left invalid.
+ *
+ * @param path log file
+ * @param ledger ledger_fingerprint() written to the header of a new file,
+ *               along with a random log id
+ */
+WriteAheadLog::WriteAheadLog(const std::string& path, uint64_t ledger) {
+  fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (fd < 0) {
+    perror(path.c_str());
+    return;
+  }
+
+  struct stat st;
+  WalHeader header {WAL_MAGIC, WAL_VERSION, ledger, 0};
+  if (fstat(fd, &st) == 0 && st.st_size == 0) {
+    // Any value other than 0 will do, as long as two logs are unlikely to share it
+    std::random_device random;
+    while (header.log_id == 0) header.log_id = (uint64_t)random() << 32 | random();
+    if (write(fd, &header, sizeof(header)) != sizeof(header) || fdatasync(fd) < 0) perror(path.c_str());
+  } else {
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header)) perror(path.c_str());
+    if (st.st_size > (off_t)sizeof(WalHeader)) existing = (st.st_size - sizeof(WalHeader)) / sizeof(WalRecord);
+  }
+  log_id = header.log_id;
+
+  committer = std::thread(&WriteAheadLog::commit, this);
+}
+
+/**
+ * @brief Commits everything still pending, then stops the committer.
+ */
+WriteAheadLog::~WriteAheadLog() {
+  if (fd < 0) return;
+  {
+    // Automatically unlocks when destroyed.
+    std::scoped_lock lock {wal_lock};
+    stopping = true;
+  }
+  commit_cv.notify_one();
+  committer.join();
+  close(fd);
+}
+
+/**
+ * @brief Adds an executed operation to the pending group. Returns without
+ *        waiting for the disk; see sync().
+ *
+ * @param result the operation that was applied, or that failed
+ */
+void WriteAheadLog::append(const LogRecord& result) {
+  int32_t op = result.success ? result.op : result.op | WAL_FAILED;
+  WalRecord rec {result.ledger_id, result.acc_id, result.dest_id, op, result.amount, 0};
+  rec.checksum = wal_checksum(rec);
+
+  // Automatically unlocks when destroyed.
+  std::scoped_lock lock {wal_lock};
+  pending.push_back(rec);
+  appended++;
+  if (pending.size() == WAL_GROUP_RECORDS) commit_cv.notify_one();
+}
+
+/**
+ * @brief Waits until every record appended before the call is on disk.
+ *        Concurrent callers share the same commit.
+ */
+void WriteAheadLog::sync() {
+  // Automatically unlocks when destroyed.
+  std::unique_lock<std::mutex> lock {wal_lock};
+  uint64_t target = appended;
+  waiters++;
+  commit_cv.notify_one();
+  durable_cv.wait(lock, [&]() { return durable >= target; });
+  waiters--;
+}
+
+/**
+ * @brief Number of records in the log, counting the ones it held when it was
+ *        opened and the ones appended since (committed or not).
+ *
+ * @return uint64_t record count
+ */
+uint64_t WriteAheadLog::records() {
+  // Automatically unlocks when destroyed.
+  std::scoped_lock lock {wal_lock};
+  return existing + appended;
+}
+
+/**
+ * @brief Committer loop: takes the pending group, writes it with one write()
+ *        and syncs it with one fdatasync() outside the lock, so workers keep
+ *        appending to the next group meanwhile.
+ */
+void WriteAheadLog::commit() {
+  std::vector<WalRecord> group;
+
+  // Automatically unlocks when destroyed.
+  std::unique_lock<std::mutex> lock {wal_lock};
+  for (;;) {
+    commit_cv.wait_for(lock, WAL_COMMIT_INTERVAL, [&]() {
+      return stopping || pending.size() >= WAL_GROUP_RECORDS || (waiters > 0 && !pending.empty());
+    });
+    if (pending.empty()) {
+      if (stopping) return;
+      continue;
+    }
+
+    group.swap(pending);
+    uint64_t end = appended;
+    lock.unlock();
+
+    const char* data = reinterpret_cast<const char*>(group.data());
+    size_t left = group.size() * sizeof(WalRecord);
+    while (left > 0) {
+      ssize_t n = write(fd, data, left);
+      if (n < 0) {
+        perror("wal");
+        break;
+      }
+      data += n;
+      left -= n;
+    }
+    if (fdatasync(fd) < 0) perror("wal");
+    group.clear();
+
+    lock.lock();
+    durable = end;
+    durable_cv.notify_all();
+  }
+}
@@ -0,0 +1,97 @@
+#include <workload.h>
+
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+
+/**
+ * @brief Precomputes the cumulative weights of ids 0 ... n-1.
+ *
+ * @param n number of ids
+ * @param s skew; 0 is uniform, around 1 is a classic Zipf law
+ */
+ZipfSampler::ZipfSampler(int n, double s) : cdf(std::max(n, 1)) {
+  double sum = 0;
+  for (size_t k = 0; k < cdf.size(); ++k) {
+    sum += 1.0 / std::pow(k + 1.0, s);
+    cdf[k] = sum;
+  }
+  for (double& c : cdf) c /= sum;
+}
+
+/**
+ * @brief Draws one id.
+ *
+ * @param rng random source
+ * @return int id in 0 ... n-1
+ */
+int ZipfSampler::operator()(std::mt19937& rng) const {
+  double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+  return std::min<size_t>(std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin(), cdf.size() - 1);
+}
+
+/**
+ * @brief Generates a ledger of `config.entries` operations (plus the opening
+ *        entries, if requested) with ledger ids in order.
+ *
+ * @param config workload shape
+ * @return std::vector<Ledger> the ledger
+ */
+std::vector<Ledger> generate_ledger(const WorkloadConfig& config) {
+  std::mt19937 rng {config.seed};
+  ZipfSampler pick {config.accounts, config.zipf};
+  std::discrete_distribution<int> mode {std::begin(config.mix), std::end(config.mix)};
+  std::uniform_real_distribution<double> coin {0.0, 1.0};
+  std::uniform_int_distribution<int> amount {1, 500};
+  std::uniform_int_distribution<int> offset {-LOCALITY_WINDOW / 2, LOCALITY_WINDOW / 2};
+
+  std::vector<Ledger> entries;
+  entries.reserve(config.entries + config.accounts);
+  if (config.open_accounts) {
+    for (int id = 10; id < config.accounts; ++id) entries.push_back({id, 0, 0, 4, (int)entries.size()});
+  }
+
+  for (int i = 0; i < config.entries; ++i) {
+    Ledger l {pick(rng), 0, 0, mode(rng), (int)entries.size()};
+    if (l.mode <= 2) l.amount = amount(rng);
+    if (l.mode == 2) {
+      if (coin(rng) < config.locality) l.to = std::clamp(l.from + offset(rng), 0, config.accounts - 1);
+      else                             l.to = pick(rng);
+    }
+    entries.push_back(l);
+  }
+  return entries;
+}
+
+/**
+ * @brief Writes a ledger as text, or as a binary ledger with header and
+ *        checksum (see ledger_file.h).
+ *
+ * @param path file to write
+ * @param entries the ledger
+ * @param binary write the binary format instead of text
+ * @return true on success, false on error (an error is printed)
+ */
+bool write_ledger(const std::string& path, const std::vector<Ledger>& entries, bool binary) {
+  FILE* out = fopen(path.c_str(), "wb");
+  if (out == nullptr) {
+    perror(path.c_str());
+    return false;
+  }
+
+  bool ok = true;
+  if (binary) {
+    LedgerHeader header {LEDGER_MAGIC, LEDGER_VERSION, entries.size(), 0};
+    for (const Ledger& l : entries) header.checksum += record_checksum(l);
+    ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+         fwrite(entries.data(), sizeof(Ledger), entries.size(), out) == entries.size();
+  } else {
+    for (const Ledger& l : entries) {
+      if (fprintf(out, "%d %d %d %d\n", l.from, l.to, l.amount, l.mode) < 0) ok = false;
+    }
+  }
+
+  if (fclose(out) != 0) ok = false;
+  if (!ok) perror(path.c_str());
+  return ok;
+}
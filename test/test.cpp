@@ -1,11 +1,24 @@
 #include <gtest/gtest.h>
 #include <fstream>
 #include <iostream>
+#include <random>
 #include <string>
+#include <cstring>
+#include <sys/socket.h>
 #include <sstream>
+#include <filesystem>
+#include <map>
 
 
 #include "ledger.h"
+#include "affinity.h"
+#include "compact_store.h"
+#include "shard.h"
+#include "engine.h"
+#include "file_reader.h"
+#include "scheduler.h"
+#include "server.h"
+#include "workload.h"
 
 using namespace std;
 
@@ -56,12 +69,13 @@ TEST(BankTest, Test2) {
     bank->deposit(0, 0, 3, 100);
     bank->deposit(0, 0, 5, 100);
     
+    bank->logger.flush(); // write queued log lines while cout is still redirected
     cout.rdbuf(oldCoutStreamBuf); // restore cout's original streambuf
     
-    EXPECT_EQ(bank->accounts[1].balance, 100);
-    EXPECT_EQ(bank->accounts[3].balance, 100);
-    EXPECT_EQ(bank->accounts[5].balance, 100);
-    EXPECT_EQ(bank->accounts[8].balance, 0);
+    EXPECT_EQ(bank->accounts[1].balance(), 100);
+    EXPECT_EQ(bank->accounts[3].balance(), 100);
+    EXPECT_EQ(bank->accounts[5].balance(), 100);
+    EXPECT_EQ(bank->accounts[8].balance(), 0);
 
     delete bank;
 }
@@ -83,6 +97,7 @@ TEST(BankTest, Test3) {
     int withdraw1 = bank->withdraw(0, 0, 1, 50);
     int withdraw2 = bank->withdraw(0, 0, 0, 50);
 
+    bank->logger.flush(); // write queued log lines while cout is still redirected
     cout.rdbuf(oldCoutStreamBuf); // restore cout's original streambuf
     
     EXPECT_EQ(withdraw1, 0);
@@ -108,11 +123,12 @@ TEST(BankTest, Test4) {
     int transfer1 = bank->transfer(0, 0, 1, 0, 50);
     int transfer2 = bank->transfer(0, 0, 6, 7, 50);
 
+    bank->logger.flush(); // write queued log lines while cout is still redirected
     cout.rdbuf(oldCoutStreamBuf); // restore cout's original streambuf
     
     EXPECT_EQ(transfer1, 0);
     EXPECT_EQ(transfer2, -1);
-    EXPECT_TRUE(bank->accounts[1].balance == 50 && bank->accounts[0].balance == 50);
+    EXPECT_TRUE(bank->accounts[1].balance() == 50 && bank->accounts[0].balance() == 50);
 
     delete bank;
 }
@@ -131,6 +147,7 @@ TEST(BankTest, Test5) {
 
     int transfer1 = bank->transfer(0, 0, 1, 1, 50);
 
+    bank->logger.flush(); // write queued log lines while cout is still redirected
     cout.rdbuf(oldCoutStreamBuf); // restore cout's original streambuf
     
     EXPECT_EQ(transfer1, -1);
@@ -179,13 +196,14 @@ TEST(BankTest, Test7) {
     int deposit2 = bank->deposit(0, 0, 1, 100);
     int open2 = bank->open_account(0, 0, 1);
 
+    bank->logger.flush(); // write queued log lines while cout is still redirected
     cout.rdbuf(oldCoutStreamBuf); // restore cout's original streambuf
     
     EXPECT_EQ(deposit1, -1);
     EXPECT_EQ(open1, 0);
     EXPECT_EQ(deposit2, 0);
     EXPECT_EQ(open2, -1);
-    EXPECT_TRUE(bank->accounts[1].balance == 100);
+    EXPECT_TRUE(bank->accounts[1].balance() == 100);
 
     delete bank;
 }
@@ -204,6 +222,7 @@ TEST(BankTest, Test8) {
     int deposit2 = bank->deposit(0, 0, 0, 100);
     int close2 = bank->close_account(0, 0, 0);
 
+    bank->logger.flush(); // write queued log lines while cout is still redirected
     cout.rdbuf(oldCoutStreamBuf); // restore cout's original streambuf
     
     EXPECT_EQ(deposit1, 0);
@@ -229,6 +248,7 @@ TEST(BankTest, Test9) {
     int close = bank->close_account(0, 0, 0);
     int check3 = bank->check_balance(0, 0, 0);
 
+    bank->logger.flush(); // write queued log lines while cout is still redirected
     cout.rdbuf(oldCoutStreamBuf); // restore cout's original streambuf
     
     EXPECT_EQ(check1, 0);
@@ -241,20 +261,402 @@ TEST(BankTest, Test9) {
 }
 
 
+TEST(BankTest, Test10) {
+    Bank *bank = new Bank();
+
+    // capture out
+    stringstream output;
+    streambuf* oldCoutStreamBuf = cout.rdbuf(); // save cout's streambuf
+    cout.rdbuf(output.rdbuf()); // redirect cout to stringstream
+
+    // race threads opening the same 1000 accounts; each id must be opened exactly once
+    std::atomic<int> opened {0};
+    std::thread threads[4];
+    for (int t = 0; t < 4; ++t) {
+      threads[t] = std::thread([&, t]() {
+        for (int i = 0; i < 1000; ++i) {
+          if (bank->open_account(t, i, i * 7919) == 0) opened++;
+        }
+      });
+    }
+    for (auto& thread : threads) thread.join();
+
+    bank->logger.flush(); // write queued log lines while cout is still redirected
+    cout.rdbuf(oldCoutStreamBuf); // restore cout's original streambuf
+
+    EXPECT_EQ(opened, 1000);
+    EXPECT_EQ(bank->accounts.size(), 1000);
+    EXPECT_EQ(bank->accounts.find(1), nullptr);
+    ASSERT_NE(bank->accounts.find(999 * 7919), nullptr);
+    EXPECT_TRUE(bank->accounts.find(999 * 7919)->is_open());
+
+    delete bank;
+}
+
+
+TEST(BankTest, Test11) {
+    Bank *bank = new Bank(10);
+    bank->logger.set_verbosity(QUIET);
+
+    // one failure of every kind from the main thread
+    bank->withdraw(0, 0, 1, 50);        // insufficient funds
+    bank->deposit(0, 1, 42, 50);        // missing account
+    bank->transfer(0, 2, 3, 3, 50);     // same account
+    bank->open_account(0, 3, 4);        // account exists
+    bank->close_account(0, 4, 5);
+    bank->check_balance(0, 5, 5);       // closed account
+
+    // and successful deposits counted from several threads
+    std::thread threads[4];
+    for (int t = 0; t < 4; ++t) {
+      threads[t] = std::thread([&, t]() {
+        for (int i = 0; i < 1000; ++i) bank->deposit(t, i, t, 1);
+      });
+    }
+    for (auto& thread : threads) thread.join();
+
+    BankStats stats = bank->stats();
+    EXPECT_EQ(stats.successes(), 4001);
+    EXPECT_EQ(stats.failures(), 5);
+    EXPECT_EQ(stats.succ[OP_DEPOSIT], 4000);
+    EXPECT_EQ(stats.succ[OP_CLOSE], 1);
+    EXPECT_EQ(stats.fail[OP_BALANCE], 1);
+    EXPECT_EQ(stats.reasons[FAIL_FUNDS], 1);
+    EXPECT_EQ(stats.reasons[FAIL_MISSING], 1);
+    EXPECT_EQ(stats.reasons[FAIL_SAME_ACCOUNT], 1);
+    EXPECT_EQ(stats.reasons[FAIL_EXISTS], 1);
+    EXPECT_EQ(stats.reasons[FAIL_CLOSED], 1);
+
+    delete bank;
+}
+
+TEST(BankTest, Test12) {
+    Bank *bank = new Bank(2);
+    bank->logger.set_verbosity(QUIET);
+    bank->deposit(0, 0, 0, 1000);
+
+    // lock-free deposits/withdrawals race with locked transfers; money is only
+    // created by the deposits and nothing may go negative
+    std::atomic<long> deposited {1000}, withdrawn {0};
+    std::thread threads[4];
+    for (int t = 0; t < 4; ++t) {
+      threads[t] = std::thread([&, t]() {
+        for (int i = 0; i < 20000; ++i) {
+          switch ((i + t) % 3) {
+            case 0: if (bank->deposit(t, i, i % 2, 3) == 0) deposited += 3; break;
+            case 1: if (bank->withdraw(t, i, i % 2, 5) == 0) withdrawn += 5; break;
+            case 2: bank->transfer(t, i, i % 2, 1 - i % 2, 7); break;
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) thread.join();
+
+    EXPECT_GE(bank->accounts[0].balance(), 0);
+    EXPECT_GE(bank->accounts[1].balance(), 0);
+    EXPECT_EQ(bank->accounts[0].balance() + bank->accounts[1].balance(), deposited - withdrawn);
+
+    // a closed account takes no more deposits
+    bank->close_account(0, 0, 1);
+    EXPECT_EQ(bank->deposit(0, 0, 1, 10), -1);
+    EXPECT_FALSE(bank->accounts[1].is_open());
+
+    delete bank;
+}
+
+TEST(BankTest, Test13) {
+    Bank *bank = new Bank(2);
+    bank->logger.set_verbosity(QUIET);
+    bank->deposit(0, 0, 0, 100);
+
+    // balance reads must not need write_lock, even while someone holds it
+    bank->accounts[0].write_lock.lock();
+    int check = -2;
+    std::thread reader([&]() { check = bank->check_balance(1, 1, 0); });
+    reader.join();
+    EXPECT_EQ(check, 0);
+    EXPECT_EQ(bank->accounts[0].balance(), 100);
+    bank->accounts[0].write_lock.unlock();
+
+    // and reads racing with transfers only ever see whole transfers
+    std::atomic<bool> stop {false};
+    std::thread mover([&]() {
+      for (int i = 0; i < 20000; ++i) bank->transfer(0, i, i % 2, 1 - i % 2, 100);
+      stop = true;
+    });
+    while (!stop) {
+      long balance = bank->accounts[0].balance();
+      EXPECT_TRUE(balance == 0 || balance == 100) << balance;
+    }
+    mover.join();
+
+    delete bank;
+}
+
+TEST(BankTest, Test14) {
+    Bank *bank = new Bank(8);
+    bank->logger.set_verbosity(QUIET);
+    for (int i = 0; i < 8; ++i) bank->deposit(0, 0, i, 1000);
+
+    // transfers never change the total, so every snapshot taken while they
+    // run must add up to exactly 8000
+    std::atomic<bool> stop {false};
+    std::thread threads[3];
+    for (int t = 0; t < 3; ++t) {
+      threads[t] = std::thread([&, t]() {
+        for (int i = 0; !stop; ++i) bank->transfer(t, i, (i + t) % 8, (i * 3 + t + 1) % 8, 1 + i % 50);
+      });
+    }
+    for (int i = 0; i < 200; ++i) {
+      BankSnapshot snap = bank->snapshot();
+      ASSERT_EQ(snap.balances.size(), 8);
+      ASSERT_EQ(snap.total(), 8000) << "snapshot " << i << " is not consistent";
+    }
+    stop = true;
+    for (auto& thread : threads) thread.join();
+
+    // accounts closed after a snapshot are still in it; accounts opened after are not
+    BankSnapshot before = bank->snapshot();
+    bank->close_account(0, 0, 0);
+    bank->open_account(0, 0, 100);
+    BankSnapshot after = bank->snapshot();
+    EXPECT_EQ(before.balances.front().first, 0);
+    EXPECT_EQ(after.balances.front().first, 1);
+    EXPECT_EQ(after.balances.back().first, 100);
+
+    delete bank;
+}
+
+TEST(BankTest, Test15) {
+    Bank *bank = new Bank(4);
+    bank->logger.set_verbosity(QUIET);
+
+    // enough contended updates turn an account hot
+    Account& settlement = bank->accounts[0];
+    for (int i = 0; i < HOT_THRESHOLD - 1; ++i) settlement.contended();
+    EXPECT_FALSE(settlement.is_hot());
+    settlement.contended();
+    ASSERT_TRUE(settlement.is_hot());
+
+    // deposits and credits land on stripes, withdrawals and debits fold them
+    // in when the word alone is short; no money appears or disappears
+    for (int i = 1; i < 4; ++i) bank->deposit(0, 0, i, 100000);
+    std::atomic<long> deposited {300000}, withdrawn {0};
+    std::thread threads[4];
+    for (int t = 0; t < 4; ++t) {
+      threads[t] = std::thread([&, t]() {
+        for (int i = 0; i < 20000; ++i) {
+          int other = 1 + (i + t) % 3;
+          switch ((i + t) % 4) {
+            case 0: if (bank->deposit(t, i, 0, 5) == 0) deposited += 5; break;
+            case 1: bank->transfer(t, i, other, 0, 3); break;
+            case 2: bank->transfer(t, i, 0, other, 4); break;
+            case 3: if (bank->withdraw(t, i, 0, 2) == 0) withdrawn += 2; break;
+          }
+          if (i % 1000 == 0) {
+            BankSnapshot snap = bank->snapshot();
+            EXPECT_GE(snap.total(), 0);
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) thread.join();
+
+    long total = 0;
+    for (int i = 0; i < 4; ++i) {
+      EXPECT_GE(bank->accounts[i].balance(), 0);
+      total += bank->accounts[i].balance();
+    }
+    EXPECT_EQ(total, deposited - withdrawn);
+    EXPECT_EQ(bank->snapshot().total(), deposited - withdrawn);
+
+    // a withdrawal that only the stripes can cover still succeeds
+    bank->deposit(0, 0, 0, 50);
+    long balance = settlement.balance();
+    EXPECT_EQ(bank->withdraw(0, 0, 0, balance), 0);
+    EXPECT_EQ(settlement.balance(), 0);
+    EXPECT_EQ(bank->withdraw(0, 0, 0, 1), -1);
+
+    // a closed hot account takes no deposits or credits
+    bank->close_account(0, 0, 0);
+    EXPECT_EQ(bank->deposit(0, 0, 0, 10), -1);
+    EXPECT_EQ(bank->transfer(0, 0, 1, 0, 10), -1);
+
+    delete bank;
+}
+
+TEST(BankTest, Test16) {
+    Bank *bank = new Bank(3);
+    bank->logger.set_verbosity(QUIET);
+    bank->deposit(0, 0, 0, 100);
+    bank->close_account(0, 0, 2);
+
+    // transfers that are bound to fail never wait for a lock, even while
+    // someone holds both accounts
+    bank->accounts[0].write_lock.lock();
+    bank->accounts[1].write_lock.lock();
+    int results[3] {-2, -2, -2};
+    std::thread failing([&]() {
+      results[0] = bank->transfer(1, 1, 0, 1, 1000);  // insufficient funds
+      results[1] = bank->transfer(1, 2, 1, 0, 1);     // empty source
+      results[2] = bank->transfer(1, 3, 0, 2, 1);     // closed destination
+    });
+    failing.join();
+    EXPECT_EQ(results[0], -1);
+    EXPECT_EQ(results[1], -1);
+    EXPECT_EQ(results[2], -1);
+    EXPECT_EQ(bank->stats().reasons[FAIL_FUNDS], 2);
+    EXPECT_EQ(bank->stats().reasons[FAIL_CLOSED], 1);
+
+    // one that can succeed waits for the locks and then goes through
+    std::atomic<int> result {-2};
+    std::thread waiting([&]() { result = bank->transfer(1, 4, 0, 1, 60); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_EQ(result, -2);
+    bank->accounts[1].write_lock.unlock();
+    bank->accounts[0].write_lock.unlock();
+    waiting.join();
+    EXPECT_EQ(result, 0);
+    EXPECT_EQ(bank->accounts[0].balance(), 40);
+    EXPECT_EQ(bank->accounts[1].balance(), 60);
+
+    // failing and succeeding transfers racing on the same accounts
+    std::thread threads[4];
+    for (int t = 0; t < 4; ++t) {
+      threads[t] = std::thread([&, t]() {
+        for (int i = 0; i < 20000; ++i) bank->transfer(t, i, (i + t) % 2, 1 - (i + t) % 2, i % 3 == 0 ? 1000 : 7);
+      });
+    }
+    for (auto& thread : threads) thread.join();
+    EXPECT_EQ(bank->accounts[0].balance() + bank->accounts[1].balance(), 100);
+
+    delete bank;
+}
+
+TEST(BankTest, Test17) {
+    // CompactStore: untouched accounts are closed and empty, and ops follow Account's rules
+    CompactStore store {1000000};
+    ASSERT_TRUE(store.valid());
+    EXPECT_LE(CompactStore::bytes_per_account(), 16);
+    EXPECT_FALSE(store.is_open(999999));
+    EXPECT_EQ(store.deposit(5, 10), ACC_CLOSED);
+    EXPECT_EQ(store.deposit(1000000, 10), ACC_CLOSED);
+    EXPECT_TRUE(store.open(5));
+    EXPECT_FALSE(store.open(5));
+    EXPECT_TRUE(store.open(999999));
+    EXPECT_EQ(store.deposit(5, 10), ACC_OK);
+    EXPECT_EQ(store.withdraw(5, 11), ACC_FUNDS);
+    EXPECT_EQ(store.transfer(5, 999999, 4), ACC_OK);
+    EXPECT_EQ(store.transfer(5, 999999, 7), ACC_FUNDS);
+    EXPECT_EQ(store.transfer(5, 6, 1), ACC_CLOSED);
+    EXPECT_EQ(store.balance(5), 6);
+    EXPECT_EQ(store.balance(999999), 4);
+    EXPECT_TRUE(store.close(999999));
+    EXPECT_FALSE(store.close(999999));
+    EXPECT_EQ(store.transfer(5, 999999, 1), ACC_CLOSED);
+
+    // racing lock-free deposits/withdrawals and locked transfers keep the money exact
+    for (int i = 0; i < 4; ++i) store.open(i);
+    std::atomic<long> deposited {6}, withdrawn {0};
+    std::thread threads[4];
+    for (int t = 0; t < 4; ++t) {
+      threads[t] = std::thread([&, t]() {
+        for (int i = 0; i < 20000; ++i) {
+          switch ((i + t) % 3) {
+            case 0: if (store.deposit(i % 4, 3) == ACC_OK) deposited += 3; break;
+            case 1: if (store.withdraw(i % 4, 5) == ACC_OK) withdrawn += 5; break;
+            case 2: store.transfer(i % 4, (i + 1) % 4, 7); break;
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) thread.join();
+    long total = store.balance(5);
+    for (int i = 0; i < 4; ++i) {
+      EXPECT_GE(store.balance(i), 0);
+      total += store.balance(i);
+    }
+    EXPECT_EQ(total, deposited - withdrawn);
+}
+
+TEST(LoggerTest, Test1) {
+    // every queued record is written once flush() returns, and verbosity filters records
+    stringstream output;
+    Logger logger {output};
+    logger.set_verbosity(FAILURES);
+
+    std::thread threads[4];
+    for (int t = 0; t < 4; ++t) {
+      threads[t] = std::thread([&, t]() {
+        for (int i = 0; i < 5000; ++i) {
+          logger.record({t, i, i, i + 1, i, OP_TRANSFER, i % 2 == 0});
+        }
+      });
+    }
+    for (auto& thread : threads) thread.join();
+    logger.flush();
+
+    string line;
+    int lines = 0;
+    while (getline(output, line)) {
+      EXPECT_NE(line.find("failed to complete ledger"), string::npos) << line;
+      lines++;
+    }
+    EXPECT_EQ(lines, 4 * 2500);
+
+    stringstream formatted;
+    Logger all {formatted};
+    all.record({3, 7, 1, 2, 50, OP_TRANSFER, true});
+    all.record({3, 8, 1, 0, 150, OP_BALANCE, true});
+    all.flush();
+    EXPECT_EQ(formatted.str(), "Worker 3 completed ledger 7: transfer $50 from account 1 to account 2\n"
+                               "Worker 3 completed ledger 8: balance of $150 in account 1.\n");
+}
+
+TEST(LoggerTest, Test2) {
+    // latency buckets stay within 1/16 of the value, and dumps count every
+    // recorded sample under its op and kind
+    for (uint64_t ns : {0ull, 1ull, 15ull, 16ull, 17ull, 100ull, 1000ull, 123456ull, 1ull << 36}) {
+      uint64_t low = LatencyHistogram::lowest(LatencyHistogram::bucket_of(ns));
+      EXPECT_LE(low, ns);
+      EXPECT_LE(ns - low, ns / 16);
+    }
+    EXPECT_EQ(LatencyHistogram::bucket_of(~0ull), (size_t)TRACE_BUCKETS - 1);
+
+    // other tests may have recorded samples too (in BANK_TRACE builds), so
+    // compare the count before and after
+    string path = testing::TempDir() + "trace.json";
+    auto close_lock_count = [&]() {
+      EXPECT_TRUE(trace_dump(path));
+      std::ifstream file {path};
+      string json {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+      string key = "\"lock_wait\": {\"count\": ";
+      size_t at = json.find(key, json.find("\"close\""));
+      return at == string::npos ? -1 : stoll(json.substr(at + key.size()));
+    };
+    long long before = close_lock_count();
+    for (int i = 1; i <= 100; ++i) trace_record(TRACE_LOCK, OP_CLOSE, i * 1000);
+    EXPECT_EQ(close_lock_count(), before + 100);
+    remove(path.c_str());
+}
+
+
 /// test load 
 TEST(LedgerTest, Test1){
-    bool done = false;
+    std::atomic<int> readers {1};
 	  std::ifstream file {"short_ledger.txt"};
 	  std::mutex file_lock;
 
   	int ledger_id = 0;
-	  std::queue<Ledger> ledger;
-	  std::mutex ledger_lock;
-	  std::condition_variable empty, fill;
+	  LedgerQueue ledger {DEFAULT_QUEUE_SIZE};
+
+    load_ledger(std::ref(readers), std::ref(ledger_id), std::ref(file), std::ref(file_lock), std::ref(ledger));
 
-    load_ledger(std::ref(done), std::ref(ledger_id), std::ref(file), std::ref(file_lock), 
-                std::ref(ledger), std::ref(ledger_lock), std::ref(empty), std::ref(fill));
-    EXPECT_EQ(ledger.size(), 4);
+    int size = 0;
+    Ledger l;
+    while (ledger.pop(l)) EXPECT_EQ(l.ledgerID, size++);
+    EXPECT_EQ(size, 4);
+    EXPECT_TRUE(ledger.is_closed());
 }
 
 
@@ -299,6 +701,1096 @@ TEST(LedgerTest, Test2) {
 }
 
 
+TEST(LedgerTest, Test3) {
+    // a tiny buffer shared by 4 producers and 4 consumers; every item must
+    // come out exactly once and every consumer must exit after close()
+    LedgerQueue ledger {2};
+    std::atomic<int> producers {4};
+    std::atomic<long> sum {0};
+    std::atomic<int> count {0};
+
+    std::thread pthreads[4], cthreads[4];
+    for (int t = 0; t < 4; ++t) {
+      pthreads[t] = std::thread([&, t]() {
+        for (int i = 0; i < 10000; ++i) ledger.push({t, 0, i, 0, t * 10000 + i});
+        if (--producers == 0) ledger.close();
+      });
+      cthreads[t] = std::thread([&]() {
+        Ledger l;
+        while (ledger.pop(l)) {
+          sum += l.ledgerID;
+          count++;
+        }
+      });
+    }
+    for (auto& thread : pthreads) thread.join();
+    for (auto& thread : cthreads) thread.join();
+
+    EXPECT_EQ(count, 40000);
+    EXPECT_EQ(sum, 40000L * 39999 / 2);
+}
+
+
+TEST(LedgerTest, Test4) {
+    // the mapped parallel reader must produce the same entries and ids as a sequential read
+    std::ifstream file {"pressure_test.txt"};
+    std::vector<std::array<int, 4>> expected;
+    int f, t, a, m;
+    while (file >> f >> t >> a >> m) expected.push_back({f, t, a, m});
+
+    for (int num_readers : {1, 3, 7}) {
+      LedgerQueue ledger {128};
+      read_mapped(num_readers, "pressure_test.txt", ledger);
+
+      std::vector<std::array<int, 4>> actual(expected.size());
+      size_t size = 0;
+      Ledger l;
+      while (ledger.try_pop(l)) {
+        ASSERT_LT(l.ledgerID, (int)expected.size());
+        actual[l.ledgerID] = {l.from, l.to, l.amount, l.mode};
+        size++;
+      }
+      EXPECT_EQ(size, expected.size());
+      EXPECT_EQ(actual, expected) << "with " << num_readers << " readers";
+    }
+}
+
+
+TEST(LedgerTest, Test5) {
+    // text -> binary -> text round trip, and the binary ledger is read back verbatim
+    string binary = testing::TempDir() + "short_ledger.bin";
+    string text = testing::TempDir() + "short_ledger.txt";
+    ASSERT_TRUE(convert_ledger("short_ledger.txt", binary));
+    ASSERT_TRUE(is_binary_ledger(binary));
+    ASSERT_TRUE(convert_ledger(binary, text));
+    EXPECT_FALSE(is_binary_ledger(text));
+
+    std::ifstream expected_file {"short_ledger.txt"}, actual_file {text};
+    int f1, t1, a1, m1, f2, t2, a2, m2, entries = 0;
+    while (expected_file >> f1 >> t1 >> a1 >> m1) {
+      ASSERT_TRUE(actual_file >> f2 >> t2 >> a2 >> m2);
+      EXPECT_TRUE(f1 == f2 && t1 == t2 && a1 == a2 && m1 == m2);
+      entries++;
+    }
+
+    LedgerQueue ledger {16};
+    read_mapped(2, binary, ledger);
+    Ledger l;
+    int size = 0, id_sum = 0;
+    while (ledger.pop(l)) {
+      id_sum += l.ledgerID;
+      size++;
+    }
+    EXPECT_EQ(size, entries);
+    EXPECT_EQ(id_sum, entries * (entries - 1) / 2);
+
+    // a corrupted record fails the checksum and nothing is executed
+    {
+      std::fstream file {binary, std::ios::in | std::ios::out | std::ios::binary};
+      file.seekp(sizeof(LedgerHeader) + offsetof(Ledger, amount));
+      int amount = 1000000;
+      file.write(reinterpret_cast<char*>(&amount), sizeof(amount));
+    }
+    LedgerQueue corrupt {16};
+    read_mapped(2, binary, corrupt);
+    EXPECT_FALSE(corrupt.try_pop(l));
+
+    // a file with the magic number but an unsupported version, or a count
+    // whose size wraps around to the file's, is rejected rather than parsed as text
+    for (LedgerHeader bad : {LedgerHeader {LEDGER_MAGIC, LEDGER_VERSION + 1, 0, 0},
+                             LedgerHeader {LEDGER_MAGIC, LEDGER_VERSION, 1ull << 62, 0}}) {
+      {
+        std::ofstream file {binary, std::ios::binary | std::ios::trunc};
+        file.write(reinterpret_cast<char*>(&bad), sizeof(bad));
+        file << "0 0 5 0\n";
+      }
+      if (bad.count != 0) std::filesystem::resize_file(binary, sizeof(bad));
+      MappedFile mapped {binary};
+      EXPECT_EQ(binary_header(mapped), nullptr);
+      EXPECT_FALSE(convert_ledger(binary, text));
+      LedgerQueue rejected {16};
+      read_mapped(2, binary, rejected);
+      EXPECT_FALSE(rejected.try_pop(l));
+      LedgerQueue listed {16};
+      read_files(2, {binary, "short_ledger.txt"}, listed);
+      int first = -1;
+      if (listed.try_pop(l)) first = l.ledgerID;
+      EXPECT_EQ(first, 0);
+    }
+
+    remove(binary.c_str());
+    remove(text.c_str());
+}
+
+TEST(LedgerTest, Test6) {
+    // the deterministic scheduler matches a sequential replay exactly, for
+    // any worker count and batch size, on a ledger full of conflicts
+    std::mt19937 rng {377};
+    std::vector<Ledger> entries;
+    for (int i = 0; i < 20000; ++i) {
+      int mode = rng() % 100;
+      mode = mode < 30 ? 0 : mode < 55 ? 1 : mode < 85 ? 2 : mode < 93 ? 3 : mode < 97 ? 4 : 5;
+      entries.push_back({(int)(rng() % 16), (int)(rng() % 16), (int)(rng() % 200), mode, i});
+    }
+
+    Bank expected {10};
+    expected.logger.set_verbosity(QUIET);
+    for (const Ledger& l : entries) execute_entry(expected, 0, l);
+    BankSnapshot expected_snap = expected.snapshot();
+    BankStats expected_stats = expected.stats();
+
+    for (auto [workers, batch_size] : {std::pair{2, 7}, {4, 64}, {8, 4096}}) {
+      Bank bank {10};
+      bank.logger.set_verbosity(QUIET);
+      LedgerQueue ledger {16};
+      std::thread reader([&]() {
+        for (const Ledger& l : entries) ledger.push(l);
+        ledger.close();
+      });
+      sequence(bank, workers, batch_size, ledger);
+      reader.join();
+
+      BankSnapshot snap = bank.snapshot();
+      BankStats stats = bank.stats();
+      EXPECT_EQ(snap.balances, expected_snap.balances);
+      for (int op = 0; op < NUM_OPS; ++op) {
+        EXPECT_EQ(stats.succ[op], expected_stats.succ[op]);
+        EXPECT_EQ(stats.fail[op], expected_stats.fail[op]);
+      }
+    }
+}
+
+TEST(LedgerTest, Test7) {
+    // replaying the write-ahead log rebuilds the bank, and a torn record at
+    // the end of the log is dropped
+    string path = testing::TempDir() + "test7.wal";
+    remove(path.c_str());
+
+    Bank bank {10};
+    bank.logger.set_verbosity(QUIET);
+    {
+      WriteAheadLog wal {path};
+      ASSERT_TRUE(wal.valid());
+      bank.wal = &wal;
+      std::thread threads[4];
+      for (int t = 0; t < 4; ++t) {
+        threads[t] = std::thread([&, t]() {
+          for (int i = 0; i < 1000; ++i) {
+            int id = t * 1000 + i;
+            switch (i % 4) {
+              case 0: bank.deposit (t, id, i % 10, 100);                break;
+              case 1: bank.withdraw(t, id, (i + 3) % 10, 30);           break;
+              case 2: bank.transfer(t, id, i % 10, (i + 7) % 10, 50);   break;
+              case 3: bank.check_balance(t, id, i % 10);                break;
+            }
+          }
+        });
+      }
+      for (auto& thread : threads) thread.join();
+      bank.open_account(0, 4000, 20);
+      bank.deposit(0, 4001, 20, 5);
+      bank.close_account(0, 4002, 3);
+      wal.sync();
+      bank.wal = nullptr;
+    }
+
+    {
+      std::ofstream torn {path, std::ios::app | std::ios::binary};
+      torn.write("torn", 4);
+    }
+
+    std::vector<WalRecord> records;
+    ASSERT_TRUE(read_wal(path, records));
+    BankStats stats = bank.stats();
+    EXPECT_EQ(records.size(), stats.successes() - stats.succ[OP_BALANCE] + stats.failures() - stats.fail[OP_BALANCE]);
+
+    Bank recovered {10};
+    for (const WalRecord& rec : records) recovered.replay(rec);
+    EXPECT_EQ(recovered.snapshot().balances, bank.snapshot().balances);
+    EXPECT_TRUE(recovered.replayed(4001));
+    EXPECT_FALSE(recovered.replayed(3));  // a balance check is not logged
+
+    // the torn bytes were cut off, so a second read sees the same log
+    std::vector<WalRecord> again;
+    ASSERT_TRUE(read_wal(path, again));
+    EXPECT_EQ(again.size(), records.size());
+
+    // the log belongs to the ledger it was written for, and another is refused
+    uint64_t ledger = ledger_fingerprint({path});
+    EXPECT_EQ(ledger, ledger_fingerprint({testing::TempDir() + "./test7.wal"}));
+    EXPECT_NE(ledger, ledger_fingerprint({path + ".other"}));
+    std::vector<WalRecord> other;
+    EXPECT_FALSE(read_wal(path, other, ledger));
+    EXPECT_TRUE(other.empty());
+
+    // a failed entry is logged too, so a rerun does not retry it against a
+    // bank where it would now succeed
+    remove(path.c_str());
+    BankConfig config;
+    config.verbosity = QUIET;
+    config.wal_path = path;
+    std::vector<Ledger> entries {{0, 0, 100, 1, 0}, {0, 0, 100, 0, 1}};
+    for (int run = 0; run < 2; ++run) {
+      Bank rerun {10};
+      std::unique_ptr<WriteAheadLog> log;
+      ASSERT_TRUE(prepare_bank(rerun, config, log));
+      for (const Ledger& l : entries) execute_entry(rerun, 0, l);
+      log->sync();
+      EXPECT_TRUE(rerun.replayed(0) || run == 0);
+      EXPECT_EQ(rerun.snapshot().balances[0], std::make_pair(0, 100L));
+      rerun.wal = nullptr;
+    }
+
+    remove(path.c_str());
+}
+
+TEST(LedgerTest, Test8) {
+    // a checkpoint restores every account, closed ones included, and a
+    // corrupted checkpoint is rejected
+    string path = testing::TempDir() + "test8.ckpt";
+    Bank bank {10};
+    bank.logger.set_verbosity(QUIET);
+    for (int i = 0; i < 10; ++i) bank.deposit(0, i, i, 100 * i);
+    bank.transfer(0, 10, 9, 0, 250);
+    bank.close_account(0, 11, 5);
+    for (int i = 0; i < 1000; ++i) bank.open_account(0, 12 + i, 1000 + 7 * i);
+    bank.deposit(0, 1012, 1007, 42);
+    ASSERT_TRUE(bank.checkpoint(path));
+
+    Bank restored;
+    restored.logger.set_verbosity(QUIET);
+    ASSERT_TRUE(restored.restore(path));
+    EXPECT_EQ(restored.snapshot().balances, bank.snapshot().balances);
+    EXPECT_EQ(restored.check_balance(0, 0, 5), -1);
+    EXPECT_EQ(restored.open_account(0, 1, 5), -1);  // closed accounts stay closed
+    EXPECT_EQ(restored.withdraw(0, 2, 1007, 42), 0);
+
+    // checkpointing a restored bank keeps the accounts it never touched
+    string again = path + ".again";
+    ASSERT_TRUE(restored.checkpoint(again));
+    Bank second;
+    ASSERT_TRUE(second.restore(again));
+    EXPECT_EQ(second.snapshot().balances, restored.snapshot().balances);
+    EXPECT_EQ(second.open_account(0, 0, 5), -1);
+    remove(again.c_str());
+
+    // a checkpoint saved next to a write-ahead log includes its records, so
+    // restoring both applies every change once and still skips their ids
+    string wal_path = path + ".wal", logged = path + ".logged";
+    remove(wal_path.c_str());
+    BankConfig config;
+    config.verbosity = QUIET;
+    config.wal_path = wal_path;
+    BankSnapshot expected;
+    {
+      Bank first {10};
+      std::unique_ptr<WriteAheadLog> wal;
+      ASSERT_TRUE(prepare_bank(first, config, wal));
+      first.deposit(0, 0, 1, 100);
+      first.transfer(0, 1, 1, 2, 30);
+      ASSERT_TRUE(first.checkpoint(logged));
+      first.deposit(0, 2, 3, 7);
+      wal->sync();
+      expected = first.snapshot();
+      first.wal = nullptr;
+    }
+    config.checkpoint_path = logged;
+    {
+      Bank resumed;
+      std::unique_ptr<WriteAheadLog> wal;
+      ASSERT_TRUE(prepare_bank(resumed, config, wal));
+      EXPECT_EQ(resumed.checkpointed_records(wal->id()), 2u);
+      EXPECT_EQ(resumed.snapshot().balances, expected.balances);
+      EXPECT_TRUE(resumed.replayed(0));
+      EXPECT_TRUE(resumed.replayed(2));
+
+      // saved again, the checkpoint includes the whole log
+      ASSERT_TRUE(resumed.checkpoint(logged));
+      resumed.wal = nullptr;
+    }
+    {
+      Bank resumed;
+      std::unique_ptr<WriteAheadLog> wal;
+      ASSERT_TRUE(prepare_bank(resumed, config, wal));
+      EXPECT_EQ(resumed.checkpointed_records(wal->id()), 3u);
+      EXPECT_EQ(resumed.snapshot().balances, expected.balances);
+      resumed.wal = nullptr;
+    }
+
+    // with a log it was not saved with, the checkpoint covers none of its
+    // records, so a restart replays all of them
+    string fresh_path = path + ".fresh";
+    remove(fresh_path.c_str());
+    config.wal_path = fresh_path;
+    for (int run = 0; run < 2; ++run) {
+      Bank day2;
+      std::unique_ptr<WriteAheadLog> wal;
+      ASSERT_TRUE(prepare_bank(day2, config, wal));
+      EXPECT_EQ(day2.checkpointed_records(wal->id()), 0u);
+      if (run == 0) {
+        day2.deposit(0, 0, 5, 7);
+        day2.deposit(0, 1, 6, 7);
+        wal->sync();
+      }
+      BankSnapshot snap = day2.snapshot();
+      EXPECT_EQ(snap.total(), expected.total() + 14);
+      day2.wal = nullptr;
+    }
+    remove(fresh_path.c_str());
+    remove(logged.c_str());
+    remove(wal_path.c_str());
+
+    {
+      std::fstream file {path, std::ios::in | std::ios::out | std::ios::binary};
+      file.seekp(sizeof(CheckpointHeader) + 4);
+      file.put(0x7f);
+    }
+    Bank corrupt;
+    EXPECT_FALSE(corrupt.restore(path));
+    {
+      // a count too large for the file is refused before its size is computed
+      std::fstream file {path, std::ios::in | std::ios::out | std::ios::binary};
+      uint64_t count = ~0ull / 4;
+      file.seekp(offsetof(CheckpointHeader, count));
+      file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    }
+    EXPECT_FALSE(corrupt.restore(path));
+
+    remove(path.c_str());
+}
+
+TEST(LedgerTest, Test9) {
+    // generated ledgers follow the op mix, skew and locality they were asked for
+    WorkloadConfig config;
+    config.entries = 20000;
+    config.accounts = 1000;
+    config.zipf = 1.0;
+    config.mix[0] = 1, config.mix[1] = 0, config.mix[2] = 1, config.mix[3] = 0, config.mix[4] = 0, config.mix[5] = 0;
+    config.locality = 1.0;
+
+    std::vector<Ledger> entries = generate_ledger(config);
+    ASSERT_EQ(entries.size(), 20000u + 990u);
+    EXPECT_EQ(entries[0].mode, 4);
+    EXPECT_EQ(entries[0].from, 10);
+    int hot = 0;
+    for (size_t i = 990; i < entries.size(); ++i) {
+      const Ledger& l = entries[i];
+      EXPECT_EQ(l.ledgerID, (int)i);
+      EXPECT_TRUE(l.mode == 0 || l.mode == 2);
+      EXPECT_TRUE(l.from >= 0 && l.from < 1000);
+      if (l.mode == 2) {
+        EXPECT_LE(abs(l.to - l.from), LOCALITY_WINDOW / 2);
+      }
+      hot += l.from < 10;
+    }
+    // ids 0 ... 9 carry about 39% of a Zipf(1) distribution over 1000 ids
+    EXPECT_GT(hot, 20000 * 3 / 10);
+
+    std::vector<Ledger> again = generate_ledger(config);
+    EXPECT_EQ(memcmp(again.data(), entries.data(), entries.size() * sizeof(Ledger)), 0);
+
+    // the default mix, as the benchmarks run it, fails only on short funds
+    WorkloadConfig bench;
+    bench.entries = 50000;
+    bench.zipf = 0.99;
+    Bank bank {10};
+    bank.logger.set_verbosity(QUIET);
+    int failed = 0;
+    for (const Ledger& l : generate_ledger(bench)) failed += execute_entry(bank, 0, l) != 0;
+    EXPECT_LT(failed, 50000 / 10);
+}
+
+TEST(LedgerTest, Test10) {
+    // the engine runs many batches on one pool and reports per-entry results
+    // through futures and callbacks
+    Bank bank {10};
+    bank.logger.set_verbosity(QUIET);
+    std::atomic<int> callbacks {0};
+    {
+      std::vector<std::future<std::vector<int>>> futures;
+      BankEngine engine {bank, 4, 8};
+      std::vector<Ledger> batch;
+      for (int i = 0; i < 10; ++i) batch.push_back({i, 0, 10, 0, i});
+      for (int b = 0; b < 200; ++b) futures.push_back(engine.submit(batch));
+      engine.submit(batch, [&](std::vector<int>&& results) {
+        EXPECT_EQ(std::count(results.begin(), results.end(), 0), 10);
+        callbacks++;
+      });
+
+      for (auto& f : futures) EXPECT_EQ(f.get(), std::vector<int>(10, 0));
+
+      // results come back in entry order
+      std::vector<Ledger> mixed {{0, 0, 1000000, 1, 0}, {42, 0, 5, 0, 1}, {1, 2, 5, 2, 2}, {1, 1, 5, 2, 3}, {3, 0, 0, 3, 4}, {1, 0, 0, 9, 5}};
+      std::vector<int> results = engine.submit(mixed).get();
+      EXPECT_EQ(results, (std::vector<int> {-1, -1, 0, -1, 0, -1}));
+      EXPECT_TRUE(engine.submit(std::span<const Ledger>()).get().empty());
+      // the destructor finishes whatever is still queued
+    }
+
+    EXPECT_EQ(callbacks, 1);
+    EXPECT_EQ(bank.snapshot().total(), 201 * 100);
+
+    // a callback may submit batches that would overflow the queue, and may
+    // shut the engine down; the destructor then joins the workers
+    {
+      std::vector<Ledger> deposits;
+      for (int i = 0; i < 10; ++i) deposits.push_back({i, 0, 10, 0, i});
+      std::atomic<int> nested {0};
+      std::promise<void> stopped_inside;
+      BankEngine engine {bank, 2, 2};
+      engine.submit(deposits, [&](std::vector<int>&&) {
+        for (int b = 0; b < 20; ++b) {
+          engine.submit(deposits, [&](std::vector<int>&& results) {
+            EXPECT_EQ(results, std::vector<int>(10, 0));
+            nested++;
+          });
+        }
+        engine.shutdown();
+        EXPECT_EQ(engine.submit(deposits).get(), std::vector<int>(10, -1));
+        stopped_inside.set_value();
+      });
+      stopped_inside.get_future().wait();
+      EXPECT_EQ(nested, 20);
+    }
+    EXPECT_EQ(bank.snapshot().total(), 222 * 100);
+
+    // a nested submit does not wait for an outside submitter that is blocked
+    // on the full queue the callback's worker has to drain
+    {
+      std::vector<Ledger> large(3200, Ledger {0, 0, 1, 0, 0});
+      std::vector<Ledger> one {{1, 0, 1, 0, 0}};
+      BankEngine engine {bank, 1, 2};
+      std::future<std::vector<int>> nested;
+      engine.submit(one, [&](std::vector<int>&&) {
+        // long enough for the large batch below to fill the queue
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        nested = engine.submit(one);
+      });
+      std::future<std::vector<int>> outside = engine.submit(large);
+      EXPECT_EQ(outside.get(), std::vector<int>(3200, 0));
+      EXPECT_EQ(nested.get(), std::vector<int> {0});
+    }
+    EXPECT_EQ(bank.snapshot().total(), 222 * 100 + 3202);
+
+    BankEngine stopped {bank, 1};
+    stopped.shutdown();
+    EXPECT_EQ(stopped.submit(std::vector<Ledger> {{0, 0, 5, 0, 0}}).get(), std::vector<int> {-1});
+}
+
+TEST(LedgerTest, Test11) {
+    // the server answers pipelined text and binary requests on one Unix socket
+    Bank bank {10};
+    bank.logger.set_verbosity(QUIET);
+    std::string path = testing::TempDir() + "bank_test.sock";
+    BankEngine engine {bank, 2};
+    LedgerServer server {engine, path};
+    ASSERT_TRUE(server.valid());
+    std::thread loop([&]() { server.run(); });
+
+    // text: ids count from 0 per connection; malformed lines fail; the last line needs no newline
+    int fd = connect_to(path);
+    ASSERT_GE(fd, 0);
+    std::string request = "0 0 10 0\n0 0 100 1\nnot a ledger entry\n1 0 0 3\n0 1 5 2";
+    ASSERT_EQ(write(fd, request.data(), request.size()), (ssize_t)request.size());
+    shutdown(fd, SHUT_WR);
+    std::string text;
+    char buf[256];
+    for (ssize_t n; (n = read(fd, buf, sizeof(buf))) > 0; ) text.append(buf, n);
+    close(fd);
+    std::map<int, int> replies;
+    std::istringstream lines {text};
+    for (int id, result; lines >> id >> result; ) replies[id] = result;
+    EXPECT_EQ(replies, (std::map<int, int> {{0, 0}, {1, -1}, {2, -1}, {3, 0}, {4, 0}}));
+
+    // binary: the client picks the ids and the records may arrive in pieces
+    fd = connect_to(path);
+    ASSERT_GE(fd, 0);
+    uint32_t magic = LEDGER_MAGIC;
+    Ledger records[3] {{2, 0, 7, 0, 100}, {2, 0, 8, 1, 101}, {-5, 0, 0, 3, 102}};
+    ASSERT_EQ(write(fd, &magic, sizeof(magic)), (ssize_t)sizeof(magic));
+    ASSERT_EQ(write(fd, records, 30), 30);
+    ASSERT_EQ(write(fd, reinterpret_cast<char*>(records) + 30, sizeof(records) - 30), (ssize_t)sizeof(records) - 30);
+    std::map<int, int> binary;
+    LedgerReply reply;
+    while (binary.size() < 3 && read(fd, &reply, sizeof(reply)) == sizeof(reply)) binary[reply.ledgerID] = reply.result;
+    close(fd);
+    EXPECT_EQ(binary, (std::map<int, int> {{100, 0}, {101, -1}, {102, -1}}));
+
+    server.stop();
+    loop.join();
+    engine.shutdown();
+    EXPECT_EQ(bank.snapshot().total(), 17);
+
+    // ledger ids are the server's own and carry on past the write-ahead log,
+    // so a restarted server's requests are not taken for replayed ones
+    string wal_path = testing::TempDir() + "server_test.wal";
+    std::remove(wal_path.c_str());
+    BankConfig config;
+    config.verbosity = QUIET;
+    config.wal_path = wal_path;
+    auto session = [&](const std::string& request, const std::vector<Ledger>& records) {
+      Bank restarted {10};
+      std::unique_ptr<WriteAheadLog> wal;
+      EXPECT_TRUE(prepare_bank(restarted, config, wal));
+      int first_id = restarted.next_ledger_id();
+      BankEngine session_engine {restarted, 2};
+      LedgerServer session_server {session_engine, path, first_id, wal.get()};
+      std::thread session_loop([&]() { session_server.run(); });
+      int text_fd = connect_to(path);
+      EXPECT_EQ(write(text_fd, request.data(), request.size()), (ssize_t)request.size());
+      shutdown(text_fd, SHUT_WR);
+      for (ssize_t n; (n = read(text_fd, buf, sizeof(buf))) > 0; ) {}
+      close(text_fd);
+      int binary_fd = connect_to(path);
+      EXPECT_EQ(write(binary_fd, &magic, sizeof(magic)), (ssize_t)sizeof(magic));
+      EXPECT_EQ(write(binary_fd, records.data(), records.size() * sizeof(Ledger)), (ssize_t)(records.size() * sizeof(Ledger)));
+      for (size_t i = 0; i < records.size(); ++i) {
+        EXPECT_EQ(read(binary_fd, &reply, sizeof(reply)), (ssize_t)sizeof(reply));
+        EXPECT_EQ(reply.ledgerID, records[i].ledgerID);
+      }
+      // every answered entry is already on disk
+      EXPECT_EQ(std::filesystem::file_size(wal_path), sizeof(WalHeader) + wal->records() * sizeof(WalRecord));
+      close(binary_fd);
+      session_server.stop();
+      session_loop.join();
+      session_engine.shutdown();
+      wal->sync();
+      return std::make_pair(first_id, restarted.snapshot());
+    };
+    auto [first, before] = session("0 0 100 0\n1 0 50 0\n", {{4, 0, 9, 0, 2000000000}});
+    EXPECT_EQ(first, 0);
+    auto [next, after] = session("2 0 70 0\n3 0 30 0\n", {{5, 0, 1, 0, 0}});
+    EXPECT_EQ(next, 3);
+    EXPECT_EQ(after.balances, (std::vector<std::pair<int, long>> {{0, 100}, {1, 50}, {2, 70}, {3, 30}, {4, 9},
+                                                                  {5, 1}, {6, 0}, {7, 0}, {8, 0}, {9, 0}}));
+
+    // replies of batches still running at stop() are written by drain()
+    BankEngine slow {bank, 1};
+    LedgerServer draining {slow, path};
+    std::thread drain_loop([&]() { draining.run(); });
+    std::mutex gate;
+    gate.lock();
+    slow.submit(std::vector<Ledger> {{0, 0, 0, 3, 0}}, [&](std::vector<int>&&) { gate.lock(); gate.unlock(); });
+    fd = connect_to(path);
+    ASSERT_GE(fd, 0);
+    request = "0 0 1 0\n";
+    ASSERT_EQ(write(fd, request.data(), request.size()), (ssize_t)request.size());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    draining.stop();
+    drain_loop.join();
+    gate.unlock();
+    slow.shutdown();
+    draining.drain();
+    text.clear();
+    for (ssize_t n; (n = read(fd, buf, sizeof(buf))) > 0; ) text.append(buf, n);
+    close(fd);
+    EXPECT_EQ(text, "0 0\n");
+}
+
+
+TEST(LedgerTest, Test12) {
+    // per-worker queues: every entry comes out exactly once, entries for one
+    // account share a home queue, and a lone worker steals everything
+    LedgerQueue ledger {4, 4};
+    EXPECT_EQ(ledger.queues(), 4);
+    std::atomic<int> producers {4};
+    std::atomic<long> sum {0};
+    std::atomic<int> count {0};
+
+    std::thread pthreads[4], cthreads[4];
+    for (int t = 0; t < 4; ++t) {
+      pthreads[t] = std::thread([&, t]() {
+        for (int i = 0; i < 10000; ++i) ledger.push({i % 100, 0, i, 0, t * 10000 + i});
+        if (--producers == 0) ledger.close();
+      });
+      cthreads[t] = std::thread([&, t]() {
+        Ledger l;
+        while (ledger.pop(t, l)) {
+          sum += l.ledgerID;
+          count++;
+        }
+      });
+    }
+    for (auto& thread : pthreads) thread.join();
+    for (auto& thread : cthreads) thread.join();
+    EXPECT_EQ(count, 40000);
+    EXPECT_EQ(sum, 40000L * 39999 / 2);
+
+    LedgerQueue lone {64, 4};
+    for (int i = 0; i < 64; ++i) ASSERT_TRUE(lone.try_push({i, 0, 0, 3, i}));
+    lone.close();
+    std::vector<int> seen;
+    Ledger l;
+    while (lone.pop(3, l)) seen.push_back(l.ledgerID);
+    EXPECT_EQ(seen.size(), 64);
+
+    // workers past the index's shard count still get a home for some accounts
+    LedgerQueue wide {1, 100};
+    std::vector<int> homes(100);
+    for (int id = 0; id < 100000; ++id) homes[wide.owner(id)]++;
+    EXPECT_EQ(std::count(homes.begin(), homes.end(), 0), 0);
+    for (int id = 0; id < 1000; ++id) EXPECT_EQ(ledger.owner(id), (int)(AccountIndex::shard(id) * 4 >> INDEX_SHARD_BITS));
+
+    // CPU lists parse, and threads are spread over nodes in contiguous groups
+    EXPECT_EQ(parse_cpu_list("0-2,8,10-11"), (std::vector<int> {0, 1, 2, 8, 10, 11}));
+    CpuTopology topology {{{0, 1, 2, 3}, {4, 5, 6, 7}}};
+    EXPECT_EQ(place_threads(topology, 4), (std::vector<int> {0, 1, 4, 5}));
+    EXPECT_EQ(place_threads(topology, 10), (std::vector<int> {0, 1, 2, 3, 0, 4, 5, 6, 7, 4}));
+    EXPECT_GE(CpuTopology::detect().cpus(), 1);
+
+    // a stealing, pinned run with separate reader and worker counts ends
+    // with the same money as the ledger put in (deposits only, so any order works)
+    string path = testing::TempDir() + "steal_ledger.txt";
+    {
+      std::ofstream out {path};
+      for (int i = 0; i < 5000; ++i) out << i % 10 << " 0 " << 1 + i % 7 << " 0\n";
+    }
+    long expected = 0;
+    for (int i = 0; i < 5000; ++i) expected += 1 + i % 7;
+    BankConfig config;
+    config.verbosity = QUIET;
+    config.steal = true;
+    config.pin = true;
+    config.readers = 2;
+    testing::internal::CaptureStdout();
+    InitBank(4, path, config);
+    std::string output = testing::internal::GetCapturedStdout();
+    long total = 0;
+    std::istringstream lines {output.substr(output.rfind("ID# 0 |"))};
+    for (std::string line; std::getline(lines, line); ) {
+      int id;
+      long balance;
+      if (sscanf(line.c_str(), "ID# %d | %ld", &id, &balance) == 2) total += balance;
+    }
+    EXPECT_EQ(total, expected);
+}
+
+TEST(LedgerTest, Test13) {
+    // shard processes keep every dollar through cross-shard transfers, and a
+    // failed cross-shard transfer gives the held amount back
+    ShardedBank bank {4, QUIET};
+    ASSERT_TRUE(bank.valid());
+    for (int id = 0; id < 100; ++id) ASSERT_TRUE(bank.seed(id, 1000));
+    EXPECT_FALSE(bank.seed(5, 0));
+    int a = 200, b = 201, missing = 100000;
+    while (bank.owner(b) == bank.owner(a)) ++b;
+    while (bank.owner(missing) == bank.owner(a)) ++missing;
+    ASSERT_TRUE(bank.seed(a, 1000));
+    ASSERT_TRUE(bank.seed(b, 1000));
+    ASSERT_TRUE(bank.start());
+
+    std::mt19937 rng(377);
+    std::uniform_int_distribution<int> id {0, 99}, amount {1, 50};
+    int same = 0, entries = 0;
+    for (; entries < 20000; ++entries) {
+      Ledger l {id(rng), id(rng), amount(rng), 2, entries};
+      same += l.from == l.to;
+      ASSERT_TRUE(bank.submit(l));
+    }
+    // Entries from one account run in order on its shard.
+    ASSERT_TRUE(bank.submit({a, b, 300, 2, entries++}));        // commits
+    ASSERT_TRUE(bank.submit({a, missing, 100, 2, entries++}));  // aborts and refunds
+    ASSERT_TRUE(bank.submit({a, b, 5000, 2, entries++}));       // too little money
+    // Held money is gone until the abort comes back, so only 600 is certain to be there.
+    ASSERT_TRUE(bank.submit({a, 0, 600, 1, entries++}));
+    bank.close();
+    EXPECT_TRUE(bank.wait());
+
+    long total = 0;
+    std::map<int, long> balances;
+    for (auto& [acc, balance] : bank.balances()) {
+      balances[acc] = balance;
+      total += balance;
+    }
+    EXPECT_EQ(balances.size(), 102);
+    EXPECT_EQ(balances[a], 100);
+    EXPECT_EQ(balances[b], 1300);
+    EXPECT_EQ(total, 100 * 1000 + 2 * 1000 - 600);
+
+    BankStats stats = bank.stats();
+    EXPECT_EQ(stats.successes() + stats.failures(), entries);
+    EXPECT_EQ(stats.reasons[FAIL_MISSING], 1);
+    EXPECT_EQ(stats.reasons[FAIL_SAME_ACCOUNT], same);
+    EXPECT_GE(stats.reasons[FAIL_FUNDS], 1);
+    EXPECT_EQ(stats.succ[OP_WITHDRAW], 1);
+}
+
+TEST(LedgerTest, Test14) {
+    // a partitioned queue hands each worker only its own accounts, and
+    // workers keep popping mail until nothing is in flight
+    LedgerQueue queue {64, 4, false};
+    EXPECT_TRUE(queue.partitioned());
+    for (int acc = 0; acc < 64; ++acc) ASSERT_TRUE(queue.try_push({acc, 0, 0, 3, acc}));
+    queue.close();
+    std::atomic<int> entries {0}, mail {0};
+    std::thread workers[4];
+    for (int t = 0; t < 4; ++t) {
+      workers[t] = std::thread([&, t]() {
+        LedgerItem item;
+        while (queue.pop(t, item)) {
+          if (item.kind == ITEM_CREDIT) {
+            mail++;
+            queue.end_transfer();
+            continue;
+          }
+          EXPECT_EQ(queue.owner(item.l.from), t);
+          entries++;
+          // Every entry mails a message to the next worker.
+          queue.begin_transfer();
+          queue.post((t + 1) % 4, item.l, ITEM_CREDIT);
+        }
+      });
+    }
+    for (auto& thread : workers) thread.join();
+    EXPECT_EQ(entries, 64);
+    EXPECT_EQ(mail, 64);
+
+    // the two halves of a cross-partition transfer, and the refund when the
+    // destination is closed in between
+    Bank bank {3};
+    bank.logger.set_verbosity(QUIET);
+    bank.single_writer = true;
+    bank.deposit(0, 0, 0, 100);
+    EXPECT_EQ(bank.debit(0, 1, 0, 1, 30), 1);
+    BankSnapshot halfway = bank.snapshot();
+    EXPECT_EQ(halfway.in_transit, 30);
+    EXPECT_EQ(halfway.total(), 100);
+    EXPECT_EQ(bank.credit(0, 1, 0, 1, 30), 0);
+    EXPECT_EQ(bank.debit(0, 2, 0, 2, 50), 1);
+    EXPECT_EQ(bank.close_account(0, 3, 2), 0);
+    EXPECT_EQ(bank.credit(0, 2, 0, 2, 50), -1);
+    bank.refund(0, 50);
+    EXPECT_EQ(bank.debit(0, 4, 0, 1, 500), -1);
+    EXPECT_EQ(bank.debit(0, 5, 0, 2, 5), -1);
+    EXPECT_EQ(bank.debit(0, 6, 0, 9, 5), -1);
+    BankSnapshot snap = bank.snapshot();
+    EXPECT_EQ(snap.balances, (std::vector<std::pair<int, long>> {{0, 70}, {1, 30}}));
+    EXPECT_EQ(snap.in_transit, 0);
+    BankStats stats = bank.stats();
+    EXPECT_EQ(stats.succ[OP_TRANSFER], 1);
+    EXPECT_EQ(stats.reasons[FAIL_CLOSED], 2);
+    EXPECT_EQ(stats.reasons[FAIL_FUNDS], 1);
+    EXPECT_EQ(stats.reasons[FAIL_MISSING], 1);
+
+    // a partitioned run keeps every dollar through transfers between partitions
+    string path = testing::TempDir() + "partition_ledger.txt";
+    long deposited = 0;
+    int count = 0;
+    {
+      std::ofstream out {path};
+      std::mt19937 rng(377);
+      std::uniform_int_distribution<int> id {0, 9}, amount {1, 100};
+      for (; count < 20000; ++count) {
+        if (count % 4 == 0) {
+          int a = amount(rng);
+          deposited += a;
+          out << id(rng) << " 0 " << a << " 0\n";
+        } else {
+          out << id(rng) << " " << id(rng) << " " << amount(rng) << " 2\n";
+        }
+      }
+    }
+    BankConfig config;
+    config.verbosity = QUIET;
+    config.partition = true;
+    testing::internal::CaptureStdout();
+    InitBank(4, path, config);
+    std::string output = testing::internal::GetCapturedStdout();
+    std::istringstream lines {output.substr(output.find("Success"))};
+    long total = 0;
+    int succ = 0, fail = 0;
+    for (std::string line; std::getline(lines, line); ) {
+      int acc;
+      long balance;
+      if (sscanf(line.c_str(), "ID# %d | %ld", &acc, &balance) == 2) total += balance;
+      sscanf(line.c_str(), "Success: %d Fails: %d", &succ, &fail);
+    }
+    EXPECT_EQ(total, deposited);
+    EXPECT_EQ(succ + fail, count);
+
+    // live reports of a partitioned run count the money in the mail
+    string funded = testing::TempDir() + "partition_funded.ckpt";
+    {
+      Bank start {10};
+      start.logger.set_verbosity(QUIET);
+      for (int acc = 0; acc < 10; ++acc) start.deposit(0, acc, acc, 1000);
+      ASSERT_TRUE(start.checkpoint(funded));
+    }
+    string transfers = testing::TempDir() + "partition_transfers.txt";
+    {
+      std::ofstream out {transfers};
+      std::mt19937 rng(377);
+      std::uniform_int_distribution<int> id {0, 9}, amount {1, 100};
+      for (int i = 0; i < 100000; ++i) out << id(rng) << " " << id(rng) << " " << amount(rng) << " 2\n";
+    }
+    config.checkpoint_path = funded;
+    config.report_ms = 1;
+    testing::internal::CaptureStdout();
+    InitBank(4, transfers, config);
+    output = testing::internal::GetCapturedStdout();
+    config.checkpoint_path.clear();
+    config.report_ms = 0;
+    std::istringstream report_lines {output};
+    int reports = 0;
+    for (std::string line; std::getline(report_lines, line); ) {
+      int n, open;
+      long sum;
+      if (sscanf(line.c_str(), "Report %d: %d open accounts, total $%ld", &n, &open, &sum) != 3) continue;
+      reports++;
+      EXPECT_EQ(sum, 10000) << line;
+    }
+    EXPECT_GT(reports, 0);
+
+    // ledger lines cannot pose as the messages workers mail each other
+    string forged = testing::TempDir() + "forged_mail.txt";
+    {
+      std::ofstream out {forged};
+      out << "1 99 500 6\n3 4 1000 6\n0 0 5 0\n0 1 0 7\n";
+    }
+    testing::internal::CaptureStderr();
+    testing::internal::CaptureStdout();
+    InitBank(2, forged, config);
+    output = testing::internal::GetCapturedStdout();
+    testing::internal::GetCapturedStderr();
+    EXPECT_NE(output.find("ID# 0 | 5\n"), std::string::npos);
+    EXPECT_NE(output.find("ID# 4 | 0\n"), std::string::npos);
+    EXPECT_NE(output.find("Success: 1 Fails: 0"), std::string::npos);
+}
+
+
+TEST(LedgerTest, Test15) {
+    // a fused run checks every op against the balance the ops before it leave
+    Bank bank {3};
+    bank.logger.set_verbosity(QUIET);
+    std::vector<RunOp> run {{0, 50, OP_DEPOSIT}, {1, 80, OP_WITHDRAW}, {2, 0, OP_BALANCE},
+                            {3, 40, OP_DEPOSIT}, {4, 80, OP_WITHDRAW}, {5, 0, OP_BALANCE}};
+    EXPECT_EQ(bank.apply_run(0, 0, run), -1);
+    // a hot account's withdrawals see the deposits still on its stripes
+    bank.accounts.find(1)->promote();
+    bank.deposit(0, 6, 1, 100);
+    EXPECT_EQ(bank.apply_run(0, 1, {{7, 100, OP_WITHDRAW}, {8, 5, OP_DEPOSIT}}), 0);
+    EXPECT_EQ(bank.apply_run(0, 2, {{9, 5, OP_DEPOSIT}, {10, 5, OP_DEPOSIT}}), 0);
+    bank.close_account(0, 11, 2);
+    EXPECT_EQ(bank.apply_run(0, 2, {{12, 5, OP_DEPOSIT}, {13, 0, OP_BALANCE}}), -1);
+    EXPECT_EQ(bank.apply_run(0, 9, {{14, 5, OP_DEPOSIT}, {15, 0, OP_BALANCE}}), -1);
+    BankSnapshot snap = bank.snapshot();
+    EXPECT_EQ(snap.balances, (std::vector<std::pair<int, long>> {{0, 10}, {1, 5}}));
+    BankStats stats = bank.stats();
+    EXPECT_EQ(stats.succ[OP_DEPOSIT], 6);
+    EXPECT_EQ(stats.succ[OP_WITHDRAW], 2);
+    EXPECT_EQ(stats.succ[OP_BALANCE], 2);
+    EXPECT_EQ(stats.reasons[FAIL_FUNDS], 1);
+    EXPECT_EQ(stats.reasons[FAIL_CLOSED], 2);
+    EXPECT_EQ(stats.reasons[FAIL_MISSING], 2);
+
+    // a run ends where a transfer touches its account, and takes the place of its first entry
+    LedgerQueue queue {16, 1, true, true};
+    EXPECT_TRUE(queue.fuses());
+    std::vector<Ledger> batch {{0, 0, 5, 0, 0}, {1, 0, 5, 0, 1}, {0, 0, 3, 1, 2}, {0, 1, 2, 2, 3},
+                               {0, 0, 1, 0, 4}, {0, 0, 0, 3, 5}, {4, 0, 0, 4, 6}};
+    push_batch(batch.data(), batch.data() + batch.size(), queue);
+    queue.close();
+    std::vector<int> modes, ids;
+    LedgerItem item;
+    while (queue.pop(0, item)) {
+      const Ledger& l = item.l;
+      modes.push_back(item.kind == ITEM_RUN ? -1 : l.mode);
+      ids.push_back(l.ledgerID);
+      if (item.kind != ITEM_RUN) continue;
+      EXPECT_EQ(l.from, 0);
+      EXPECT_EQ(queue.run(l.to).size(), 2u);
+      queue.release_run(l.to);
+    }
+    EXPECT_EQ(modes, (std::vector<int> {-1, 0, 2, -1, 4}));
+    EXPECT_EQ(ids, (std::vector<int> {0, 1, 3, 4, 6}));
+
+    // fusing keeps every outcome of a sequential run, and every dollar with several workers
+    string path = testing::TempDir() + "fuse_ledger.txt";
+    long deposited = 0;
+    int count = 0;
+    {
+      std::ofstream out {path};
+      std::mt19937 rng(377);
+      std::uniform_int_distribution<int> id {0, 4}, amount {1, 100}, mode {0, 9};
+      for (; count < 20000; ++count) {
+        int m = mode(rng);
+        if (m < 5) {
+          int a = amount(rng);
+          deposited += a;
+          out << id(rng) << " 0 " << a << " 0\n";
+        } else if (m < 8) {
+          out << id(rng) << " 0 0 3\n";
+        } else {
+          out << id(rng) << " " << id(rng) << " " << amount(rng) << " 2\n";
+        }
+      }
+    }
+    BankConfig config;
+    config.verbosity = QUIET;
+    config.readers = 1;
+    testing::internal::CaptureStdout();
+    InitBank(1, path, config);
+    std::string plain = testing::internal::GetCapturedStdout();
+    config.fuse = true;
+    testing::internal::CaptureStdout();
+    InitBank(1, path, config);
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), plain);
+
+    config.readers = 0;
+    testing::internal::CaptureStdout();
+    InitBank(4, path, config);
+    std::string output = testing::internal::GetCapturedStdout();
+    std::istringstream lines {output.substr(output.find("Success"))};
+    long total = 0;
+    int succ = 0, fail = 0;
+    for (std::string line; std::getline(lines, line); ) {
+      int acc;
+      long balance;
+      if (sscanf(line.c_str(), "ID# %d | %ld", &acc, &balance) == 2) total += balance;
+      sscanf(line.c_str(), "Success: %d Fails: %d", &succ, &fail);
+    }
+    EXPECT_EQ(total, deposited);
+    EXPECT_EQ(succ + fail, count);
+
+    // modes no ledger may use are skipped, in text and binary ledgers, fused or not
+    string forged = testing::TempDir() + "forged_ledger.txt";
+    {
+      std::ofstream out {forged};
+      out << "0 3 1 8\n0 0 5 0\n1 99 500 6\n0 0 0 7\n";
+    }
+    std::vector<Ledger> records {{0, 3, 1, 8, 0}, {0, 0, 5, 0, 1}, {1, 99, 500, 6, 2}, {0, 0, 0, -1, 3}};
+    LedgerHeader header {LEDGER_MAGIC, LEDGER_VERSION, records.size(), 0};
+    for (const Ledger& r : records) header.checksum += record_checksum(r);
+    {
+      std::ofstream out {forged + ".bin", std::ios::binary};
+      out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Ledger));
+    }
+    for (const string& file : {forged, forged + ".bin"}) {
+      for (bool fuse : {false, true}) {
+        config.fuse = fuse;
+        testing::internal::CaptureStderr();
+        testing::internal::CaptureStdout();
+        InitBank(2, file, config);
+        output = testing::internal::GetCapturedStdout();
+        std::string errors = testing::internal::GetCapturedStderr();
+        EXPECT_NE(output.find("ID# 0 | 5\n"), std::string::npos);
+        EXPECT_NE(output.find("Success: 1 Fails: 0"), std::string::npos);
+        EXPECT_NE(errors.find("Skipping malformed ledger entry 2"), std::string::npos);
+      }
+    }
+}
+
+TEST(LedgerTest, Test16) {
+    // a followed ledger yields what is appended, waits for the rest of a
+    // partial line, and closes the buffer on SIGTERM
+    string path = testing::TempDir() + "follow_ledger.txt";
+    {
+      std::ofstream out {path};
+      out << "0 0 5 0\n1 0 6 0\n";
+    }
+    LedgerQueue queue {64};
+    std::thread reader([&]() {
+      sigset_t stop;
+      sigemptyset(&stop);
+      sigaddset(&stop, SIGINT);
+      sigaddset(&stop, SIGTERM);
+      pthread_sigmask(SIG_BLOCK, &stop, nullptr);
+      read_follow(path, queue);
+    });
+
+    Ledger l;
+    ASSERT_TRUE(queue.pop(l));
+    EXPECT_EQ(l.ledgerID, 0);
+    ASSERT_TRUE(queue.pop(l));
+    EXPECT_EQ(l.amount, 6);
+    std::ofstream out {path, std::ios::app};
+    out << "2 0 7" << std::flush;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(queue.try_pop(l));
+    out << " 0\n3 0 0 3\n" << std::flush;
+    ASSERT_TRUE(queue.pop(l));
+    EXPECT_EQ(l.from, 2);
+    EXPECT_EQ(l.amount, 7);
+    EXPECT_EQ(l.ledgerID, 2);
+    ASSERT_TRUE(queue.pop(l));
+    EXPECT_EQ(l.mode, 3);
+    EXPECT_EQ(l.ledgerID, 3);
+
+    pthread_kill(reader.native_handle(), SIGTERM);
+    EXPECT_FALSE(queue.pop(l));
+    reader.join();
+    EXPECT_TRUE(queue.is_closed());
+}
+
+TEST(LedgerTest, Test17) {
+    // a directory of text and binary ledgers is read by both FileReader
+    // back ends, and its ledger ids run on from one file to the next
+    string dir = testing::TempDir() + "ledger_dir";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    {
+      std::ofstream a {dir + "/a.txt"};
+      a << "0 0 5 0\n1 0 6 0\n";
+      std::ofstream b {testing::TempDir() + "ledger_dir_b.txt"};
+      b << "2 0 7 0\n0 1 8 0\n";
+      std::ofstream c {dir + "/c.txt"};
+      c << "3 0 0 3\n\n4 0 9 0";
+      std::ofstream hidden {dir + "/.skip"};
+      hidden << "5 0 1 0\n";
+    }
+    ASSERT_TRUE(convert_ledger(testing::TempDir() + "ledger_dir_b.txt", dir + "/b.bin"));
+    vector<string> files = ledger_files({dir});
+    ASSERT_EQ(files.size(), 3);
+    EXPECT_EQ(files[1], dir + "/b.bin");
+
+    for (bool use_uring : {true, false}) {
+      FileReader reader {2, use_uring};
+      vector<int> seen(files.size());
+      reader.read_all(files, [&](size_t index, vector<char>& data, bool ok) {
+        EXPECT_TRUE(ok);
+        EXPECT_EQ(data.size(), std::filesystem::file_size(files[index]));
+        seen[index]++;
+      });
+      EXPECT_EQ(seen, vector<int>(files.size(), 1));
+    }
+
+    LedgerQueue queue {64};
+    read_files(2, files, queue);
+    EXPECT_TRUE(queue.is_closed());
+    map<int, Ledger> by_id;
+    Ledger l;
+    while (queue.try_pop(l)) by_id[l.ledgerID] = l;
+    ASSERT_EQ(by_id.size(), 6);
+    EXPECT_EQ(by_id[2].amount, 7);
+    EXPECT_EQ(by_id[3].from, 0);
+    EXPECT_EQ(by_id[3].to, 1);
+    EXPECT_EQ(by_id[4].mode, 3);
+    EXPECT_EQ(by_id[5].amount, 9);
+
+    // binary records are numbered by position whichever reader takes them,
+    // not by the ids they were stored with
+    string forged = testing::TempDir() + "stored_ids.bin";
+    {
+      vector<Ledger> records {{2, 0, 7, 0, 70}, {0, 1, 8, 0, 90}};
+      LedgerHeader header {LEDGER_MAGIC, LEDGER_VERSION, records.size(), 0};
+      for (const Ledger& r : records) header.checksum += record_checksum(r);
+      std::ofstream file {forged, std::ios::binary | std::ios::trunc};
+      file.write(reinterpret_cast<char*>(&header), sizeof(header));
+      file.write(reinterpret_cast<char*>(records.data()), records.size() * sizeof(Ledger));
+    }
+    auto ids_of = [&](LedgerQueue& read) {
+      map<int, int> ids;  // ledger id -> amount
+      while (read.try_pop(l)) ids[l.ledgerID] = l.amount;
+      return ids;
+    };
+    LedgerQueue mapped {64}, listed {64};
+    read_mapped(2, forged, mapped);
+    read_files(2, {forged, dir + "/a.txt"}, listed);
+    EXPECT_EQ(ids_of(mapped), (map<int, int> {{0, 7}, {1, 8}}));
+    EXPECT_EQ(ids_of(listed), (map<int, int> {{0, 7}, {1, 8}, {2, 5}, {3, 6}}));
+    remove(forged.c_str());
+}
 
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);